@@ -12,6 +12,7 @@ require "pwa/lib/#{ENV['OS_NAME']}/norm_int.so"
 require "utils.rb"
 require "pwa/lib/#{ENV['OS_NAME']}/cppvector"
 require "norm-int/norm_int_utils.rb"
+require "pwa/kinvar.rb"
 include PWA
 #
 # global vars
@@ -43,10 +44,11 @@ end
 #
 # The method below is called by the norm control file for each bin.
 # The code below then calls a compiled C function (see norm_int.cpp and 
-# norm_int_utils.rb).
+# norm_int_utils.rb). If _selection_ is given, events which fail it (see
+# PWA::KinvarFile#select, using the bin's kinvar.xml) are also cut.
 #
 def gen_norm_int_file(bin_name,coherence,total_events,cuts_file_name,
-                      scale_factors,max_events,amp_str = "")
+                      scale_factors,max_events,amp_str = "",selection = nil)
   current_dir = Dir.new("#{$top_dir}/#{$type}/#{bin_name}/")
   print ":::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::\n"
   print ":::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::\n"
@@ -87,9 +89,17 @@ def gen_norm_int_file(bin_name,coherence,total_events,cuts_file_name,
     end
   else event_no = num_amps
   end
+  unless(selection.nil?) # done natively over the binary kinvar file
+    kv_file = PWA::KinvarFile.new(current_dir.path.to_s + "/kinvar.xml")
+    cuts = kv_file.select(selection,(cuts_on != 0) ? cuts : nil)
+    cuts_on = 1
+    event_no = cuts.length
+    print "selection = #{selection}\n"
+  end
 
   elem = Element.new('cuts-info')
   elem.add_attribute('cuts-file-name',cuts_file_name)
+  elem.add_attribute('selection',selection) unless(selection.nil?)
   norm_int_key.add_element(elem)
 
   errsq = 0.0
@@ -133,6 +143,7 @@ def gen_norm_int_file(bin_name,coherence,total_events,cuts_file_name,
   print ", relative error = " + (errsq**0.5).to_s + "\n"
   print "cuts file = #{cuts_file_name}\n"
 
+  bin_sets = [] # for the binary sidecar
   coh_strs.each{|str|
     @coh_amps = get_coh_amps_for_string(current_dir,str,bin_name,amp_match)
     num_coh_amps = @coh_amps.length
@@ -159,22 +170,23 @@ def gen_norm_int_file(bin_name,coherence,total_events,cuts_file_name,
       waveset.add_element(wave)
     }
     num_amps = calc_coherent_sums(num_coh_amps,cuts_on,cuts,event_no)
+    bin_sets.push [str,@coh_amps.collect{|amp| amp.split('/').last},
+                   @cross_term_ints,total_factor]
 
     norm_elements = Element.new("normint-elements")
+    # 1 bulk copy of the sums (see CppVectorFlt2D#to_packed_data), rather 
+    # than converting each element to a Complex
+    sums = @cross_term_ints.to_packed_data.unpack('f*')
     num_coh_amps.times do|i|
       row = Element.new("row")
       sum_string = ""
       num_coh_amps.times do |j|
-	if @cross_term_ints[i,j].real.to_s == "0.0" || @cross_term_ints[i,j].real.to_s == "-0.0"
-	  term_real = "0"
-	else term_real = (@cross_term_ints[i,j].real * total_factor).to_s
-	end
-	if @cross_term_ints[i,j].imag.to_s == "0.0" || @cross_term_ints[i,j].imag.to_s == "-0.0"
-	  term_imag = "0"
-	else term_imag = (@cross_term_ints[i,j].imag * total_factor).to_s
-	end
-	sum_string += sprintf("\(%g\,%g\)\|",term_real.to_f,term_imag.to_f)
-#	sum_string += "(" + term_real + "\," + term_imag + ")\|"
+	terms = sums[2*(i*num_coh_amps + j),2].collect{|term| 
+	  (term == 0) ? 0 : term*total_factor
+	}
+	# (all 17 digits, so reading the XML gives the same doubles the 
+	# sidecar holds)
+	sum_string += sprintf("\(%.17g\,%.17g\)\|",*terms)
       end
       sum_string.chop
       row.add_text(sum_string)
@@ -195,9 +207,12 @@ def gen_norm_int_file(bin_name,coherence,total_events,cuts_file_name,
   file = File.open(filename,"w")
   xml_norm_int.add_element(norm_int_key)
   xml_norm_int.write(file,-1,false)
+  file.close
+  bin_file = write_norm_int_bin(filename,bin_sets)
   print ":::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::\n"
   print "Computed sums for " + coh_strs.size.to_s + " incoherent wavesets.\n"
   print "File name : " + filename + "\n"
+  print "Binary file name : " + bin_file + "\n"
 end
 
 #
@@ -6,6 +6,7 @@
 require 'optparse'
 require 'pwa/dataset'
 require 'pwa/fcn'
+require 'pwa/bin_scheduler'
 require 'utils'
 require 'minuit'
 #
@@ -19,6 +20,10 @@ fcn = PWA::Fcn.instance
 # parse the command line
 #
 test_derivs = false
+check_precision = false
+precision = nil
+shm_procs = 1
+bin_jobs = 0
 cmdline = OptionParser.new
 cmdline.banner = 'Usage: fit.rb [...options...] fit-ctrl.rb'
 cmdline.on('-h','--help','Prints help to screen'){puts cmdline; exit}
@@ -33,22 +38,96 @@ cmdline.on('-b [min-max,min-max,...]',Array,'Only use bins in range'){ |r|
 }
 cmdline.on('-i [#]',String,'Number of iterations'){|i| fcn.num_iters = i.to_i}
 cmdline.on('--test-derivs','Test derivatives then exit'){test_derivs = true}
+cmdline.on('--precision double|mixed',String,
+	   'Arithmetic used for all evt datasets'){|p| precision = p.to_sym}
+cmdline.on('--check-precision',
+	   'Compare mixed to double precision -log(L) then exit'){
+  check_precision = true
+}
+cmdline.on('--shm #',String,'Number of forked (shared memory) processes'){|n|
+  shm_procs = n.to_i
+}
+cmdline.on('--bins-parallel #',String,
+	   'Fit each bin separately, # at a time (largest 1st)'){|n|
+  bin_jobs = n.to_i
+}
+cmdline.on('--numa-nodes n|cpus:cpus:...',String,
+	   'Override the NUMA topology (# of nodes or cpulist per node)'){|n|
+  ENV['PWA_NUMA_NODES'] = n
+}
+cmdline.on('--analytic-hesse [fisher]',String,
+	   'Write the covariance from the analytic 2nd derivatives'){|h|
+  fcn.analytic_hesse = (h == 'fisher') ? :fisher : :hessian
+}
+cmdline.on('--trace file[,call]',Array,
+	   'Write a Chrome trace of fcn call (default 1st) to file'){|t|
+  fcn.trace_file = t[0]
+  fcn.trace_call = t[1].nil? ? 1 : t[1].to_i
+}
 ctrl_file = cmdline.parse(ARGV)[0]
+PWA::Fcn.defer_parameters = true if(bin_jobs > 0) # (see BinScheduler)
 require ctrl_file
+unless(precision.nil?)
+  PWA::Dataset.each{|dset| dset.precision = precision if(dset.type == :evt)}
+end
+if(bin_jobs > 0)
+  #
+  # Fork a fit for each bin (each one continues below w/ only its bin, the
+  # scheduler just waits for them)
+  #
+  if(parallel? or shm_procs > 1)
+    raise '--bins-parallel can not be used w/ MPI or --shm' 
+  end
+  failed = PWA::BinScheduler.start(bin_jobs,File.dirname(ctrl_file))
+  unless(PWA::BinScheduler.active?)
+    puts "fits failed for bins: #{failed.join(' ')}" unless(failed.empty?)
+    exit(failed.empty? ? 0 : 1)
+  end
+end
 PWA::Parallel.divide if(parallel?) # divide up datasets amongst available nodes
-if(node == 0) 
+if(shm_procs > 1 and !parallel?)
   #
-  # Running on the master (or only if not parallel) node
+  # Fork the workers (they handle their share of the datasets until the master
+  # tells them to exit)
   #
   PWA::Dataset.each{|dset| print_line(':'); dset.print_set_up}
   print_line(':')
   puts 'reading in amplitudes...'
+  max_par_id = Minuit::Parameter.max_id
+  if(PWA::ShmParallel.start(shm_procs,max_par_id) != 0)
+    begin
+      PWA::ShmParallel.each_dataset_on_node{|dataset| 
+	puts dataset.init_for_fit(max_par_id)
+      }
+      PWA::ShmParallel.serve(fcn)
+    rescue Exception
+      puts "worker #{PWA::ShmParallel.node}: #{$!}"
+      exit!(1)
+    end
+    exit!(0)
+  end
+end
+if(node == 0) 
+  #
+  # Running on the master (or only if not parallel) node
+  #
+  unless(PWA::ShmParallel.active?)
+    PWA::Dataset.each{|dset| print_line(':'); dset.print_set_up}
+    print_line(':')
+    puts 'reading in amplitudes...'
+  end
   if(parallel?)
+    PWA::Parallel.show_divide
     PWA::Parallel.send_to_children(Minuit::Parameter.max_id,:max_par)
     PWA::Parallel.each_dataset_on_node{|dataset| 
       puts dataset.init_for_fit(Minuit::Parameter.max_id)
     }
     PWA::Parallel.recv_from_children(:message).each{|m| puts m}
+  elsif(PWA::ShmParallel.active?)
+    PWA::ShmParallel.show_divide
+    PWA::ShmParallel.each_dataset_on_node{|dataset| 
+      puts dataset.init_for_fit(Minuit::Parameter.max_id)
+    }
   else 
     PWA::Dataset.each{|dataset| 
       puts dataset.init_for_fit(Minuit::Parameter.max_id)
@@ -67,6 +146,24 @@ if(node == 0)
       puts "#{name} => numeric: #{numeric} analytic: #{analytic}"
     }
     PWA::Parallel.send_to_children(true,:terminate) if(parallel?)
+    PWA::ShmParallel.stop if(PWA::ShmParallel.active?)
+    exit
+  end
+  #
+  # Compare mixed to double precision (if wanted)
+  #
+  if(check_precision)
+    if(parallel? or PWA::ShmParallel.active?)
+      raise '--check-precision is not available in parallel mode'
+    end
+    pars = Array.new(Minuit::Parameter.max_id + 1)
+    Minuit::Parameter.each{|par| pars[par.id] = par.value}
+    PWA::Dataset.each{|dset|
+      next unless(dset.type == :evt)
+      log_l_diff,deriv_diff = dset.check_precision(pars)
+      printf("%s => -log(L) rel diff: %.2e  max deriv diff: %.2e\n",
+	     dset.name,log_l_diff,deriv_diff)
+    }
     exit
   end
   #
@@ -75,6 +172,7 @@ if(node == 0)
   fcn.out_path = File.dirname(ctrl_file)
   fcn.minimize
   PWA::Parallel.send_to_children(true,:terminate) if(parallel?)
+  PWA::ShmParallel.stop if(PWA::ShmParallel.active?)
 else 
   #
   # Running on (one of) the child node(s)
@@ -87,15 +185,21 @@ else
   PWA::Parallel.send_to_master(msg,:message)
   loop{
     break if(PWA::Parallel.recv_from_master(:terminate))
+    scales = PWA::Parallel.recv_from_master(:rebalance)
+    unless(scales.nil?) # re-divide the datasets w/ these cost scales
+      PWA::Parallel.redivide(scales,max_par_id)
+      fcn.datasets_changed
+    end
     flag = PWA::Parallel.recv_from_master(:fcn_flag)
     pars = PWA::Parallel.recv_from_master(:params)
-    fcn_val,derivs = [],[]
-    PWA::Parallel.each_dataset_on_node{|dataset|
-      dset_derivs = Array.new(pars.length,0)
-      fcn_val.push(dataset.fcn_val(flag,pars,dset_derivs))
-      derivs.push dset_derivs
-    }
-    PWA::Parallel.send_to_master(fcn_val,:fcn_val)
-    PWA::Parallel.send_to_master(derivs,:derivs) if(flag == 2)
+    derivs = PWA::Parallel.recv_from_master(:derivs) # (nil if not wanted)
+    if(PWA::Fcn.hessian_flag?(flag))
+      PWA::Parallel.send_to_master(fcn.hessian_on_node(flag,pars),:hessian)
+      next
+    end
+    start = Time.now
+    fcn_val = fcn.fcn_on_node(flag,pars,derivs)
+    PWA::Parallel.send_to_master([fcn_val,Time.now - start],:fcn_val)
+    PWA::Parallel.send_to_master([derivs],:derivs) if(flag == 2)
   }
 end
@@ -24,6 +24,9 @@ cmdline.on('-b min-max,min-max,...',Array,'Only use bins in range'){|r|
   options[:b] = r.join(',')
 } 
 cmdline.on('-p #',String,'Number of processors'){|p| options[:p] = p}
+cmdline.on('-f #',String,'Number of forked processes (no MPI)'){|f| 
+  options[:f] = f
+}
 cmdline.on('-i #',String,'Number of iterations'){|i| options[:i] = i}
 cmdline.on('--test-derivs','Test derivatives then exit'){
   options[:test_derivs] = true
@@ -44,6 +47,7 @@ else
   cmd = "mpirun -np #{options[:p]} mpi_ruby #{path2fit}/fit.rb  "
 end
 cmd += ' --test-derivs' unless options[:test_derivs].nil?
+cmd += " --shm #{options[:f]}" unless options[:f].nil?
 cmd += " -b #{options[:b]}" unless options[:b].nil?
 cmd += " -i #{options[:i]}" unless options[:i].nil?
 cmd += " #{ctrl_file}"
@@ -49,6 +49,27 @@ module PWA
       }
     end
     #
+    # Returns the MINUIT parameter ids used by this amplitude.
+    #
+    def par_ids
+      ids = []
+      @params.each_index{|id| ids.push id unless @params[id].nil?}
+      ids
+    end
+    #
+    # Moves the parameters to new ids, <tt>old2new[id]</tt> is the new id of 
+    # parameter _id_ (see BinScheduler).
+    #
+    def remap_par_ids(old2new)
+      params = Array.new
+      @params.each_index{|id|
+	next if(@params[id].nil?)
+	raise "#{@file}: no new id for parameter #{id}" if(old2new[id].nil?)
+	params[old2new[id]] = @params[id]
+      }
+      @params = params
+    end
+    #
     # Add a MINUIT parameter for this amplitude.
     #
     def add_parameter(id,handle,deriv_method) 
@@ -66,5 +87,22 @@ module PWA
       @params[id].deriv_method.call(@pars_hash,vars)
     end
     #
+    # Returns the 2nd derivative w/r to parameters _id1_ and _id2_ (at the
+    # values of the last set_pars), from central differences of
+    # deriv(_id1_) in _id2_. It's 0 if the value is linear in them.
+    #
+    def deriv2(id1,id2,vars=nil)
+      return 0 if(@params[id1].nil? or @params[id2].nil?)
+      handle = @params[id2].handle
+      val = @pars_hash[handle]
+      step = 1e-4*[val.abs,1.0].max
+      @pars_hash[handle] = val + step
+      up = self.deriv(id1,vars)
+      @pars_hash[handle] = val - step
+      down = self.deriv(id1,vars)
+      @pars_hash[handle] = val
+      (up - down)/(2*step)
+    end
+    #
   end
 end
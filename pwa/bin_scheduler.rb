@@ -0,0 +1,130 @@
+# Author:: Mike Williams
+require 'pwa/parallel'
+require 'pwa/fcn'
+require "pwa/lib/#{ENV['OS_NAME']}/fcn_sum"
+module PWA
+  #
+  # The PWA::BinScheduler module runs the (independent) fits of many bins 
+  # after loading the fit control file only once (w/ Fcn.defer_parameters 
+  # set, so no MINUIT parameters are defined yet). Each bin is fit on its own
+  # forked process, up to _jobs_ of them at a time. It drops the other bins' 
+  # Datasets, sets <tt>$bin_ranges</tt> to just its bin and defines only that
+  # bin's parameters (renumbered from 1). Bins are started largest 1st (see 
+  # Parallel.dataset_cost) so the small ones fill in at the end, and each 
+  # fit's FcnSum gets an even share of the CPUs among the fits still to run
+  # (so the last few get more threads). Each bin writes the same output XML
+  # <tt>fit.rb -b min-max</tt> would, plus a log of what it printed.
+  #
+  module BinScheduler
+    # Bin fit by this process (nil if not running or on the scheduler)
+    @@bin = nil
+    #
+    # Is this process fitting a bin for the scheduler?
+    #
+    def BinScheduler.active?; !@@bin.nil?; end
+    #
+    # Which bin is this process fitting?
+    #
+    def BinScheduler.bin; @@bin; end
+    #
+    # Returns the bin (eg. <tt>Wbin1700-1710</tt>) _dataset_ is for (nil if 
+    # it's not bin dependent). Dataset definition files name them 
+    # <tt>name:bin</tt>.
+    #
+    def BinScheduler.dataset_bin(dataset)
+      bin = dataset.name.split(':').last
+      bin_info(bin).nil? ? nil : bin
+    end
+    #
+    # Returns Array of <tt>[bin,cost]</tt> for all bins w/ Datasets defined, 
+    # largest 1st.
+    #
+    def BinScheduler.bin_costs
+      costs = {}
+      Dataset.each{|dataset|
+	bin = BinScheduler.dataset_bin(dataset)
+	next if(bin.nil?)
+	costs[bin] = costs[bin].to_f + Parallel.dataset_cost(dataset)
+      }
+      costs.to_a.sort_by{|bin,cost| [-cost,bin]}
+    end
+    #
+    # Number of CPUs shared by the fits (see FcnSum.numa_nodes)
+    #
+    def BinScheduler.num_cpus; FcnSum.numa_nodes.flatten.length; end
+    #
+    # Forks a process for each bin (_jobs_ at a time) and waits for them. In 
+    # each forked process, this returns its bin once it's set up to fit only
+    # that bin (its output now goes to <tt>log_path/min-max.log</tt>), it 
+    # should then run the fit as usual and exit. In the scheduler, it returns 
+    # the bins whose fits failed once they're all done.
+    #
+    def BinScheduler.start(jobs,log_path)
+      bins = BinScheduler.bin_costs
+      raise 'no bin dependent Datasets to fit' if(bins.empty?)
+      cpus = BinScheduler.num_cpus
+      running,failed = {},[] # running is pid => [bin,start time]
+      puts "fitting #{bins.length} bins, #{jobs} at a time on #{cpus} CPUs"
+      until(bins.empty? and running.empty?)
+	while(!bins.empty? and running.length < jobs)
+	  bin,cost = *bins.shift
+	  num_fits = [jobs,running.length + 1 + bins.length].min
+	  threads = [cpus/num_fits,1].max
+	  STDOUT.flush
+	  pid = fork
+	  if(pid.nil?)
+	    BinScheduler._set_up_bin(bin,threads,log_path)
+	    return bin
+	  end
+	  running[pid] = [bin,Time.now]
+	  printf("started %s (cost: %.3g threads: %d)\n",bin,cost,threads)
+	end
+	pid,status = *Process.wait2
+	bin,start = *running.delete(pid)
+	next if(bin.nil?)
+	failed.push bin unless(status.success?)
+	printf("finished %s in %.1f s%s\n",bin,Time.now - start,
+	       status.success? ? '' : ' (FAILED, see its log)')
+      end
+      failed
+    end
+    #
+    # Sets up this (forked) process to fit only _bin_ w/ _threads_ threads.
+    #
+    def BinScheduler._set_up_bin(bin,threads,log_path)
+      @@bin = bin
+      min,max = *bin_info(bin)[2,2]
+      $bin_ranges = [[min.to_i,max.to_i]]
+      Dataset.keep_if{|dataset| 
+	dset_bin = BinScheduler.dataset_bin(dataset)
+	(dset_bin.nil? or dset_bin == bin)
+      }
+      BinScheduler._define_bin_parameters
+      ENV['PWA_NUM_THREADS'] = threads.to_s # (read when FcnSum is built)
+      log = "#{log_path}/#{bin_ranges_to_s($bin_ranges)}.log"
+      STDOUT.reopen(log,'w')
+      STDERR.reopen(STDOUT)
+      STDOUT.sync = true
+    end
+    #
+    # Defines only the current bin's parameters (in ParIDs and MINUIT, ids 
+    # start from 1 again) and moves the kept Datasets' amps to the new ids.
+    #
+    def BinScheduler._define_bin_parameters
+      old_ids = ParIDs.names2ids
+      ParIDs.set(Hash.new)
+      Fcn.defer_parameters = false
+      Fcn.instance.define_parameters
+      old2new = Array.new
+      old_ids.each{|name,id| 
+	old2new[id] = ParIDs[name] unless(ParIDs.names2ids[name].nil?)
+      }
+      amps = {} # (an amp may be in more than 1 Dataset, only move it once)
+      Dataset.each{|dataset| 
+	dataset.each_amp{|amp,ic,a| amps[amp.object_id] = amp}
+      }
+      amps.each_value{|amp| amp.remap_par_ids(old2new)}
+    end
+    #
+  end
+end
@@ -33,6 +33,12 @@ module PWA
     #
     attr_reader :type
     #
+    # <tt>[lo,hi]</tt> if only the events from fraction _lo_ to _hi_ of this 
+    # Dataset are handled by this process (<tt>nil</tt> for all of them). Set
+    # by PWA::Parallel when splitting up large Datasets.
+    #
+    attr_accessor :part
+    #
     # global list of all Dataset's
     #
     @@all = Array.new
@@ -44,7 +50,7 @@ module PWA
       self.extend PWA::Dcs if(type == :dcs)
       self.extend PWA::Evt if(type == :evt)
       @name = name; @amps = []; @coherence = []
-      @amp_vals = CppVectorFlt3D.new
+      @amp_vals = AmpStore.new
       @params = CppVectorDbl2D.new
       @dparams = CppVectorDbl3D.new      
       yield(self) if block_given?
@@ -105,6 +111,29 @@ module PWA
     end
     protected :_print_set_up
     #
+    # Returns <tt>[ic,a,p,q,d2]</tt> for each nonzero 2nd derivative _d2_ of
+    # an amp's parameter w/r to MINUIT parameters <tt>p >= q</tt> (both
+    # non-nil in _pars_) given kinematic variables _vars_ (see Amp#deriv2).
+    # These are the terms calc_hessian adds to the Gauss-Newton ones.
+    #
+    def _param_d2s(pars,vars)
+      d2s = []
+      self.each_amp{|amp,ic,a|
+	next unless(amp.use)
+	amp.set_pars(pars)
+	ids = amp.par_ids.reject{|id| pars[id].nil?}
+	ids.each{|p|
+	  ids.each{|q|
+	    next if(q > p)
+	    d2 = amp.deriv2(p,q,vars)
+	    d2s.push [ic,a,p,q,d2] unless(d2 == 0)
+	  }
+	}
+      }
+      d2s
+    end
+    protected :_param_d2s
+    #
     # Free all memory used by this Dataset stored in c++ vectors
     #
     def clear
@@ -114,6 +143,18 @@ module PWA
       @norm_vals.clear unless @norm_vals.nil?
     end
     #
+    # Remove the Dataset's for which the block returns <tt>false</tt> from the
+    # global list (and clear them)
+    #
+    def Dataset.keep_if
+      @@all.delete_if{|dataset| 
+        drop = !yield(dataset)
+        dataset.clear if(drop)
+        drop
+      }
+      @@all.each_index{|d| @@all[d].instance_variable_set(:@index,d)}
+    end
+    #
     # Remove all Dataset's from global list (and clear them)
     #
     def Dataset.clear
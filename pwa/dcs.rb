@@ -11,6 +11,26 @@ module PWA
     end
   end
   #
+  # Stands in for a kinematic variable Hash to see if an amp uses it (the 
+  # Dcs fcn calls evaluate each amp w/ 1 of these every call, see dcs.cpp). 
+  # Every method call is passed on to the Hash and marks it as used.
+  #
+  class VarsProbe
+    instance_methods.each{|meth| 
+      undef_method meth unless(meth.to_s =~ /^__|^object_id$/)
+    }
+    def initialize(vars); @vars,@used = vars,false; end
+    #
+    # Was any method called on this probe?
+    #
+    def __used?; @used; end
+    #
+    def method_missing(meth,*args,&block)
+      @used = true
+      @vars.__send__(meth,*args,&block)
+    end
+  end
+  #
   # The PWA::Dcs module is an extension for the PWA::Dataset class used for
   # differential cross section fitting.
   #
@@ -148,6 +168,60 @@ module PWA
       msg
     end
     #
+    # Returns the estimated cost of a _fcn_val_ call (pts x amps x pars, the 
+    # cross section points are counted in the dcs file if they haven't been 
+    # read in yet).
+    #
+    def cost_estimate
+      num_pts = (@dcs_pts.nil?) ? self._count_pts : @dcs_pts.length
+      num_amps = 0
+      self.each_amp{|amp,ic,a| num_amps += 1}
+      num_pts*num_amps*(ParIDs.max_id + 1)
+    end
+    #
+    # Returns the number of <tt><pt></tt> elements in the dcs file (w/o 
+    # parsing it, so every process can call this cheaply).
+    #
+    def _count_pts
+      File.read("#{@top_dir}/#{@dcs_file}").scan(/<pt[\s\/>]/).length
+    end
+    protected :_count_pts
+    #
+    # Can this Dataset be split up into ranges? (no, the amp coefficients are
+    # evaluated in Ruby for all of its pts at once)
+    #
+    def splittable?; false; end
+    #
+    # Returns the 2nd derivative matrix of _fcn_val_ w/r to MINUIT parameters
+    # _pars_ (or the Fisher information if _fisher_ is <tt>true</tt>). The 
+    # points are few, so _num_threads_ isn't used.
+    #
+    def fcn_hessian(pars,fisher=false,num_threads=1)
+      self.calc_hessian(pars,fisher)
+    end
+    #
+    # Returns <tt>[index,vars]</tt>, where _vars_ are the distinct kinematic
+    # variable Hashes of the cross section points and <tt>index[pt]</tt> is
+    # the one point _pt_ uses (only recalculated if <tt>@dcs_pts</tt> is
+    # replaced).
+    #
+    def _distinct_vars
+      unless(@distinct_vars_pts.equal?(@dcs_pts))
+	seen,index,vars = Hash.new,[],[]
+	@dcs_pts.each{|pt|
+	  key = pt.vars.to_a.sort_by{|name,val| name.to_s}
+	  if(seen[key].nil?)
+	    seen[key] = vars.length
+	    vars.push pt.vars
+	  end
+	  index.push seen[key]
+	}
+	@distinct_vars,@distinct_vars_pts = [index,vars],@dcs_pts
+      end
+      @distinct_vars
+    end
+    protected :_distinct_vars
+    #
     # Prints setup to the screen
     #
     def print_set_up
@@ -45,6 +45,15 @@ module PWA
       @cuts
     end
     #
+    # Returns the selection Hash. Keys are <tt>:data,:acc,:raw</tt>. Values
+    # are expressions over the kinematic variables (see KinvarFile#select),
+    # events which fail them are cut.
+    #
+    def selection
+      @selection = {} if @selection.nil?
+      @selection
+    end
+    #
     # Returns Array of cuts values for _type_ (<tt>:data,...</tt>).
     #
     def get_cuts(type)
@@ -58,9 +67,30 @@ module PWA
         end
         cuts_file.close
       end
-      cuts
+      self._select(type,cuts)
+    end
+    #
+    # Returns _cuts_ w/ the events which fail the selection for _type_ (if
+    # there is one) cut.
+    #
+    def _select(type,cuts)
+      return cuts if(@selection.nil? or @selection[type].nil?)
+      self._kinvar_file(type).select(@selection[type],cuts)
     end
     #
+    # Returns the KinvarFile for _type_ (the XML is only parsed once, select 
+    # doesn't open the binary file, so it's kept around).
+    #
+    def _kinvar_file(type)
+      @kinvar_files = {} if(@kinvar_files.nil?)
+      xml_file = "#{@dir[type]}/#{@kinvar[type]}"
+      if(@kinvar_files[xml_file].nil?)
+	@kinvar_files[xml_file] = PWA::KinvarFile.new(xml_file)
+      end
+      @kinvar_files[xml_file]
+    end
+    protected :_select,:_kinvar_file
+    #
     # Returns Arrays of cuts w/ signal q-values and errors
     #
     def get_cuts_and_errors(type)
@@ -76,6 +106,7 @@ module PWA
         end
         cuts_file.close
       end
+      cuts = self._select(type,cuts)
       return cuts,errs
     end
     #
@@ -111,15 +142,24 @@ module PWA
 	  end
 	}
       end
+      first = 0
+      unless(@part.nil?) # only keep our chunk of the events
+	first = (@num_events*@part[0]).round
+	last = (@num_events*@part[1]).round
+	@wts = @wts[first...last]
+	@num_events = last - first
+      end
       self._resize(@num_events,max_par_id)      
       self.each_amp{|amp,ic,a| 
         file = "#{@dir[type]}/#{amp.file}"
 	raise "File #{file} does NOT exist." unless File.exists?(file)
-        self.read_in_amps_for_file(cuts,ic,a,file)
+        self.read_in_amps_for_file(cuts,ic,a,file,first)
       }
     end
     #
-    # Read in normalization integral values for _type_.
+    # Read in normalization integral values for _type_. If the norm-int file
+    # has an up to date binary sidecar (written by GenerateNormInt.rb), that's
+    # read instead of the XML.
     #
     def read_in_norm(type,max_par_id=nil)
       unless(max_par_id.nil?)
@@ -127,33 +167,9 @@ module PWA
         @num_events = self.get_num_events(type,cuts)
         self._resize(@num_events,max_par_id) 
       end
-      doc = REXML::Document.new(File.new("#{@dir[type]}/#{@norm[type]}"))
-      doc.root.elements.each('incoherent-waveset'){|ic_elem|
-        files = []
-        ic_elem.elements.each('wave'){|w| files.push w.attributes['file']}
-        norm_vals = []
-        row_index = -1
-        ic_elem.elements['normint-elements'].elements.each('row'){|row|
-          row_index += 1
-          val_ary = row.text.split('|')
-          norm_vals.push []
-          val_ary.each{|c| 
-            m,r,i = *(c.match(/\((.+)\,(.+)\)/))
-            norm_vals.last.push Complex.new(r.to_f,i.to_f)
-          }
-        }
-        @amps.each_index{|ic|
-          @amps[ic].each_index{|a1|            
-            a1_ind = files.index(@amps[ic][a1].file)
-	    next if(a1_ind.nil?)
-            @amps[ic].each_index{|a2|
-              a2_ind = files.index(@amps[ic][a2].file)
-	      raise "no norm-int entry for #{@amps[ic][a2].file}" if(a2_ind.nil?)	      
-	      @norm_vals[ic,a1,a2] = norm_vals[a1_ind][a2_ind]
-            }
-          }
-        }
-      }
+      # read natively (from the binary sidecar if it's there, see normint.h)
+      amp_files = @amps.collect{|amps| amps.collect{|amp| amp.file}}
+      self.read_norm_int_file("#{@dir[type]}/#{@norm[type]}",amp_files)
     end
     #
     # Returns the relative error on the normalization scale factors
@@ -198,12 +214,18 @@ module PWA
     # 2, then derivatives are calculated and filled in _derivs_.
     #
     def fcn_val(flag,pars,derivs)
-      do_derivs = flag == 2 ? true : false
-      self._set_params(pars,nil,do_derivs)
-      lderivs = Array.new(pars.length,0)
+      if(flag == 2) # only those MINUIT wants (non-nil in derivs)
+        self._set_params(pars,nil,derivs)
+        lderivs = derivs.collect{|deriv| deriv.nil? ? nil : 0}
+        nderivs = derivs.collect{|deriv| deriv.nil? ? nil : 0}
+      else
+        self._set_params(pars,nil,false)
+        lderivs = Array.new(pars.length,0)
+        nderivs = Array.new(pars.length,0)
+      end
       log_l = self.calc_log_liklihood(flag,pars,lderivs)
-      nderivs = Array.new(pars.length,0)
-      norm_int = self.calc_norm(flag,pars,nderivs)
+      norm_int = 0
+      norm_int = self.calc_norm(flag,pars,nderivs) if(self.include_norm?)
       if(flag == 2)
         derivs.each_index{|p| next if(derivs[p].nil?)
           derivs[p] = 2*(lderivs[p] + nderivs[p])
@@ -214,12 +236,92 @@ module PWA
       2*(log_l + norm_int)
     end
     #
+    # Arithmetic used by _calc_log_liklihood_: <tt>:double</tt> (the default)
+    # or <tt>:mixed</tt> (amp totals, intensities and gradient terms in float,
+    # sums over events in double). <tt>:mixed</tt> is faster but only good to
+    # ~1e-7 (relative), use _check_precision_ to compare them for a fit.
+    #
+    def precision=(prec); @amp_vals.precision = prec; end
+    #
+    # See precision=
+    #
+    def precision; @amp_vals.precision; end
+    #
+    # Compares -log(L) (+ derivatives) calculated w/ <tt>:mixed</tt> and 
+    # <tt>:double</tt> precision for MINUIT parameters _pars_. Returns the
+    # relative difference of -log(L) and the largest derivative difference
+    # (relative to the largest derivative).
+    #
+    def check_precision(pars)
+      prec = self.precision
+      self._set_params(pars,nil,true)
+      vals = [:double,:mixed].collect{|p|
+	self.precision = p
+	derivs = Array.new(pars.length,0)
+	[self.calc_log_liklihood(2,pars,derivs),derivs]
+      }
+      self.precision = prec
+      (log_l,derivs),(mixed_log_l,mixed_derivs) = vals
+      max_deriv,max_diff = 0,0
+      derivs.each_index{|p|
+	max_deriv = [max_deriv,derivs[p].abs].max
+	max_diff = [max_diff,(derivs[p] - mixed_derivs[p]).abs].max
+      }
+      max_deriv = 1 if(max_deriv == 0)
+      [(mixed_log_l - log_l).abs/log_l.abs,max_diff/max_deriv]
+    end
+    #
+    # Does _fcn_val_ include the normalization integral? When the events are 
+    # split up (see Dataset#part), only the 1st range adds it.
+    #
+    def include_norm?; (@part.nil? or @part[0] == 0); end
+    #
+    # Returns the estimated cost of a _fcn_val_ call (events x amps, the 
+    # number of events is taken from the size of the 1st data amps file).
+    #
+    def cost_estimate
+      return 0 if(@amps.length == 0)
+      num_events = File.size("#{@dir[:data]}/#{@amps[0][0].file}")/8
+      num_amps = 0
+      self.each_amp{|amp,ic,a| num_amps += 1}
+      num_events*num_amps
+    end
+    #
+    # Can this Dataset be split up into event ranges (see Dataset#part)?
+    #
+    def splittable?; true; end
+    #
+    # Returns the 2nd derivative matrix of _fcn_val_ w/r to MINUIT parameters
+    # _pars_ (or the Fisher information if _fisher_ is <tt>true</tt>), the 
+    # events are split over up to _num_threads_ threads.
+    #
+    def fcn_hessian(pars,fisher=false,num_threads=1)
+      self._set_params(pars,nil,true)
+      hess = self.calc_hessian(pars,fisher,num_threads)
+      hess.collect{|row| row.collect{|h| 2*h}}
+    end
+    #
+    # Free all memory used by this Dataset stored in c++ vectors (+ any cached
+    # amplitude columns nobody else uses).
+    #
+    def clear
+      super
+      Evt.purge_amp_cache
+    end
+    #
     # Initialize to run a fit (read in amps + norm-int).    
     #
     def init_for_fit(max_par_id)
+      saved = Evt.amp_cache_stats['bytes-saved']
       self.read_in_amps(max_par_id,:data)
+      saved = Evt.amp_cache_stats['bytes-saved'] - saved
       self.read_in_norm(:acc)
-      msg = "#{@name}: read amps for #{@num_events} events + norm-int"
+      msg = "#{@name}: read amps for #{@num_events} events"
+      unless(@part.nil?)
+	msg += sprintf(" (%.0f-%.0f%%)",100*@part[0],100*@part[1]) 
+      end
+      msg += sprintf(" (%.3g MB shared)",1e-6*saved) if(saved > 0)
+      msg += ' + norm-int'
       if(parallel?) then msg += "(on #{MPI.processor_name})."
       else msg += '.' end
       msg
@@ -234,6 +336,11 @@ module PWA
 	puts "Cuts(#{type}): #{@cuts[type]}" unless(@cuts.nil?)
       }
       [:acc,:raw].each{|type| puts "Norm(#{type}): #{@norm[type]}"}
+      [:data,:acc,:raw].each{|type| 
+	next if(@selection.nil? or @selection[type].nil?)
+	puts "Select(#{type}): #{@selection[type]}"
+      }
+      puts "Precision: #{self.precision}" if(self.precision != :double)
       [:data,:acc,:raw].each{|type| puts "KV(#{type}): #{@kinvar[type]}"}
     end
     #
@@ -283,7 +390,8 @@ module PWA
     end
     #
     # Returns histogram bins filled w/ yields vs. _kv_ of _type_ using all amps
-    # that match _reg_exp_ for MINUIT parameters _pars_.
+    # that match _reg_exp_ for MINUIT parameters _pars_. If given, only events
+    # which pass selection _condition_ (see KinvarFile#select) are used.
     #
     def histo_bins(kv,pars,reg_exp,type,condition=nil)
       dim = 1
@@ -298,13 +406,10 @@ module PWA
         self.use_files_matching(reg_exp) 
         self._set_params(pars,nil,false)
       end
-      cond = nil
-      unless(condition.nil?)
-	cond = condition.gsub('[','kv_vals["')
-	cond.gsub!(']','"]')
-      end
       cuts,errs = self.get_cuts_and_errors(type)
       kv_file = PWA::KinvarFile.new("#{@dir[type]}/#{@kinvar[type]}")
+      # the condition is run natively over the whole file up front
+      cond = condition.nil? ? nil : self._kinvar_file(type).select(condition)
       event = 0
       ev_index = 0
       kinvars = Array.new
@@ -326,7 +431,7 @@ module PWA
 	kinvars.each{|k| break if(kv_vals[k].nil?)}
 	pass = (cuts.nil? or cuts[ev_index] > 0)
 	pass_cond = true
-	pass_cond = eval(cond) unless(cond.nil? or !pass)
+	pass_cond = (cond[ev_index] > 0) unless(cond.nil? or !pass)
         if(pass and pass_cond)
           wt = 1.0
 	  wt = cuts[ev_index] unless cuts.nil?
@@ -350,6 +455,7 @@ module PWA
 	event += 1 if(pass and !pass_cond)
         ev_index += 1
       end
+      kv_file.close
       # add statistical errors
       if(dim == 1)
 	bins.each_index{|b|
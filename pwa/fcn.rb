@@ -1,6 +1,9 @@
 require 'rexml/document'
+require 'matrix'
 require 'singleton'
 require 'pwa/parallel'
+require 'pwa/shm_parallel'
+require "pwa/lib/#{ENV['OS_NAME']}/fcn_sum"
 require 'ftools.rb'
 module PWA
   #
@@ -8,6 +11,12 @@ module PWA
   #
   class Fcn
     include Singleton
+    # Only map parameter names to ids (don't define them in MINUIT)?
+    @@defer_parameters = false
+    # Flags (besides MINUIT's 1-4) telling the nodes to send back their 
+    # Hessian (or Fisher information) instead of a fcn value (see hessian)
+    HESSIAN_FLAG = 5
+    FISHER_FLAG = 6
     #
     # Number of calls to _fcn_ made so far.
     #
@@ -29,6 +38,17 @@ module PWA
     #
     attr_accessor :out_path
     #
+    # Write a Chrome trace of fcn call number <tt>trace_call</tt> (of the 1st
+    # iteration) to <tt>trace_file</tt>.
+    #
+    attr_accessor :trace_call,:trace_file
+    #
+    # Write the covariance matrix estimated from the analytic 2nd derivatives
+    # (see cov_matrix_estimate) to the output instead of MINUIT's? 
+    # (<tt>:hessian</tt>, <tt>:fisher</tt> or <tt>nil</tt> for MINUIT's)
+    #
+    attr_accessor :analytic_hesse
+    #
     # Registers Fcn with Minuit. Also sets the minimization strategy to 2 and
     # tells Minuit that we're going to calculate the derivatives ourselves.
     #
@@ -37,6 +57,9 @@ module PWA
       @num_calls_per_print = 100
       @num_iters = 1
       @out_path = './'
+      @trace_call,@trace_file,@trace = nil,nil,nil
+      @analytic_hesse = nil
+      self.reset_timing
       if(!parallel? or Parallel.master?)
 	Minuit.register_fcn(self)
 	Minuit.set_strategy 2
@@ -52,10 +75,22 @@ module PWA
     #
     def parameter_def_proc(&proc); @par_def_proc = proc; proc.call; end
     #
+    # Runs the parameter_def_proc code block again (eg. once 
+    # <tt>$bin_ranges</tt> has changed).
+    #
+    def define_parameters; @par_def_proc.call; end
+    #
+    # If _defer_ is <tt>true</tt>, define_parameter only gives the parameters
+    # ids (so the amps can be set up) until this is set back to 
+    # <tt>false</tt> and define_parameters is called (see BinScheduler).
+    #
+    def Fcn.defer_parameters=(defer); @@defer_parameters = defer; end
+    #
     # Define a MINUIT parameter for a new fit.
     #
     def Fcn.define_parameter(name,start,step,limits)
       PWA::ParIDs.push name
+      return if(@@defer_parameters)
       if(!parallel? or Parallel.master?)
 	Minuit::Parameter.define(PWA::ParIDs[name],name,start,step,limits)
       end
@@ -67,6 +102,7 @@ module PWA
       @num_iters.times{|iter|
 	@iter = iter
 	@num_calls = 0; Minuit.call_fcn(666); # reset MINUIT
+	self.reset_timing
 	@par_def_proc.call # reset parameter values
 	begin
 	  @min_proc.call     # minimize
@@ -94,10 +130,30 @@ module PWA
 	attr['value'] = sprintf("%g",par.value)
 	pars.add_element('par',attr)
       }
+      phases,counters = self.timing
+      timing = iter.add_element 'timing'
+      counters.each{|name,val| timing.attributes[name] = sprintf("%g",val)}
+      phases.keys.sort.each{|name|
+	calls,wall,cpu = *phases[name]
+	attr = {'name' => name,'calls' => calls}
+	attr['wall'] = sprintf("%g",wall)
+	attr['cpu'] = sprintf("%g",cpu)
+	timing.add_element('phase',attr)
+      }
       cov_matrix = iter.add_element 'cov-matrix'
+      cov = Minuit::CovMatrix
+      unless(@analytic_hesse.nil?)
+	pars = Array.new(Minuit::Parameter.max_id + 1)
+	Minuit::Parameter.each{|par| pars[par.id] = par.value}
+	cov = self._time('analytic-hesse'){
+	  self.cov_matrix_estimate(pars,Minuit.par_ids,
+				   @analytic_hesse == :fisher)
+	}
+	cov_matrix.attributes['source'] = "analytic-#{@analytic_hesse}"
+      end
       Minuit.par_ids.each{|i|
 	vals = []
-	Minuit.par_ids.each{|j| vals.push sprintf("%g",Minuit::CovMatrix[i,j])}
+	Minuit.par_ids.each{|j| vals.push sprintf("%g",cov[i,j])}
 	cov_matrix.add_element('row',{'values' => vals.join(',')})
       }
     end
@@ -129,58 +185,322 @@ module PWA
     end
     protected :_add_derivs
     #
+    # Returns the FcnSum over all Dataset's handled on this node (built the 
+    # 1st time it's needed, so all Dataset's must be defined by then).
+    #
+    def _fcn_sum
+      if(@fcn_sum.nil?)
+	datasets = []
+	self._each_dataset_on_node{|dataset| datasets.push dataset}
+	@fcn_sum = FcnSum.new(datasets)
+	# 1 process per core
+	@fcn_sum.num_threads = 1 if(parallel? or ShmParallel.active?)
+      end
+      @fcn_sum
+    end
+    protected :_fcn_sum
+    #
+    # Yields each Dataset handled on this node.
+    #
+    def _each_dataset_on_node
+      if(parallel?)
+	Parallel.each_dataset_on_node{|dataset| yield dataset}
+      elsif(ShmParallel.active?)
+	ShmParallel.each_dataset_on_node{|dataset| yield dataset}
+      else 
+	Dataset.each{|dataset| yield dataset}
+      end
+    end
+    protected :_each_dataset_on_node
+    #
+    # Must be called if the Datasets handled on this node have changed.
+    #
+    def datasets_changed
+      self._save_fcn_sum_stats
+      @fcn_sum = nil
+    end
+    #
+    # Calls the block, adding its wall and CPU time (in seconds) to phase 
+    # _name_ (and a trace event if this call is being traced). The wall time 
+    # is also left in <tt>@last_wall</tt>. Returns what the block returns.
+    #
+    def _time(name)
+      start,cpu_start = Time.now,Process.times
+      ret = yield
+      @last_wall = Time.now - start
+      cpu_stop = Process.times
+      @timers[name] = [0,0.0,0.0] if(@timers[name].nil?)
+      timer = @timers[name]
+      timer[0] += 1
+      timer[1] += @last_wall
+      timer[2] += (cpu_stop.utime + cpu_stop.stime) 
+      timer[2] -= (cpu_start.utime + cpu_start.stime)
+      @trace.push [name,0,start.to_f,@last_wall] unless(@trace.nil?)
+      ret
+    end
+    protected :_time
+    #
+    # Adds the FcnSum timers and counters to those saved from earlier ones 
+    # (before it gets replaced).
+    #
+    def _save_fcn_sum_stats
+      return if(@fcn_sum.nil?)
+      phases,counters = @fcn_sum.phase_times,@fcn_sum.counters
+      phases.each{|name,times| 
+	@fcn_sum_phases[name] = [0,0.0,0.0] if(@fcn_sum_phases[name].nil?)
+	3.times{|i| @fcn_sum_phases[name][i] += times[i]}
+      }
+      counters.each{|name,val| 
+	next if(name == 'thread-utilization')
+	@fcn_sum_counters[name] = @fcn_sum_counters[name].to_f + val
+      }
+    end
+    protected :_save_fcn_sum_stats
+    #
+    # Returns <tt>[phases,counters]</tt> for this node since the last 
+    # reset_timing. _phases_ is a Hash of <tt>[calls,wall,cpu]</tt> (times in 
+    # seconds) for the phases of fcn and of FcnSum#fcn (see 
+    # FcnSum#phase_times), _counters_ is FcnSum#counters.
+    #
+    def timing
+      phases,counters = {},{}
+      @timers.each{|name,times| phases[name] = times.dup}
+      @fcn_sum_phases.each{|name,times| phases[name] = times.dup}
+      @fcn_sum_counters.each{|name,val| counters[name] = val}
+      unless(@fcn_sum.nil?)
+	@fcn_sum.phase_times.each{|name,times|
+	  phases[name] = [0,0.0,0.0] if(phases[name].nil?)
+	  3.times{|i| phases[name][i] += times[i]}
+	}
+	@fcn_sum.counters.each{|name,val|
+	  if(name == 'thread-utilization') then counters[name] = val
+	  else counters[name] = counters[name].to_f + val
+	  end
+	}
+      end
+      [phases,counters]
+    end
+    #
+    # Sets all timers and counters back to 0.
+    #
+    def reset_timing
+      @timers,@fcn_sum_phases,@fcn_sum_counters = {},{},{}
+      @fcn_sum.reset_stats unless(@fcn_sum.nil?)
+    end
+    #
+    # Returns a 1 line summary of timing (time per call spent in each phase,
+    # rates, etc...).
+    #
+    def timing_summary
+      phases,counters = self.timing
+      return 'timing: no calls yet' if(phases['fcn'].nil?)
+      calls = phases['fcn'][0]
+      summary = sprintf("timing: %.3g ms/call [",1e3*phases['fcn'][1]/calls)
+      summary += phases.keys.sort.reject{|name| name == 'fcn'}.collect{|name|
+	sprintf("%s %.3g",name,1e3*phases[name][1]/calls)
+      }.join(' ') + ']'
+      sum_time = phases['fcn-sum'].nil? ? 0 : phases['fcn-sum'][1]
+      if(sum_time > 0 and counters['events'].to_f > 0)
+	summary += sprintf(" events/s: %.3g",counters['events']/sum_time)
+	summary += sprintf(" GB/s: %.3g",1e-9*counters['bytes']/sum_time)
+	summary += sprintf(" threads: %.0f%%",
+			   100*counters['thread-utilization'].to_f)
+	num_nodes = counters.keys.grep(/^node\d+-bytes$/).length
+	if(num_nodes > 1)
+	  num_nodes.times{|n|
+	    bytes = counters["node#{n}-bytes"].to_f
+	    remote = counters["node#{n}-remote-bytes"].to_f
+	    summary += sprintf(" node%d GB/s: %.3g",n,1e-9*bytes/sum_time)
+	    summary += sprintf(" (%.0f%% remote)",100*remote/bytes) if(bytes > 0)
+	  }
+	end
+      end
+      summary
+    end
+    #
+    # Writes the trace events of the last traced call to _file_ in Chrome 
+    # trace format (load it in chrome://tracing).
+    #
+    def write_trace(file)
+      events = @trace + self._fcn_sum.trace_events
+      return if(events.empty?)
+      t0 = events.collect{|event| event[2]}.min
+      out = File.new(file,'w')
+      out.puts '{"traceEvents":['
+      out.puts events.collect{|name,tid,start,dur|
+	name = name.gsub(/["\\]/){|c| "\\#{c}"}
+	sprintf('{"name":"%s","ph":"X","pid":0,"tid":%d,"ts":%.1f,"dur":%.1f}',
+		name,tid,1e6*(start - t0),1e6*dur)
+      }.join(",\n")
+      out.puts '],"displayTimeUnit":"ms"}'
+      out.close
+    end
+    #
+    # Returns the sum of <tt>fcn_val</tt> for all Dataset's handled on this 
+    # node. If _flag_ is 2, derivatives are added to _derivs_.
+    #
+    def fcn_on_node(flag,pars,derivs)
+      self._fcn_sum.fcn(flag,pars,derivs)
+    end
+    #
     # Method used by MINUIT during minimization
     #
     def fcn(flag,pars,derivs)
+      trace = (@iter.to_i == 0 and @num_calls + 1 == @trace_call)
+      if(trace)
+	@trace = []
+	self._fcn_sum.trace = true
+      end
+      fcn_val = self._time('fcn'){self._calc_fcn(flag,pars,derivs)}
+      @num_calls += 1
+      self._time('print-status'){self.print_status pars}
+      if(trace)
+	self._fcn_sum.trace = false
+	self.write_trace(@trace_file)
+	@trace = nil
+      end
+      fcn_val
+    end
+    #
+    # Returns the fcn value summed over all nodes (see fcn).
+    #
+    def _calc_fcn(flag,pars,derivs)
       fcn_val = 0.0
       if(parallel?)
-	Parallel.send_to_children(false,:terminate)
-	Parallel.send_to_children(flag,:fcn_flag)
-	Parallel.send_to_children(pars,:params)
+	self._time('mpi-send'){
+	  Parallel.send_to_children(false,:terminate)
+	  Parallel.send_to_children(Parallel.pending_scales,:rebalance)
+	  Parallel.send_to_children(flag,:fcn_flag)
+	  Parallel.send_to_children(pars,:params)
+	  Parallel.send_to_children(derivs.map{|d| d && 0},:derivs)
+	}
 	#
 	# do the master nodes calculations
 	#
-	Parallel.each_dataset_on_node{|dataset|
-	  dset_derivs = Array.new(pars.length,0)
-	  fcn_val += dataset.fcn_val(flag,pars,dset_derivs)
-	  self._add_derivs(dset_derivs,derivs) if(flag == 2)
-	}
+	fcn_val += self._time('node'){self.fcn_on_node(flag,pars,derivs)}
+	node_times = [@last_wall]
 	#
 	# add the child node calculations
 	#
-	Parallel.recv_from_children(:fcn_val).each{|fcn_vals| 
-	  fcn_vals.each{|f| fcn_val += f}
-	}
-	if(flag == 2)
-	  Parallel.recv_from_children(:derivs).each{|node_derivs|
-	    node_derivs.each{|dderivs| self._add_derivs(dderivs,derivs)}
+	self._time('mpi-wait'){
+	  Parallel.recv_from_children(:fcn_val).each{|node_val,node_time| 
+	    fcn_val += node_val
+	    node_times.push node_time
 	  }
+	  if(flag == 2)
+	    Parallel.recv_from_children(:derivs).each{|node_derivs|
+	      node_derivs.each{|dderivs| self._add_derivs(dderivs,derivs)}
+	    }
+	  end
+	}
+	Parallel.add_node_times node_times
+	if(self._time('rebalance'){Parallel.rebalance(Minuit::Parameter.max_id)})
+	  self.datasets_changed
+	  puts 'rebalanced datasets:'
+	  Parallel.show_divide
+	end
+      elsif(ShmParallel.active?)
+	self._time('shm-send'){ShmParallel.broadcast(flag,pars,derivs)}
+	fcn_val = self._time('node'){self.fcn_on_node(flag,pars,derivs)}
+	node_times = [@last_wall]
+	fcn_val += self._time('shm-wait'){ShmParallel.gather(derivs)}
+	Parallel.add_node_times(node_times + ShmParallel.node_times)
+	if(self._time('rebalance'){ShmParallel.rebalance})
+	  self.datasets_changed
+	  puts 'rebalanced datasets:'
+	  ShmParallel.show_divide
 	end
       else
-	Dataset.each{|dataset|
-	  dset_derivs = Array.new(pars.length,0)
-	  fcn_val += dataset.fcn_val(flag,pars,dset_derivs)
-	  self._add_derivs(dset_derivs,derivs) if(flag == 2)
-	}
+	fcn_val = self._time('node'){self.fcn_on_node(flag,pars,derivs)}
       end
-      @num_calls += 1
-      self.print_status pars
       fcn_val
     end
+    protected :_calc_fcn
+    #
+    # Returns the 2nd derivative matrix (Array of Arrays) of _fcn_ w/r to 
+    # MINUIT parameters _pars_ summed over all Dataset's. If _fisher_ is 
+    # <tt>true</tt>, the Fisher information is returned instead. In parallel
+    # (MPI or shm) mode, each node sums its own Datasets (see 
+    # hessian_on_node) and the master adds them up.
+    #
+    def hessian(pars,fisher=false)
+      flag = fisher ? FISHER_FLAG : HESSIAN_FLAG
+      if(parallel?)
+	Parallel.send_to_children(false,:terminate)
+	Parallel.send_to_children(Parallel.pending_scales,:rebalance)
+	Parallel.send_to_children(flag,:fcn_flag)
+	Parallel.send_to_children(pars,:params)
+	Parallel.send_to_children(pars.map{|p| p && 0},:derivs)
+	hess = self.hessian_on_node(flag,pars)
+	Parallel.recv_from_children(:hessian).each{|node_hess|
+	  hess.each_index{|i| 
+	    hess[i].each_index{|j| hess[i][j] += node_hess[i][j]}
+	  }
+	}
+      elsif(ShmParallel.active?)
+	ShmParallel.broadcast(flag,pars,pars)
+	hess = self.hessian_on_node(flag,pars)
+	ShmParallel.gather_hessian(hess)
+      else
+	hess = self.hessian_on_node(flag,pars)
+      end
+      hess
+    end
+    #
+    # Is _flag_ a request for hessian_on_node (rather than a fcn call)?
+    #
+    def Fcn.hessian_flag?(flag)
+      (flag == HESSIAN_FLAG or flag == FISHER_FLAG)
+    end
+    #
+    # Returns the 2nd derivative matrix (or Fisher information if _flag_ is 
+    # FISHER_FLAG) summed over the Dataset's handled on this node. Evt's use
+    # the node's FcnSum threads.
+    #
+    def hessian_on_node(flag,pars)
+      fisher = (flag == FISHER_FLAG)
+      num_threads = self._fcn_sum.num_threads
+      hess = Array.new(pars.length){Array.new(pars.length,0.0)}
+      self._each_dataset_on_node{|dataset|
+	dset_hess = dataset.fcn_hessian(pars,fisher,num_threads)
+	hess.each_index{|i| 
+	  hess[i].each_index{|j| hess[i][j] += dset_hess[i][j]}
+	}
+      }
+      hess
+    end
+    #
+    # Returns the covariance Matrix estimated from the analytic 2nd 
+    # derivatives of _fcn_ at _pars_ for parameter _ids_ (entries for all other
+    # parameters are 0). Its indexing matches Minuit::CovMatrix.
+    #
+    def cov_matrix_estimate(pars,ids=Minuit.par_ids,fisher=true)
+      hess = self.hessian(pars,fisher)
+      sub = Matrix.rows(ids.collect{|i| ids.collect{|j| hess[i][j].to_f}})
+      sub_inv = sub.inverse
+      cov = Array.new(pars.length){Array.new(pars.length,0.0)}
+      ids.each_index{|i| 
+	ids.each_index{|j| cov[ids[i]][ids[j]] = 2*sub_inv[i,j]}
+      }
+      Matrix.rows(cov)
+    end
     #
     # Prints minimization status to the screen
     #
     def print_status(pars)
       if(@num_calls % @num_calls_per_print == 0)
 	status = "calls: #{@num_calls} fcn-min: #{Minuit::Status.fcn_min}"
-	unless parallel?
+	unless(parallel? or ShmParallel.active?)
 	  dummy = Array.new(pars.length)
 	  Dataset.each{|dataset| next unless dataset.type == :evt	  
 	    status += " norm-int(#{dataset.name}): "
 	    status += "#{dataset.calc_norm(0,pars,dummy)}"
 	  }
+	else
+	  status += sprintf(" imbalance: %.2f",Parallel.imbalance)
 	end
 	puts status
+	puts self.timing_summary
       end
     end
     #
@@ -1,5 +1,6 @@
 # Author:: Mike Williams
 require 'rexml/document'
+require "pwa/lib/#{ENV['OS_NAME']}/selection"
 module PWA
   #
   # The PWA::Kinvar class handles kinematic variables used in event-based 
@@ -69,27 +70,58 @@ module PWA
     #
     attr_reader :kinvars
     #
-    # Initialize from an XML file.
+    # Initialize from an XML file. The binary file is only opened by the 1st
+    # eof or read (so select, [] etc. don't need it), see close.
     #
     def initialize(xml_file_name)
       @xml_file_name = xml_file_name
       @kinvars = Array.new
-      doc = REXML::Document.new(File.new(xml_file_name))    
+      doc = File.open(xml_file_name){|xml| REXML::Document.new(xml)}
       kv_elem = doc.elements['kinematic-variables']
       kv_elem.elements.each('kinvar'){|kv| @kinvars.push Kinvar.new(kv)}
       @data_file = kv_elem.elements['dat-file'].attributes['file']
-      @file = File.new(@data_file,'rb')
+      @file = nil
     end  
     #
+    # Yields the KinvarFile for _xml_file_name_, then closes it.
+    #
+    def KinvarFile.open(xml_file_name)
+      kv_file = KinvarFile.new(xml_file_name)
+      begin
+	yield kv_file
+      ensure
+	kv_file.close
+      end
+    end
+    #
+    # Closes the binary file (if eof or read opened it). Reading again 
+    # starts from the 1st event.
+    #
+    def close
+      @file.close unless(@file.nil? or @file.closed?)
+      @file = nil
+    end
+    #
     # Returns the Kinvar object w/ name _kinvar_
     #
     def [](kinvar) 
       @kinvars.each{|kv| return kv if(kv.name == kinvar)}; nil 
     end
     #
+    # Returns a cuts Array w/ an entry for every event in the file: its
+    # entry in _cuts_ (1 if _cuts_ is <tt>nil</tt>) if it passes selection
+    # _expr_, else -1. The selection is compiled + run natively over the 
+    # binary file (see PWA::Selection for the language), eg
+    #  kv_file.select('0.5 < [mass] < 1.2 && abs([cos_theta]) < 0.9')
+    #
+    def select(expr,cuts=nil)
+      names = @kinvars.collect{|kv| kv.name}
+      PWA::Selection.new(expr,names).apply(@data_file,cuts)
+    end
+    #
     # Have we reached the end of the file?
     #
-    def eof; @file.eof; end
+    def eof; self._file.eof; end
     #
     # Read the next event's kinematic variables (returns their values via Hash)
     #
@@ -97,12 +129,20 @@ module PWA
       num_kv = @kinvars.length
       unpck = String.new
       num_kv.times{unpck += 'd'}
-      vals = @file.read(num_kv*8).unpack(unpck)
+      vals = self._file.read(num_kv*8).unpack(unpck)
       vals_hash = Hash.new
       num_kv.times{|kv| vals_hash[@kinvars[kv].name] = vals[kv]}
       vals_hash
     end
     #
+    # The binary file (opened the 1st time it's needed)
+    #
+    def _file
+      @file = File.new(@data_file,'rb') if(@file.nil?)
+      @file
+    end
+    protected :_file
+    #
   end
   #
 end
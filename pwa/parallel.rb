@@ -8,6 +8,27 @@ module PWA
     @@div_procs = nil
     # Set to MPI::Comm::WORLD.size
     @@size = nil
+    # Per-Dataset cost scales used for the current division (nil for none)
+    @@scales = nil
+    # Dcs cost per (pt x amp x par) relative to an evt (event x amp). Not
+    # measured, the rebalancing (see rebalance_scales) corrects it from the 
+    # node times.
+    @@dcs_cost_scale = 1.0
+    # Number of fcn calls averaged over before checking the balance
+    @@rebalance_calls = 20
+    # Smallest fraction of a Dataset worth splitting off
+    @@min_fraction = 0.05
+    # Only re-divide if the slowest node is this much slower than the average
+    @@rebalance_threshold = 1.25
+    # ...and the slowest node is expected to get at least this much faster
+    @@rebalance_gain = 0.9
+    # Time spent by each process on the last <tt>@@rebalance_calls</tt> calls
+    @@node_times = []
+    # Number of calls since the balance was last checked
+    @@calls_since_check = 0
+    # Scales the children should re-divide the Datasets w/ before the next 
+    # call (nil for none, see rebalance)
+    @@pending_scales = nil
     #
     # Maps Symbols to tags (Fixnum's).
     #
@@ -28,6 +49,10 @@ module PWA
 	tag = 5
       when :max_par
 	tag = 6
+      when :rebalance
+	tag = 7
+      when :hessian
+	tag = 8
       end
       tag
     end
@@ -40,28 +65,125 @@ module PWA
     #
     def Parallel.node; MPI::Comm::WORLD.rank; end
     #
+    # Returns the estimated cost of _dataset_ (see Evt#cost_estimate and 
+    # Dcs#cost_estimate) in units of 1 event-amp product.
+    #
+    def Parallel.dataset_cost(dataset)
+      cost = dataset.cost_estimate.to_f
+      cost *= @@dcs_cost_scale if(dataset.type == :dcs)
+      cost
+    end
+    #
+    # Returns the fraction of _cost_ to give to each process w/ _loads_ so that
+    # the least loaded ones are filled up to the same level. Processes which 
+    # would only get a sliver (less than <tt>@@min_fraction</tt>) get none.
+    #
+    def Parallel.fill_levels(loads,cost)
+      order = (0...loads.length).sort_by{|pr| [loads[pr],pr]}
+      num,level = order.length,0
+      loop{
+	sum = 0
+	order[0...num].each{|pr| sum += loads[pr]}
+	level = (sum + cost)/num
+	break if(num == 1 or level - loads[order[num-1]] >= @@min_fraction*cost)
+	num -= 1
+      }
+      fracs = Array.new(loads.length,0.0)
+      order[0...num].each{|pr| fracs[pr] = (level - loads[pr])/cost}
+      fracs
+    end
+    #
+    # Returns 2-D Array mapping each of _procs_ processes to the pieces of 
+    # Datasets it should handle. Each piece is <tt>[index,part]</tt>, where 
+    # _part_ is <tt>nil</tt> for the whole Dataset or <tt>[lo,hi]</tt> (see 
+    # Dataset#part). Datasets are handed out largest 1st to the least loaded 
+    # process, then those which cost more than an even share (and can be 
+    # split up into event ranges) are poured into the least loaded processes.
+    # The cost of Dataset _d_ is multiplied by <tt>scales[d]</tt> (if given). 
+    # Every process gets the same result for the same input.
+    #
+    def Parallel.divide_datasets(procs,scales=nil)
+      costs = []
+      Dataset.each{|dataset| costs.push Parallel.dataset_cost(dataset)}
+      costs.each_index{|d| costs[d] *= scales[d]} unless(scales.nil?)
+      share = 0
+      costs.each{|cost| share += cost}
+      share /= procs
+      whole,split = [],[]
+      costs.each_index{|d|
+	if(costs[d] > share and Dataset[d].splittable?) then split.push d
+	else whole.push d
+	end
+      }
+      div_procs = Array.new(procs){[]}
+      loads = Array.new(procs,0)
+      whole.sort_by{|d| [-costs[d],d]}.each{|d|
+	proc = loads.index(loads.min)
+	div_procs[proc].push [d,nil]
+	loads[proc] += costs[d]
+      }
+      split.sort_by{|d| [-costs[d],d]}.each{|d|
+	fracs = Parallel.fill_levels(loads,costs[d])
+	procs_used = (0...procs).select{|proc| fracs[proc] > 0}
+	if(procs_used.length == 1)
+	  div_procs[procs_used[0]].push [d,nil]
+	  loads[procs_used[0]] += costs[d]
+	  next
+	end
+	lo = 0.0
+	procs_used.each_index{|i|
+	  proc = procs_used[i]
+	  hi = (i == procs_used.length - 1) ? 1.0 : lo + fracs[proc]
+	  div_procs[proc].push [d,[lo,hi]]
+	  loads[proc] += costs[d]*(hi - lo)
+	  lo = hi
+	}
+      }
+      div_procs
+    end
+    #
+    # Returns the estimated cost of each process in _div_procs_ (see 
+    # divide_datasets).
+    #
+    def Parallel.node_costs(div_procs,scales=nil)
+      div_procs.collect{|pieces| 
+	cost = 0
+	pieces.each{|d,part| 
+	  dcost = Parallel.dataset_cost(Dataset[d])
+	  dcost *= scales[d] unless(scales.nil?)
+	  dcost *= (part[1] - part[0]) unless(part.nil?)
+	  cost += dcost
+	}
+	cost
+      }
+    end
+    #
+    # Sets Dataset#part for the Datasets process _node_ handles in _div_procs_.
+    #
+    def Parallel.assign_parts(div_procs,node)
+      div_procs[node].each{|d,part| Dataset[d].part = part}
+    end
+    #
     # Divides up Datasets among available processes.
     #
-    def Parallel.divide
+    def Parallel.divide(scales=nil)
       procs = MPI::Comm::WORLD.size
-      dsets = PWA::Dataset.length
-      procs_div = Array.new(procs,dsets/procs)
-      (dsets-(dsets/procs)*procs).times{|i| procs_div[i] += 1}
-      dind = 0
-      @@div_procs = []      
-      procs_div.each_index{|proc| 
-	@@div_procs[proc] = []
-	procs_div[proc].times{|p| @@div_procs[proc].push dind; dind+=1}
-      }
+      @@div_procs = Parallel.divide_datasets(procs,scales)
+      @@scales = scales
       @@size = procs
+      Parallel.assign_parts(@@div_procs,MPI::Comm::WORLD.rank)
     end
     #
     # Print to screen Dataset divisions
     #
-    def Parallel.show_divide      
-      @@div_procs.each_index{|node| 
-	datasets = @@div_procs[node].collect{|d| d}.join(',')
-	puts "node: #{node} datasets: #{datasets}"
+    def Parallel.show_divide(div_procs=@@div_procs,scales=@@scales)
+      costs = Parallel.node_costs(div_procs,scales)
+      div_procs.each_index{|node| 
+	datasets = div_procs[node].collect{|d,part| 
+	  next d.to_s if(part.nil?)
+	  sprintf("%d(%.0f-%.0f%%)",d,100*part[0],100*part[1])
+	}.join(',')
+	puts "node: #{node} datasets: #{datasets} cost: #{costs[node]}"
       }
     end
     #
@@ -69,7 +191,129 @@ module PWA
     # it.
     #
     def Parallel.each_dataset_on_node(&block)
-      @@div_procs[MPI::Comm::WORLD.rank].each{|d| yield(Dataset[d])}
+      @@div_procs[MPI::Comm::WORLD.rank].each{|d,part| yield(Dataset[d])}
+    end
+    #
+    # Records the time (in seconds) each process spent on the last fcn call.
+    #
+    def Parallel.add_node_times(times)
+      @@node_times.push times
+      @@calls_since_check += 1
+      @@node_times.shift while(@@node_times.length > @@rebalance_calls)
+    end
+    #
+    # Returns the average time spent by each process on the recent fcn calls.
+    #
+    def Parallel.avg_node_times
+      return [] if(@@node_times.empty?)
+      avg = Array.new(@@node_times[0].length,0)
+      @@node_times.each{|times| times.each_index{|n| avg[n] += times[n]}}
+      avg.collect{|t| t/@@node_times.length}
+    end
+    #
+    # Returns the load imbalance over the recent fcn calls (time spent by the 
+    # slowest process over the average, 1 is perfectly balanced).
+    #
+    def Parallel.imbalance
+      avg = Parallel.avg_node_times
+      return 1.0 if(avg.empty?)
+      mean = 0
+      avg.each{|t| mean += t}
+      mean /= avg.length
+      mean > 0 ? avg.max/mean : 1.0
+    end
+    #
+    # Checks (every <tt>@@rebalance_calls</tt> calls) if the processes in 
+    # _div_procs_ are out of balance. If re-dividing the Datasets w/ costs 
+    # calibrated to the measured times would help enough, returns the new 
+    # per-Dataset cost scales to pass to divide_datasets (else <tt>nil</tt>).
+    #
+    def Parallel.rebalance_scales(div_procs,scales)
+      return nil if(@@calls_since_check < @@rebalance_calls)
+      @@calls_since_check = 0
+      return nil if(Parallel.imbalance < @@rebalance_threshold)
+      avg = Parallel.avg_node_times
+      scales = Array.new(Dataset.length,1.0) if(scales.nil?)
+      costs = Parallel.node_costs(div_procs,scales)
+      # measured time per unit cost on each node, averaged over each Dataset's
+      # pieces (weighted by their size)
+      ratio_sum,wt_sum = Array.new(Dataset.length,0),Array.new(Dataset.length,0)
+      div_procs.each_index{|node|
+	next unless(costs[node] > 0)
+	div_procs[node].each{|d,part|
+	  wt = part.nil? ? 1.0 : part[1] - part[0]
+	  ratio_sum[d] += wt*avg[node]/costs[node]
+	  wt_sum[d] += wt
+	}
+      }
+      new_scales = scales.collect{|s| s}
+      new_scales.each_index{|d| 
+	new_scales[d] *= ratio_sum[d]/wt_sum[d] if(wt_sum[d] > 0)
+      }
+      # normalize them (so the costs stay in the same units)
+      norm = 0
+      new_scales.each{|s| norm += s}
+      return nil unless(norm > 0)
+      new_scales.collect!{|s| s*new_scales.length/norm}
+      # only worth it if the slowest node gets a lot faster
+      old_max = Parallel.node_costs(div_procs,new_scales).max
+      new_div = Parallel.divide_datasets(div_procs.length,new_scales)
+      new_max = Parallel.node_costs(new_div,new_scales).max
+      return nil unless(new_max < @@rebalance_gain*old_max)
+      @@node_times.clear # these were for the old division
+      new_scales
+    end
+    #
+    # Re-divides the Datasets using _scales_ (see rebalance_scales) going from
+    # _old_div_ to _new_div_. The Datasets (or chunks) process _node_ is no 
+    # longer handling are cleared, those that are new to it are read in (up 
+    # to MINUIT parameter id _max_par_id_). Returns the init_for_fit messages.
+    #
+    def Parallel.reassign(old_div,new_div,node,max_par_id)
+      old_pieces,new_pieces = old_div[node],new_div[node]
+      old_pieces.each{|piece| 
+	Dataset[piece[0]].clear unless(new_pieces.include?(piece))
+      }
+      Dataset.each{|dataset| dataset.part = nil}
+      Parallel.assign_parts(new_div,node)
+      msg = ''
+      new_pieces.each{|piece|
+	next if(old_pieces.include?(piece))
+	msg += Dataset[piece[0]].init_for_fit(max_par_id) + "\n"
+      }
+      msg
+    end
+    #
+    # Divides the Datasets again using _scales_ and reads in whatever this 
+    # process now needs (see reassign).
+    #
+    def Parallel.redivide(scales,max_par_id)
+      old_div = @@div_procs
+      @@div_procs = Parallel.divide_datasets(@@size,scales)
+      @@scales = scales
+      Parallel.reassign(old_div,@@div_procs,MPI::Comm::WORLD.rank,max_par_id)
+    end
+    #
+    # If the nodes are out of balance, divides up the Datasets again (w/ 
+    # _max_par_id_) and returns <tt>true</tt> (master only). The children are
+    # told to do the same w/ the next call (see pending_scales).
+    #
+    def Parallel.rebalance(max_par_id)
+      scales = Parallel.rebalance_scales(@@div_procs,@@scales)
+      return false if(scales.nil?)
+      @@pending_scales = scales
+      Parallel.redivide(scales,max_par_id)
+      true
+    end
+    #
+    # Returns (and clears) the scales the children need to re-divide the 
+    # Datasets w/ before the next call, <tt>nil</tt> if they don't (master 
+    # only). Each call sends this w/ the <tt>:rebalance</tt> tag.
+    #
+    def Parallel.pending_scales
+      scales = @@pending_scales
+      @@pending_scales = nil
+      scales
     end
     #
     # Sends _var_ w/ _tag_ to all child processes.
@@ -34,6 +34,10 @@ module PWA
     #
     def ParIDs.set(name2id); @@name2id = name2id; end
     #
+    # Returns the Hash (name => id).
+    #
+    def ParIDs.names2ids; @@name2id; end
+    #
     # Returns the highest parameter id
     #
     def ParIDs.max_id
@@ -0,0 +1,148 @@
+# Author:: Mike Williams
+require "pwa/lib/#{ENV['OS_NAME']}/shm_comm"
+require 'pwa/parallel'
+module PWA
+  #
+  # The PWA::ShmParallel module runs a fit on several forked processes on a 
+  # single node (no MPI needed). The parameters are broadcast to the workers 
+  # through shared memory and their results are sent back as packed doubles
+  # (see PWA::ShmComm). Datasets are divided up (and rebalanced) the same way
+  # as PWA::Parallel.
+  #
+  module ShmParallel
+    # PWA::ShmComm shared by all processes (nil if not running)
+    @@comm = nil
+    # Rank of this process (0 is the master)
+    @@rank = 0
+    # 2-D Array mapping process number to Dataset pieces it needs to process
+    @@div_procs = nil
+    # Per-Dataset cost scales used for the current division (nil for none)
+    @@scales = nil
+    # Highest MINUIT parameter id
+    @@max_par_id = nil
+    #
+    # Are we running on forked processes?
+    #
+    def ShmParallel.active?; !@@comm.nil?; end
+    #
+    # Is current process the master process?
+    #
+    def ShmParallel.master?; (@@rank == 0); end
+    #
+    # Which process are we?
+    #
+    def ShmParallel.node; @@rank; end
+    #
+    # Divides up Datasets among _procs_ processes and forks the workers. All
+    # Datasets and MINUIT parameters (up to id _max_par_id_) must be defined.
+    # Returns the rank of the calling process (in each process).
+    #
+    def ShmParallel.start(procs,max_par_id)
+      @@div_procs = Parallel.divide_datasets(procs)
+      @@max_par_id = max_par_id
+      @@comm = ShmComm.new(procs - 1,max_par_id + 1,Dataset.length)
+      STDOUT.flush
+      pids = []
+      1.upto(procs - 1){|rank|
+	pid = fork
+	if(pid.nil?)
+	  @@rank = rank
+	  Parallel.assign_parts(@@div_procs,@@rank)
+	  return @@rank
+	end
+	pids.push pid
+      }
+      @@comm.watch(pids)
+      Parallel.assign_parts(@@div_procs,@@rank)
+      @@rank
+    end
+    #
+    # Print to screen Dataset divisions
+    #
+    def ShmParallel.show_divide 
+      Parallel.show_divide(@@div_procs,@@scales)
+    end
+    #
+    # Iterates over the Datasets to be processed by the calling process.
+    #
+    def ShmParallel.each_dataset_on_node
+      @@div_procs[@@rank].each{|d,part| yield(Dataset[d])}
+    end
+    #
+    # Starts fcn call w/ _flag_ and _pars_ on all workers, they only calculate
+    # the non-nil _derivs_ (master only).
+    #
+    def ShmParallel.broadcast(flag,pars,derivs)
+      @@comm.broadcast(flag,pars,derivs)
+    end
+    #
+    # Waits for the workers, adds their derivatives to _derivs_ and returns 
+    # the sum of their fcn values (master only).
+    #
+    def ShmParallel.gather(derivs); @@comm.gather(derivs); end
+    #
+    # Waits for the workers to finish a Fcn#hessian call and adds theirs to 
+    # _hess_ (master only).
+    #
+    def ShmParallel.gather_hessian(hess); @@comm.gather_hessian(hess); end
+    #
+    # Returns the time (in seconds) each worker spent on the last call.
+    #
+    def ShmParallel.node_times; @@comm.node_times; end
+    #
+    # If the processes are out of balance, tells the workers to divide up the
+    # Datasets again, does the same on the master and returns <tt>true</tt> 
+    # (master only, see Parallel.rebalance_scales). Waits for all workers to
+    # finish, so the next broadcast is summed over the new division.
+    #
+    def ShmParallel.rebalance
+      scales = Parallel.rebalance_scales(@@div_procs,@@scales)
+      return false if(scales.nil?)
+      @@comm.rebalance(scales)
+      ShmParallel.redivide(scales)
+      @@comm.wait_rebalanced
+      true
+    end
+    #
+    # Divides the Datasets again using _scales_ and reads in whatever this 
+    # process now needs.
+    #
+    def ShmParallel.redivide(scales)
+      old_div = @@div_procs
+      @@div_procs = Parallel.divide_datasets(old_div.length,scales)
+      @@scales = scales
+      Parallel.reassign(old_div,@@div_procs,@@rank,@@max_par_id)
+    end
+    #
+    # Tells the workers to exit and waits for them (master only).
+    #
+    def ShmParallel.stop
+      @@comm.terminate
+      Process.waitall
+    end
+    #
+    # Worker loop, calculates _fcn_ for each call from the master until told to
+    # exit.
+    #
+    def ShmParallel.serve(fcn)
+      loop{
+	call = @@comm.wait_for_call(@@rank)
+	break if(call.nil?)
+	flag,pars,derivs = *call
+	if(flag == :rebalance)
+	  ShmParallel.redivide(pars)
+	  fcn.datasets_changed
+	  @@comm.rebalanced(@@rank)
+	  next
+	end
+	if(Fcn.hessian_flag?(flag))
+	  @@comm.reply_hessian(@@rank,fcn.hessian_on_node(flag,pars))
+	  next
+	end
+	fcn_val = fcn.fcn_on_node(flag,pars,derivs)
+	@@comm.reply(@@rank,fcn_val,derivs)
+      }
+    end
+    #
+  end
+end
@@ -0,0 +1,168 @@
+// Author: Mike Williams
+//_____________________________________________________________________________
+#include "ampscan.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/// Amps are scanned in blocks of this many
+static const int SCAN_BLOCK = 4096;
+/// Independent partial sums (+ ranges, counts) kept per block, so the loops
+/// vectorize w/o reassociating the double sums
+static const int SCAN_LANES = 4;
+/// Float exponent bits (all set for NaN or Inf)
+static const unsigned FLT_EXP_BITS = 0x7f800000;
+//_____________________________________________________________________________
+/// Adds amps @a vals (@a num re,im pairs starting at event @a first) to
+/// @a stats
+static void scan_block(const float *__vals,int __num,int __first,
+		       AmpsFileStats &__stats){
+  double mag2[SCAN_BLOCK];
+  int bad[SCAN_BLOCK];
+  unsigned bits[2*SCAN_BLOCK];
+  float clean[2*SCAN_BLOCK];
+  memcpy(bits,__vals,2*__num*sizeof(float));
+  // NaN/Inf are found from the bits and zeroed w/ a mask (no branches or 
+  // float compares, so this vectorizes)
+  for(int i = 0; i < __num; i++){
+    unsigned exp_re = bits[2*i] & FLT_EXP_BITS;
+    unsigned exp_im = bits[2*i + 1] & FLT_EXP_BITS;
+    bad[i] = (exp_re == FLT_EXP_BITS) | (exp_im == FLT_EXP_BITS);
+    unsigned mask = (unsigned)bad[i] - 1; // (0 if bad, all 1's if not)
+    bits[2*i] &= mask;
+    bits[2*i + 1] &= mask;
+  }
+  memcpy(clean,bits,2*__num*sizeof(float));
+  for(int i = 0; i < __num; i++){
+    double re = clean[2*i],im = clean[2*i + 1];
+    mag2[i] = re*re + im*im;
+  }
+  double sums[SCAN_LANES],maxs[SCAN_LANES],mins[SCAN_LANES];
+  int bads[SCAN_LANES],zeros[SCAN_LANES];
+  for(int l = 0; l < SCAN_LANES; l++){
+    sums[l] = maxs[l] = 0.;
+    mins[l] = DBL_MAX;
+    bads[l] = zeros[l] = 0;
+  }
+  int num_lanes = __num - __num % SCAN_LANES;
+  for(int i = 0; i < num_lanes; i += SCAN_LANES){
+    for(int l = 0; l < SCAN_LANES; l++){
+      double m = mag2[i + l];
+      int b = bad[i + l];
+      sums[l] += m;
+      maxs[l] = (m > maxs[l]) ? m : maxs[l];
+      double good_m = b ? DBL_MAX : m;
+      mins[l] = (good_m < mins[l]) ? good_m : mins[l];
+      bads[l] += b;
+      zeros[l] += (m == 0.) & !b;
+    }
+  }
+  for(int i = num_lanes; i < __num; i++){ // (the last < SCAN_LANES amps)
+    int l = i - num_lanes;
+    sums[l] += mag2[i];
+    maxs[l] = max(maxs[l],mag2[i]);
+    mins[l] = min(mins[l],bad[i] ? DBL_MAX : mag2[i]);
+    bads[l] += bad[i];
+    zeros[l] += (mag2[i] == 0.) & !bad[i];
+  }
+  double sum = 0.,max_mag2 = 0.,min_mag2 = DBL_MAX;
+  int num_bad = 0,num_zero = 0;
+  for(int l = 0; l < SCAN_LANES; l++){
+    sum += sums[l];
+    max_mag2 = max(max_mag2,maxs[l]);
+    min_mag2 = min(min_mag2,mins[l]);
+    num_bad += bads[l];
+    num_zero += zeros[l];
+  }
+  if(num_bad > 0 && __stats.first_bad < 0)
+    __stats.first_bad = __first + (int)(find(bad,bad + __num,1) - bad);
+  int num_good = __stats.num_events - __stats.num_bad; // so far
+  if(num_good == 0) __stats.min_mag2 = min_mag2;
+  else __stats.min_mag2 = min(__stats.min_mag2,min_mag2);
+  __stats.max_mag2 = max(__stats.max_mag2,max_mag2);
+  __stats.sum_mag2 += sum;
+  __stats.num_bad += num_bad;
+  __stats.num_zero += num_zero;
+  __stats.num_events += __num;
+}
+//_____________________________________________________________________________
+bool scan_amps_file(const string &__file,AmpsFileStats &__stats){
+  __stats = AmpsFileStats();
+  __stats.file = __file;
+  int fd = open(__file.c_str(),O_RDONLY);
+  struct stat st;
+  if(fd < 0 || fstat(fd,&st) != 0){
+    if(fd >= 0) close(fd);
+    return false;
+  }
+  __stats.readable = true;
+  __stats.bytes = (long long)st.st_size;
+  __stats.truncated = (st.st_size % (2*sizeof(float)) != 0);
+  int num_events = (int)(st.st_size/(2*sizeof(float)));
+  if(num_events == 0){
+    close(fd);
+    return true;
+  }
+  void *ptr = mmap(0,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+  close(fd); // (the mapping stays)
+  if(ptr == MAP_FAILED){
+    __stats.readable = false;
+    return false;
+  }
+  madvise(ptr,st.st_size,MADV_SEQUENTIAL);
+  const float *vals = (const float*)ptr;
+  for(int first = 0; first < num_events; first += SCAN_BLOCK){
+    int num = min(SCAN_BLOCK,num_events - first);
+    scan_block(vals + 2*(size_t)first,num,first,__stats);
+  }
+  munmap(ptr,st.st_size);
+  if(__stats.num_bad == __stats.num_events) __stats.min_mag2 = 0.;
+  return true;
+}
+//_____________________________________________________________________________
+/// Shared by the scan_amps_files threads
+struct ScanQueue {
+  const vector<string> *files;
+  vector<AmpsFileStats> *stats;
+  int next;
+  pthread_mutex_t mutex;
+};
+/// Scans files from the queue until there are none left
+static void* scan_thread(void *__ptr){
+  ScanQueue *queue = (ScanQueue*)__ptr;
+  while(true){
+    pthread_mutex_lock(&queue->mutex);
+    int f = queue->next++;
+    pthread_mutex_unlock(&queue->mutex);
+    if(f >= (int)queue->files->size()) break;
+    scan_amps_file((*queue->files)[f],(*queue->stats)[f]);
+  }
+  return 0;
+}
+//_____________________________________________________________________________
+void scan_amps_files(const vector<string> &__files,int __num_threads,
+		     vector<AmpsFileStats> &__stats){
+  __stats.assign(__files.size(),AmpsFileStats());
+  ScanQueue queue;
+  queue.files = &__files;
+  queue.stats = &__stats;
+  queue.next = 0;
+  pthread_mutex_init(&queue.mutex,0);
+  int num_threads = max(1,min(__num_threads,(int)__files.size()));
+  vector<pthread_t> threads(num_threads - 1);
+  vector<bool> started(num_threads - 1,false);
+  for(int t = 0; t < num_threads - 1; t++)
+    started[t] = (pthread_create(&threads[t],0,scan_thread,&queue) == 0);
+  scan_thread(&queue); // this thread helps out too
+  for(int t = 0; t < num_threads - 1; t++){
+    if(started[t]) pthread_join(threads[t],0);
+  }
+  pthread_mutex_destroy(&queue.mutex);
+}
+//_____________________________________________________________________________
@@ -0,0 +1,45 @@
+// -*- C++ -*-
+// Author: Mike Williams
+//_____________________________________________________________________________
+#ifndef _ampscan_H
+#define _ampscan_H
+
+#include <string>
+#include <vector>
+
+using namespace std;
+/*
+ * Validation of amps files (see pwa-checkamps). Each file is mmapped and
+ * swept once in blocks (the loops are written to be vectorized) counting
+ * non-finite values and collecting the range + sum of |A|^2, so a whole bin
+ * directory can be checked at about the speed it can be read.
+ */
+//_____________________________________________________________________________
+/// What was found in 1 amps file.
+struct AmpsFileStats {
+  string file;
+  long long bytes;    // file size
+  int num_events;     // complete amps in the file
+  bool readable;
+  bool truncated;     // size isn't a multiple of an amp
+  int num_bad;        // amps w/ a NaN or Inf part
+  int first_bad;      // event of the 1st of them (-1 if none)
+  int num_zero;       // amps which are exactly 0
+  double min_mag2;    // range of |A|^2 over the finite amps
+  double max_mag2;
+  double sum_mag2;    // sum of |A|^2 over the finite amps
+
+  AmpsFileStats() : bytes(0),num_events(0),readable(false),truncated(false),
+		    num_bad(0),first_bad(-1),num_zero(0),min_mag2(0.),
+		    max_mag2(0.),sum_mag2(0.) {}
+};
+//_____________________________________________________________________________
+/// Scans amps @a file into @a stats. Returns false if it can't be read.
+bool scan_amps_file(const string &__file,AmpsFileStats &__stats);
+/// Scans each of @a files (on up to @a num_threads threads), @a stats[f] is
+/// set for @a files[f].
+void scan_amps_files(const vector<string> &__files,int __num_threads,
+		     vector<AmpsFileStats> &__stats);
+//_____________________________________________________________________________
+
+#endif /* _ampscan_H */
@@ -0,0 +1,301 @@
+// Author: Mike Williams
+//_____________________________________________________________________________
+/*
+ * Benchmarks for the PWA core kernels (no Ruby needed). Synthetic amps files
+ * are written to a temporary directory, then each kernel is timed on them.
+ * Build + run w/:
+ *
+ *   make -C pwa/src bench && pwa/src/pwa-bench [events] [amps] [ic] [reps]
+ *
+ * where amps is the number of amps in each of the ic incoherent wavesets.
+ * The free-grad line times -log(L) + norm w/ derivatives w/r to only half of
+ * the parameters (see evt_log_liklihood).
+ */
+#include "pwa-core.h"
+#include "timers.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <string>
+#include <fstream>
+#include <unistd.h>
+
+/// Setup shared by all of the benchmarks
+struct BenchData {
+  int num_events,num_ic,num_amps,num_pars,reps;
+  string dir;
+  vector<vector<string> > files; // [ic][a]
+  vector<double> cuts,wts;
+  AmpStore amps;
+  VectorDbl2D params;
+  VectorDbl3D dparams;
+  VectorFlt3D norm_vals;
+};
+//_____________________________________________________________________________
+/// Returns a random complex number w/ |real|,|imag| < 1
+complex<double> rand_complex(){
+  return complex<double>(2.*rand()/RAND_MAX - 1,2.*rand()/RAND_MAX - 1);
+}
+//_____________________________________________________________________________
+/// Prints 1 line of results, @a time is the total over @a reps calls
+void report(const char *__name,int __reps,double __time,double __events,
+	    double __bytes){
+  double per_call = __time/__reps;
+  printf("%-24s %12.4f",__name,1e3*per_call);
+  if(__events > 0) printf(" %14.4g",__events/per_call);
+  else printf(" %14s","-");
+  printf(" %10.3f\n",__bytes/per_call/1e9);
+}
+//_____________________________________________________________________________
+/// Writes the synthetic amps files, sets up params, dparams, etc.
+void setup(BenchData &__data){
+  char dir[] = "/tmp/pwa-bench.XXXXXX";
+  if(mkdtemp(dir) == 0){
+    perror("pwa-bench: mkdtemp");
+    exit(1);
+  }
+  __data.dir = dir;
+  int num_events = __data.num_events;
+  vector<complex<float> > buf(num_events);
+  __data.files.resize(__data.num_ic);
+  for(int ic = 0; ic < __data.num_ic; ic++){
+    for(int a = 0; a < __data.num_amps; a++){
+      char file[256];
+      sprintf(file,"%s/ic%d-a%d.amps",dir,ic,a);
+      for(int ev = 0; ev < num_events; ev++) buf[ev] = rand_complex();
+      ofstream out(file,ios::out|ios::binary);
+      out.write((char*)&buf[0],num_events*sizeof(complex<float>));
+      __data.files[ic].push_back(file);
+    }
+  }
+  // keep ~90% of the events
+  __data.cuts.resize(num_events);
+  for(int ev = 0; ev < num_events; ev++)
+    __data.cuts[ev] = (rand() % 10 == 0) ? -1 : 1;
+  // each amp gets its own (complex) parameter: 2 MINUIT pars (+ par 0)
+  __data.num_pars = 2*__data.num_ic*__data.num_amps + 1;
+  __data.params.resize(__data.num_ic);
+  __data.dparams.resize(__data.num_ic);
+  __data.norm_vals.resize(__data.num_ic);
+  int par = 1;
+  for(int ic = 0; ic < __data.num_ic; ic++){
+    __data.params[ic].resize(__data.num_amps);
+    __data.dparams[ic].resize(__data.num_amps);
+    __data.norm_vals[ic].resize(__data.num_amps);
+    for(int a = 0; a < __data.num_amps; a++){
+      __data.params[ic][a] = rand_complex();
+      __data.dparams[ic][a].assign(__data.num_pars,0.);
+      __data.dparams[ic][a][par++] = 1.;
+      __data.dparams[ic][a][par++] = complex<double>(0,1);
+      __data.norm_vals[ic][a].resize(__data.num_amps);
+    }
+  }
+}
+//_____________________________________________________________________________
+/// Removes the amps files
+void cleanup(BenchData &__data){
+  for(int ic = 0; ic < __data.num_ic; ic++){
+    for(int a = 0; a < __data.num_amps; a++)
+      unlink(__data.files[ic][a].c_str());
+  }
+  rmdir(__data.dir.c_str());
+}
+//_____________________________________________________________________________
+/// Reads all amps files (w/ cuts) into the AmpStore
+void bench_read(BenchData &__data){
+  int num_pass = 0;
+  for(int ev = 0; ev < __data.num_events; ev++)
+    if(__data.cuts[ev] > 0) num_pass++;
+  vector<int> num_amps(__data.num_ic,__data.num_amps);
+  __data.amps.resize(num_pass,num_amps);
+  __data.wts.assign(num_pass,1.);
+  double start = wall_time();
+  for(int r = 0; r < __data.reps; r++){
+    for(int ic = 0; ic < __data.num_ic; ic++){
+      for(int a = 0; a < __data.num_amps; a++)
+	read_amps_file(__data.files[ic][a].c_str(),&__data.cuts,0,
+		       __data.amps.cols[ic][a]);
+    }
+  }
+  double amps = (double)__data.num_ic*__data.num_amps;
+  report("read-amps",__data.reps,wall_time() - start,__data.num_events,
+	 __data.num_events*amps*sizeof(complex<float>));
+}
+//_____________________________________________________________________________
+/// -log(L) w/ and w/o derivatives
+void bench_log_l(BenchData &__data,bool __do_derivs){
+  vector<double> derivs(__data.num_pars,0.);
+  double sum = 0.,start = wall_time();
+  for(int r = 0; r < __data.reps; r++)
+    sum += evt_log_liklihood(__data.amps,__data.params,__data.dparams,
+			     __data.wts,__do_derivs,derivs);
+  double time = wall_time() - start;
+  int num_events = __data.amps.num_events;
+  double amps = (double)__data.num_ic*__data.num_amps;
+  report(__do_derivs ? "log-liklihood(derivs)" : "log-liklihood",
+	 __data.reps,time,num_events,
+	 num_events*(amps*sizeof(complex<float>) + sizeof(double)));
+  if(sum == 0.) printf("(sum is 0)\n"); // keep the calls from being dropped
+}
+//_____________________________________________________________________________
+/// Norm-int sums over the amps files, then the norm (w/ derivatives)
+void bench_norm(BenchData &__data){
+  double start = wall_time();
+  for(int r = 0; r < __data.reps; r++){
+    for(int ic = 0; ic < __data.num_ic; ic++){
+      vector<const char*> files;
+      for(int a = 0; a < __data.num_amps; a++)
+	files.push_back(__data.files[ic][a].c_str());
+      int num_used;
+      norm_int_sums(files,&__data.cuts,__data.num_events,
+		    __data.norm_vals[ic],num_used);
+    }
+  }
+  double amps = (double)__data.num_ic*__data.num_amps;
+  report("norm-int-sums",__data.reps,wall_time() - start,__data.num_events,
+	 __data.num_events*amps*sizeof(complex<float>));
+  // evt_norm is tiny, so call it many more times
+  int reps = 1000*__data.reps;
+  vector<double> derivs(__data.num_pars,0.);
+  double sum = 0.;
+  start = wall_time();
+  for(int r = 0; r < reps; r++)
+    sum += evt_norm(__data.norm_vals,__data.params,__data.dparams,true,derivs);
+  report("norm(derivs)",reps,wall_time() - start,0,
+	 __data.num_ic*__data.num_amps*amps*sizeof(complex<float>));
+  if(sum == 0.) printf("(sum is 0)\n");
+}
+//_____________________________________________________________________________
+/// Compares -log(L) (w/ derivs) using mixed to double precision
+void bench_precision(BenchData &__data){
+  vector<double> derivs(__data.num_pars,0.),mixed_derivs(__data.num_pars,0.);
+  double log_l = 0.,mixed_log_l = 0.;
+  double start = wall_time();
+  for(int r = 0; r < __data.reps; r++)
+    log_l = evt_log_liklihood(__data.amps,__data.params,__data.dparams,
+			      __data.wts,true,derivs);
+  double time = wall_time() - start;
+  __data.amps.precision = PREC_MIXED;
+  start = wall_time();
+  for(int r = 0; r < __data.reps; r++)
+    mixed_log_l = evt_log_liklihood(__data.amps,__data.params,__data.dparams,
+				    __data.wts,true,mixed_derivs);
+  double mixed_time = wall_time() - start;
+  __data.amps.precision = PREC_DOUBLE;
+  int num_events = __data.amps.num_events;
+  double amps = (double)__data.num_ic*__data.num_amps;
+  report("log-liklihood(mixed)",__data.reps,mixed_time,num_events,
+	 num_events*(amps*sizeof(complex<float>) + sizeof(double)));
+  double max_deriv = 0.,max_diff = 0.;
+  for(int p = 0; p < __data.num_pars; p++){
+    max_deriv = max(max_deriv,fabs(derivs[p]));
+    max_diff = max(max_diff,fabs(derivs[p] - mixed_derivs[p]));
+  }
+  printf("  mixed vs double: %.2fx faster, -log(L) rel diff %.2e, "
+	 "max deriv diff %.2e\n",time/mixed_time,
+	 fabs(mixed_log_l - log_l)/fabs(log_l),max_diff/max_deriv);
+}
+//_____________________________________________________________________________
+/// -log(L) + norm w/ derivatives only w/r to free parameters (the pars of
+/// every other amp are fixed), accumulated into 1 packed gradient, compared
+/// to calculating all of them
+void bench_free_grad(BenchData &__data){
+  vector<int> free;
+  for(int p = 1; p < __data.num_pars; p++){
+    if(((p - 1)/2) % 2 == 0) free.push_back(p);
+  }
+  int num_free = (int)free.size();
+  vector<double> lderivs(__data.num_pars),nderivs(__data.num_pars);
+  vector<double> grad(num_free);
+  // 1 untimed call to warm up, then alternate the 2 so drift hits both
+  double sum = evt_log_liklihood(__data.amps,__data.params,__data.dparams,
+				 __data.wts,true,lderivs);
+  double time = 0.,all_time = 0.;
+  for(int r = 0; r < __data.reps; r++){
+    double start = wall_time();
+    grad.assign(num_free,0.);
+    sum += evt_log_liklihood(__data.amps,__data.params,__data.dparams,
+			     __data.wts,free,&grad[0]);
+    sum += evt_norm(__data.norm_vals,__data.params,__data.dparams,free,
+		    &grad[0]);
+    double mid = wall_time();
+    sum += evt_log_liklihood(__data.amps,__data.params,__data.dparams,
+			     __data.wts,true,lderivs);
+    sum += evt_norm(__data.norm_vals,__data.params,__data.dparams,true,
+		    nderivs);
+    time += mid - start;
+    all_time += wall_time() - mid;
+  }
+  int num_events = __data.amps.num_events;
+  double amps = (double)__data.num_ic*__data.num_amps;
+  report("fcn(free-grad)",__data.reps,time,num_events,
+	 num_events*(amps*sizeof(complex<float>) + sizeof(double)));
+  double max_deriv = 0.,max_diff = 0.;
+  for(int k = 0; k < num_free; k++){
+    double deriv = lderivs[free[k]] + nderivs[free[k]];
+    max_deriv = max(max_deriv,fabs(deriv));
+    max_diff = max(max_diff,fabs(grad[k] - deriv));
+  }
+  printf("  %d of %d pars free: %.2fx faster than all derivs, max deriv "
+	 "diff %.2e\n",num_free,__data.num_pars - 1,all_time/time,
+	 max_deriv > 0 ? max_diff/max_deriv : 0.);
+  if(sum == 0.) printf("(sum is 0)\n");
+}
+//_____________________________________________________________________________
+/// Times the Hessian on 1 thread vs on all CPUs (1 call each, it's slow)
+void bench_hessian(BenchData &__data){
+  int num_threads = max(1,(int)sysconf(_SC_NPROCESSORS_ONLN));
+  vector<bool> free(__data.num_pars,true);
+  vector<double> hess,threaded_hess;
+  vector<ParamD2> d2params; // (the amp parameters are linear)
+  double start = wall_time();
+  evt_hessian(__data.amps,__data.params,__data.dparams,d2params,
+	      &__data.norm_vals,__data.wts,free,false,hess);
+  double time = wall_time() - start;
+  double amps = (double)__data.num_ic*__data.num_amps;
+  report("hessian",1,time,__data.amps.num_events,
+	 __data.amps.num_events*amps*sizeof(complex<float>));
+  start = wall_time();
+  evt_hessian(__data.amps,__data.params,__data.dparams,d2params,
+	      &__data.norm_vals,__data.wts,free,false,threaded_hess,
+	      num_threads);
+  double threaded_time = wall_time() - start;
+  double max_hess = 0.,max_diff = 0.;
+  for(int k = 0; k < (int)hess.size(); k++){
+    max_hess = max(max_hess,fabs(hess[k]));
+    max_diff = max(max_diff,fabs(hess[k] - threaded_hess[k]));
+  }
+  printf("  %d threads: %.2fx faster, max diff %.2e\n",num_threads,
+	 time/threaded_time,max_hess > 0 ? max_diff/max_hess : 0.);
+}
+//_____________________________________________________________________________
+
+int main(int __argc,char *__argv[]){
+  BenchData data;
+  data.num_events = (__argc > 1) ? atoi(__argv[1]) : 200000;
+  data.num_amps = (__argc > 2) ? atoi(__argv[2]) : 8;
+  data.num_ic = (__argc > 3) ? atoi(__argv[3]) : 2;
+  data.reps = (__argc > 4) ? atoi(__argv[4]) : 10;
+  if(data.num_events <= 0 || data.num_amps <= 0 || data.num_ic <= 0
+     || data.reps <= 0){
+    fprintf(stderr,"Usage: pwa-bench [events] [amps] [ic] [reps]\n");
+    return 1;
+  }
+  srand(12345);
+  setup(data);
+  printf("%d events, %d x %d amps, %d reps\n",data.num_events,data.num_ic,
+	 data.num_amps,data.reps);
+  printf("%-24s %12s %14s %10s\n","kernel","ms/call","events/s","GB/s");
+  bench_read(data);
+  bench_log_l(data,false);
+  bench_log_l(data,true);
+  bench_precision(data);
+  bench_norm(data);
+  bench_free_grad(data);
+  bench_hessian(data);
+  cleanup(data);
+  return 0;
+}
+//_____________________________________________________________________________
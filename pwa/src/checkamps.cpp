@@ -0,0 +1,183 @@
+// Author: Mike Williams
+//_____________________________________________________________________________
+/*
+ * Checks amps files before they're used in a fit (no Ruby needed). Each
+ * directory given is searched (recursively) for .amps files, which are
+ * scanned in parallel (see ampscan.h). Build + run w/:
+ *
+ *   make -C pwa/src checkamps
+ *   pwa/src/pwa-checkamps [-j threads] [-e events] [-m max|A|] [-o report]
+ *                         dir ...
+ *
+ * The files in each directory must all have the same number of events (-e
+ * if given, else the most common one), be complete and be finite (+ have
+ * |A| <= max if -m is given). An XML report w/ the stats for each file
+ * (including sum |A|^2, a quick check on the norm-int diagonal) is written
+ * to the report file (stdout if none). The exit status is 1 if any file
+ * failed, so it can be run as a gate before a fit.
+ */
+#include "ampscan.h"
+#include "timers.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <map>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/// All the .amps files found in 1 directory
+struct AmpsDir {
+  string dir;
+  vector<int> files; // indicies into the list of all files
+  int num_events;    // events they should all have
+};
+//_____________________________________________________________________________
+/// Adds the .amps files in @a dir (+ its subdirectories) to @a files, each
+/// directory w/ any to @a dirs
+void find_amps(const string &__dir,vector<string> &__files,
+	       vector<AmpsDir> &__dirs){
+  DIR *dir = opendir(__dir.c_str());
+  if(dir == 0) return;
+  vector<string> names,subdirs;
+  struct dirent *entry;
+  while((entry = readdir(dir)) != 0){
+    string name = entry->d_name;
+    if(name == "." || name == "..") continue;
+    struct stat st;
+    if(stat((__dir + "/" + name).c_str(),&st) != 0) continue;
+    if(S_ISDIR(st.st_mode)) subdirs.push_back(name);
+    else if(name.size() > 5 && name.compare(name.size() - 5,5,".amps") == 0)
+      names.push_back(name);
+  }
+  closedir(dir);
+  sort(names.begin(),names.end());
+  sort(subdirs.begin(),subdirs.end());
+  if(!names.empty()){
+    AmpsDir amps_dir;
+    amps_dir.dir = __dir;
+    amps_dir.num_events = 0;
+    for(int n = 0; n < (int)names.size(); n++){
+      amps_dir.files.push_back((int)__files.size());
+      __files.push_back(__dir + "/" + names[n]);
+    }
+    __dirs.push_back(amps_dir);
+  }
+  for(int s = 0; s < (int)subdirs.size(); s++)
+    find_amps(__dir + "/" + subdirs[s],__files,__dirs);
+}
+//_____________________________________________________________________________
+/// Returns what's wrong w/ @a stats ("ok" if nothing)
+const char* check(const AmpsFileStats &__stats,int __num_events,
+		  double __max_mag){
+  if(!__stats.readable) return "unreadable";
+  if(__stats.truncated) return "truncated";
+  if(__stats.num_events != __num_events) return "wrong-events";
+  if(__stats.num_bad > 0) return "non-finite";
+  if(__max_mag > 0 && sqrt(__stats.max_mag2) > __max_mag) return "too-large";
+  return "ok";
+}
+//_____________________________________________________________________________
+/// Returns @a str w/ XML special characters escaped
+string xml_escape(const string &__str){
+  string str;
+  for(size_t c = 0; c < __str.size(); c++){
+    switch(__str[c]){
+    case '&': str += "&amp;"; break;
+    case '<': str += "&lt;"; break;
+    case '>': str += "&gt;"; break;
+    case '"': str += "&quot;"; break;
+    default: str += __str[c];
+    }
+  }
+  return str;
+}
+//_____________________________________________________________________________
+int main(int __argc,char *__argv[]){
+  int num_threads = (int)sysconf(_SC_NPROCESSORS_ONLN),num_events = -1;
+  double max_mag = 0.;
+  const char *report = 0;
+  vector<string> top_dirs;
+  bool usage = (__argc < 2);
+  for(int arg = 1; arg < __argc; arg++){
+    bool has_val = (arg + 1 < __argc);
+    if(strcmp(__argv[arg],"-j") == 0 && has_val)
+      num_threads = atoi(__argv[++arg]);
+    else if(strcmp(__argv[arg],"-e") == 0 && has_val)
+      num_events = atoi(__argv[++arg]);
+    else if(strcmp(__argv[arg],"-m") == 0 && has_val)
+      max_mag = atof(__argv[++arg]);
+    else if(strcmp(__argv[arg],"-o") == 0 && has_val) report = __argv[++arg];
+    else if(__argv[arg][0] == '-') usage = true;
+    else top_dirs.push_back(__argv[arg]);
+  }
+  if(usage || top_dirs.empty()){
+    fprintf(stderr,"Usage: pwa-checkamps [-j threads] [-e events] "
+	    "[-m max|A|] [-o report] dir ...\n");
+    return 2;
+  }
+  vector<string> files;
+  vector<AmpsDir> dirs;
+  for(int d = 0; d < (int)top_dirs.size(); d++)
+    find_amps(top_dirs[d],files,dirs);
+  double start = wall_time();
+  vector<AmpsFileStats> stats;
+  scan_amps_files(files,num_threads,stats);
+  double seconds = wall_time() - start;
+  // each directory's files should have its most common number of events
+  for(int d = 0; d < (int)dirs.size(); d++){
+    map<int,int> counts;
+    int most = 0;
+    dirs[d].num_events = num_events;
+    for(int f = 0; f < (int)dirs[d].files.size(); f++){
+      int num = ++counts[stats[dirs[d].files[f]].num_events];
+      if(num_events < 0 && num > most){
+	most = num;
+	dirs[d].num_events = stats[dirs[d].files[f]].num_events;
+      }
+    }
+  }
+  FILE *out = (report == 0) ? stdout : fopen(report,"w");
+  if(out == 0){
+    fprintf(stderr,"Error! Can't write %s\n",report);
+    return 2;
+  }
+  long long bytes = 0;
+  int num_failed = 0;
+  for(int f = 0; f < (int)stats.size(); f++) bytes += stats[f].bytes;
+  fprintf(out,"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+  fprintf(out,"<amps-check files=\"%d\" bytes=\"%lld\" seconds=\"%g\">\n",
+	  (int)files.size(),bytes,seconds);
+  for(int d = 0; d < (int)dirs.size(); d++){
+    const AmpsDir &dir = dirs[d];
+    fprintf(out,"  <amps-dir name=\"%s\" events=\"%d\">\n",
+	    xml_escape(dir.dir).c_str(),dir.num_events);
+    for(int f = 0; f < (int)dir.files.size(); f++){
+      const AmpsFileStats &st = stats[dir.files[f]];
+      const char *status = check(st,dir.num_events,max_mag);
+      if(strcmp(status,"ok") != 0){
+	num_failed++;
+	fprintf(stderr,"%s: %s\n",st.file.c_str(),status);
+      }
+      string name = st.file.substr(dir.dir.size() + 1);
+      int num_good = st.num_events - st.num_bad;
+      fprintf(out,"    <amps file=\"%s\" status=\"%s\" events=\"%d\" "
+	      "bytes=\"%lld\" non-finite=\"%d\" first-non-finite=\"%d\" "
+	      "zero=\"%d\" min-mag=\"%g\" max-mag=\"%g\" sum-mag2=\"%.10g\" "
+	      "mean-mag2=\"%g\"/>\n",xml_escape(name).c_str(),status,
+	      st.num_events,st.bytes,st.num_bad,st.first_bad,st.num_zero,
+	      sqrt(st.min_mag2),sqrt(st.max_mag2),st.sum_mag2,
+	      num_good > 0 ? st.sum_mag2/num_good : 0.);
+    }
+    fprintf(out,"  </amps-dir>\n");
+  }
+  fprintf(out,"</amps-check>\n");
+  if(out != stdout) fclose(out);
+  fprintf(stderr,"checked %d files (%.3g GB) in %.3g s (%.3g GB/s): %d bad\n",
+	  (int)files.size(),1e-9*bytes,seconds,
+	  seconds > 0 ? 1e-9*bytes/seconds : 0.,num_failed);
+  return (num_failed > 0) ? 1 : 0;
+}
+//_____________________________________________________________________________
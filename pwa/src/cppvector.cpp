@@ -2,16 +2,9 @@
 //_____________________________________________________________________________
 #include "ruby-complex.h"
 #include "pwa-src.h"
-// globals:
-VALUE rb_cPWA;
-VALUE rb_cCppVectorDbl2D;
-VALUE rb_cCppVectorFlt2D;
-VALUE rb_cCppVectorDbl3D;
-VALUE rb_cCppVectorFlt3D;
-VectorDbl2D __VectorDbl2D__;
-VectorFlt2D __VectorFlt2D__;
-VectorDbl3D __VectorDbl3D__;
-VectorFlt3D __VectorFlt3D__;
+#include <cstring>
+#include <cstdio>
+#include <stdint.h>
 //_____________________________________________________________________________
 /// Tell Ruby to use this function when garbage collecting CppVectorDbl2D
 void cppvectdbl2d_free(void *__ptr){
@@ -33,13 +26,10 @@ void cppvectflt3d_free(void *__ptr){
   delete (VectorFlt3D*)__ptr;
   __ptr = 0;
 }
-//_____________________________________________________________________________
-
-/// Obtains the C++ pointer from the Ruby object
-template <typename _Tp> _Tp* get_cpp_ptr(VALUE __ruby_obj,const _Tp &__dummy){
-  _Tp *ptr;
-  Data_Get_Struct(__ruby_obj,_Tp,ptr);
-  return ptr;
+/// Tell Ruby to use this function when garbage collecting AmpStore
+void ampstore_free(void *__ptr){
+  delete (AmpStore*)__ptr;
+  __ptr = 0;
 }
 //_____________________________________________________________________________
 /* Creates an empty vector */
@@ -62,6 +52,11 @@ VALUE rb_cppvectflt3d_new(VALUE __class){
   VectorFlt3D *ptr = new VectorFlt3D();
   return Data_Wrap_Struct(__class,0,cppvectflt3d_free,ptr);
 }
+/* Creates an empty amplitude store */
+VALUE rb_ampstore_new(VALUE __class){
+  AmpStore *ptr = new AmpStore();
+  return Data_Wrap_Struct(__class,0,ampstore_free,ptr);
+}
 //_____________________________________________________________________________
 /// Resizes the vector
 template <typename _Tp> void cppvect2d_resize(_Tp *__ptr,VALUE __ary){
@@ -302,6 +297,502 @@ VALUE rb_cppvectflt3d_clear(VALUE __self){
   return __self;
 }
 //_____________________________________________________________________________
+/*
+ * Packed binary copies of the vectors (to_packed/from_packed, the _packed
+ * file methods write/read the same bytes). Everything is native endian:
+ *
+ *   char[8]  "PWAVECT1"
+ *   int32    rank (2 or 3), bytes per real number (4 or 8), number of shape
+ *            entries, then the shape: the number of rows, each row's length
+ *            (for 3D, followed by the lengths of each of their rows)
+ *   re,im    pairs, innermost rows in order
+ *
+ * Each innermost row is contiguous, so it's copied w/ a single memcpy (if
+ * the precision matches, else it's converted).
+ */
+static const char PACKED_MAGIC[9] = "PWAVECT1";
+/// Size of the packed header w/ @a num_shape shape entries
+inline size_t packed_head_size(size_t __num_shape){
+  return 8 + (3 + __num_shape)*sizeof(int32_t);
+}
+/// Appends the shape of @a vec + the pointers to its rows
+template <typename _Tp> 
+void packed_rows(vector<vector<complex<_Tp> > > &__vec,vector<int32_t> &__shape,
+		 vector<vector<complex<_Tp> >*> &__rows){
+  __shape.push_back((int32_t)__vec.size());
+  for(size_t i = 0; i < __vec.size(); i++){
+    __shape.push_back((int32_t)__vec[i].size());
+    __rows.push_back(&__vec[i]);
+  }
+}
+/// Appends the shape of @a vec + the pointers to its innermost rows
+template <typename _Tp> 
+void packed_rows(vector<vector<vector<complex<_Tp> > > > &__vec,
+		 vector<int32_t> &__shape,
+		 vector<vector<complex<_Tp> >*> &__rows){
+  __shape.push_back((int32_t)__vec.size());
+  for(size_t i = 0; i < __vec.size(); i++) 
+    __shape.push_back((int32_t)__vec[i].size());
+  for(size_t i = 0; i < __vec.size(); i++){
+    for(size_t j = 0; j < __vec[i].size(); j++){
+      __shape.push_back((int32_t)__vec[i][j].size());
+      __rows.push_back(&__vec[i][j]);
+    }
+  }
+}
+/// Resizes @a vec to packed @a shape (w/ @a num entries). Returns the number
+/// of entries used (-1 if there aren't enough).
+template <typename _Tp> 
+int packed_resize(vector<vector<complex<_Tp> > > &__vec,const int32_t *__shape,
+		  int __num){
+  if(__num < 1 || __shape[0] < 0 || __num < 1 + __shape[0]) return -1;
+  __vec.resize(__shape[0]);
+  for(int i = 0; i < __shape[0]; i++){
+    if(__shape[1 + i] < 0) return -1;
+    __vec[i].resize(__shape[1 + i]);
+  }
+  return 1 + __shape[0];
+}
+/// Resizes @a vec to packed @a shape (w/ @a num entries). Returns the number
+/// of entries used (-1 if there aren't enough).
+template <typename _Tp> 
+int packed_resize(vector<vector<vector<complex<_Tp> > > > &__vec,
+		  const int32_t *__shape,int __num){
+  if(__num < 1 || __shape[0] < 0 || __num < 1 + __shape[0]) return -1;
+  __vec.resize(__shape[0]);
+  int used = 1 + __shape[0];
+  for(int i = 0; i < __shape[0]; i++){
+    int size2 = __shape[1 + i];
+    if(size2 < 0 || __num < used + size2) return -1;
+    __vec[i].resize(size2);
+    for(int j = 0; j < size2; j++){
+      if(__shape[used + j] < 0) return -1;
+      __vec[i][j].resize(__shape[used + j]);
+    }
+    used += size2;
+  }
+  return used;
+}
+/// Returns the packed header for @a vec (of @a rank), sets @a rows to its
+/// innermost rows + @a size to the total packed size
+template <typename _Tp,typename _Vec>
+vector<char> packed_head(_Vec &__vec,int __rank,
+			 vector<vector<complex<_Tp> >*> &__rows,
+			 size_t &__size){
+  vector<int32_t> shape;
+  packed_rows(__vec,shape,__rows);
+  vector<char> head(packed_head_size(shape.size()));
+  int32_t info[3] = {__rank,(int32_t)sizeof(_Tp),(int32_t)shape.size()};
+  memcpy(&head[0],PACKED_MAGIC,8);
+  memcpy(&head[8],info,sizeof(info));
+  if(!shape.empty()) 
+    memcpy(&head[8 + sizeof(info)],&shape[0],shape.size()*sizeof(int32_t));
+  __size = head.size();
+  for(size_t r = 0; r < __rows.size(); r++) 
+    __size += __rows[r]->size()*sizeof(complex<_Tp>);
+  return head;
+}
+/// Copies the re,im pairs of @a rows (in order) to @a ptr
+template <typename _Tp>
+void packed_copy_rows(const vector<vector<complex<_Tp> >*> &__rows,
+		      char *__ptr){
+  for(size_t r = 0; r < __rows.size(); r++){
+    size_t bytes = __rows[r]->size()*sizeof(complex<_Tp>);
+    if(bytes > 0) memcpy(__ptr,&(*__rows[r])[0],bytes);
+    __ptr += bytes;
+  }
+}
+/// Returns @a vec (of @a rank) packed into a Ruby String
+template <typename _Tp,typename _Vec> VALUE to_packed(_Vec &__vec,int __rank){
+  vector<vector<complex<_Tp> >*> rows;
+  size_t size;
+  vector<char> head = packed_head<_Tp>(__vec,__rank,rows,size);
+  VALUE str = rb_str_new(0,(long)size);
+  memcpy(RSTRING(str)->ptr,&head[0],head.size());
+  packed_copy_rows(rows,RSTRING(str)->ptr + head.size());
+  return str;
+}
+/// Returns just the re,im pairs of packed @a vec (no header) in a Ruby 
+/// String
+template <typename _Tp,typename _Vec> VALUE to_packed_data(_Vec &__vec){
+  vector<vector<complex<_Tp> >*> rows;
+  vector<int32_t> shape;
+  packed_rows(__vec,shape,rows);
+  size_t size = 0;
+  for(size_t r = 0; r < rows.size(); r++) 
+    size += rows[r]->size()*sizeof(complex<_Tp>);
+  VALUE str = rb_str_new(0,(long)size);
+  packed_copy_rows(rows,RSTRING(str)->ptr);
+  return str;
+}
+/// Writes @a vec (of @a rank) packed to @a file. Returns false if it can't.
+template <typename _Tp,typename _Vec> 
+bool write_packed(_Vec &__vec,int __rank,const char *__file){
+  vector<vector<complex<_Tp> >*> rows;
+  size_t size;
+  vector<char> head = packed_head<_Tp>(__vec,__rank,rows,size);
+  FILE *file = fopen(__file,"wb");
+  if(file == 0) return false;
+  bool ok = (fwrite(&head[0],1,head.size(),file) == head.size());
+  for(size_t r = 0; ok && r < rows.size(); r++){
+    size_t num = rows[r]->size();
+    if(num > 0)
+      ok = (fwrite(&(*rows[r])[0],sizeof(complex<_Tp>),num,file) == num);
+  }
+  return (fclose(file) == 0) && ok;
+}
+/// Copies @a num packed re,im pairs of type @a _Up into @a row
+template <typename _Tp,typename _Up> 
+void unpack_row(const char *__data,size_t __num,vector<complex<_Tp> > &__row){
+  if(sizeof(_Tp) == sizeof(_Up)){ 
+    if(__num > 0) memcpy(&__row[0],__data,__num*sizeof(complex<_Tp>));
+    return;
+  }
+  const _Up *vals = (const _Up*)__data;
+  for(size_t i = 0; i < __num; i++) 
+    __row[i] = complex<_Tp>((_Tp)vals[2*i],(_Tp)vals[2*i + 1]);
+}
+/// Sets @a vec (of @a rank) from @a size bytes of packed @a data. Returns
+/// what's wrong w/ it (0 if nothing).
+template <typename _Tp,typename _Vec>
+const char* from_packed(_Vec &__vec,int __rank,const char *__data,
+			size_t __size){
+  int32_t info[3];
+  if(__size < packed_head_size(0) || memcmp(__data,PACKED_MAGIC,8) != 0) 
+    return "not a packed vector";
+  memcpy(info,__data + 8,sizeof(info));
+  if(info[0] != __rank) return "wrong rank";
+  if(info[1] != sizeof(float) && info[1] != sizeof(double)) 
+    return "unknown precision";
+  if(info[2] < 0 || __size < packed_head_size(info[2])) return "truncated";
+  vector<int32_t> shape(info[2] + 1); // (+1 so it's never empty)
+  if(info[2] > 0) memcpy(&shape[0],__data + 8 + sizeof(info),
+			 info[2]*sizeof(int32_t));
+  if(packed_resize(__vec,&shape[0],info[2]) != info[2]) return "bad shape";
+  vector<vector<complex<_Tp> >*> rows;
+  vector<int32_t> dummy;
+  packed_rows(__vec,dummy,rows);
+  size_t pos = packed_head_size(info[2]),pair = 2*info[1];
+  for(size_t r = 0; r < rows.size(); r++){
+    size_t num = rows[r]->size();
+    if(__size < pos + num*pair) return "truncated";
+    if(info[1] == sizeof(float))
+      unpack_row<_Tp,float>(__data + pos,num,*rows[r]);
+    else unpack_row<_Tp,double>(__data + pos,num,*rows[r]);
+    pos += num*pair;
+  }
+  return 0;
+}
+/// Sets @a vec (of @a rank) from packed Ruby String @a str
+template <typename _Tp,typename _Vec> 
+void from_packed(_Vec &__vec,int __rank,VALUE __str){
+  StringValue(__str);
+  const char *error = from_packed<_Tp>(__vec,__rank,RSTRING(__str)->ptr,
+				       (size_t)RSTRING(__str)->len);
+  if(error != 0) rb_raise(rb_eArgError,"bad packed vector (%s)",error);
+}
+/// Sets @a vec (of @a rank) from packed @a file
+template <typename _Tp,typename _Vec> 
+void read_packed(_Vec &__vec,int __rank,VALUE __file){
+  const char *error = 0,*file_name = STR2CSTR(__file);
+  { // (rb_raise doesn't run destructors, so these must be gone 1st)
+    vector<char> data;
+    FILE *file = fopen(file_name,"rb");
+    long size = -1;
+    if(file != 0 && fseek(file,0,SEEK_END) == 0) size = ftell(file);
+    if(size > 0){
+      data.resize(size);
+      rewind(file);
+      if(fread(&data[0],1,size,file) != (size_t)size) size = -1;
+    }
+    if(file != 0) fclose(file);
+    if(size < 0) error = "can't read";
+    else if(data.empty()) error = "not a packed vector";
+    else error = from_packed<_Tp>(__vec,__rank,&data[0],data.size());
+  }
+  if(error != 0) rb_raise(rb_eIOError,"%s: %s",file_name,error);
+}
+/* call-seq: to_packed -> String
+ *
+ * Returns all entries packed into a binary String (see cppvector.cpp).
+ */
+VALUE rb_cppvectdbl2d_to_packed(VALUE __self){
+  return to_packed<double>(*get_cpp_ptr(__self,__VectorDbl2D__),2);
+}
+/* call-seq: to_packed_data -> String
+ *
+ * Returns just the re,im pairs of to_packed (native double's, innermost rows
+ * in order), eg. <tt>to_packed_data.unpack('d*')</tt>.
+ */
+VALUE rb_cppvectdbl2d_to_packed_data(VALUE __self){
+  return to_packed_data<double>(*get_cpp_ptr(__self,__VectorDbl2D__));
+}
+/* call-seq: to_packed -> String
+ *
+ * Returns all entries packed into a binary String (see cppvector.cpp).
+ */
+VALUE rb_cppvectflt2d_to_packed(VALUE __self){
+  return to_packed<float>(*get_cpp_ptr(__self,__VectorFlt2D__),2);
+}
+/* call-seq: to_packed_data -> String
+ *
+ * Returns just the re,im pairs of to_packed (native float's, innermost rows
+ * in order), eg. <tt>to_packed_data.unpack('f*')</tt>.
+ */
+VALUE rb_cppvectflt2d_to_packed_data(VALUE __self){
+  return to_packed_data<float>(*get_cpp_ptr(__self,__VectorFlt2D__));
+}
+/* call-seq: to_packed -> String
+ *
+ * Returns all entries packed into a binary String (see cppvector.cpp).
+ */
+VALUE rb_cppvectdbl3d_to_packed(VALUE __self){
+  return to_packed<double>(*get_cpp_ptr(__self,__VectorDbl3D__),3);
+}
+/* call-seq: to_packed_data -> String
+ *
+ * Returns just the re,im pairs of to_packed (native double's, innermost rows
+ * in order), eg. <tt>to_packed_data.unpack('d*')</tt>.
+ */
+VALUE rb_cppvectdbl3d_to_packed_data(VALUE __self){
+  return to_packed_data<double>(*get_cpp_ptr(__self,__VectorDbl3D__));
+}
+/* call-seq: to_packed -> String
+ *
+ * Returns all entries packed into a binary String (see cppvector.cpp).
+ */
+VALUE rb_cppvectflt3d_to_packed(VALUE __self){
+  return to_packed<float>(*get_cpp_ptr(__self,__VectorFlt3D__),3);
+}
+/* call-seq: to_packed_data -> String
+ *
+ * Returns just the re,im pairs of to_packed (native float's, innermost rows
+ * in order), eg. <tt>to_packed_data.unpack('f*')</tt>.
+ */
+VALUE rb_cppvectflt3d_to_packed_data(VALUE __self){
+  return to_packed_data<float>(*get_cpp_ptr(__self,__VectorFlt3D__));
+}
+/* call-seq: from_packed(str) -> self
+ *
+ * Resizes to + sets all entries from packed String _str_ (see to_packed).
+ */
+VALUE rb_cppvectdbl2d_from_packed(VALUE __self,VALUE __str){
+  from_packed<double>(*get_cpp_ptr(__self,__VectorDbl2D__),2,__str);
+  return __self;
+}
+/* call-seq: from_packed(str) -> self
+ *
+ * Resizes to + sets all entries from packed String _str_ (see to_packed).
+ */
+VALUE rb_cppvectflt2d_from_packed(VALUE __self,VALUE __str){
+  from_packed<float>(*get_cpp_ptr(__self,__VectorFlt2D__),2,__str);
+  return __self;
+}
+/* call-seq: from_packed(str) -> self
+ *
+ * Resizes to + sets all entries from packed String _str_ (see to_packed).
+ */
+VALUE rb_cppvectdbl3d_from_packed(VALUE __self,VALUE __str){
+  from_packed<double>(*get_cpp_ptr(__self,__VectorDbl3D__),3,__str);
+  return __self;
+}
+/* call-seq: from_packed(str) -> self
+ *
+ * Resizes to + sets all entries from packed String _str_ (see to_packed).
+ */
+VALUE rb_cppvectflt3d_from_packed(VALUE __self,VALUE __str){
+  from_packed<float>(*get_cpp_ptr(__self,__VectorFlt3D__),3,__str);
+  return __self;
+}
+/* call-seq: write_packed(file) -> self
+ *
+ * Writes all entries to _file_ (packed, see to_packed).
+ */
+VALUE rb_cppvectdbl2d_write_packed(VALUE __self,VALUE __file){
+  const char *file = STR2CSTR(__file);
+  if(!write_packed<double>(*get_cpp_ptr(__self,__VectorDbl2D__),2,file))
+    rb_raise(rb_eIOError,"can't write %s",file);
+  return __self;
+}
+/* call-seq: write_packed(file) -> self
+ *
+ * Writes all entries to _file_ (packed, see to_packed).
+ */
+VALUE rb_cppvectflt2d_write_packed(VALUE __self,VALUE __file){
+  const char *file = STR2CSTR(__file);
+  if(!write_packed<float>(*get_cpp_ptr(__self,__VectorFlt2D__),2,file))
+    rb_raise(rb_eIOError,"can't write %s",file);
+  return __self;
+}
+/* call-seq: write_packed(file) -> self
+ *
+ * Writes all entries to _file_ (packed, see to_packed).
+ */
+VALUE rb_cppvectdbl3d_write_packed(VALUE __self,VALUE __file){
+  const char *file = STR2CSTR(__file);
+  if(!write_packed<double>(*get_cpp_ptr(__self,__VectorDbl3D__),3,file))
+    rb_raise(rb_eIOError,"can't write %s",file);
+  return __self;
+}
+/* call-seq: write_packed(file) -> self
+ *
+ * Writes all entries to _file_ (packed, see to_packed).
+ */
+VALUE rb_cppvectflt3d_write_packed(VALUE __self,VALUE __file){
+  const char *file = STR2CSTR(__file);
+  if(!write_packed<float>(*get_cpp_ptr(__self,__VectorFlt3D__),3,file))
+    rb_raise(rb_eIOError,"can't write %s",file);
+  return __self;
+}
+/* call-seq: read_packed(file) -> self
+ *
+ * Resizes to + sets all entries from packed _file_ (see write_packed).
+ */
+VALUE rb_cppvectdbl2d_read_packed(VALUE __self,VALUE __file){
+  read_packed<double>(*get_cpp_ptr(__self,__VectorDbl2D__),2,__file);
+  return __self;
+}
+/* call-seq: read_packed(file) -> self
+ *
+ * Resizes to + sets all entries from packed _file_ (see write_packed).
+ */
+VALUE rb_cppvectflt2d_read_packed(VALUE __self,VALUE __file){
+  read_packed<float>(*get_cpp_ptr(__self,__VectorFlt2D__),2,__file);
+  return __self;
+}
+/* call-seq: read_packed(file) -> self
+ *
+ * Resizes to + sets all entries from packed _file_ (see write_packed).
+ */
+VALUE rb_cppvectdbl3d_read_packed(VALUE __self,VALUE __file){
+  read_packed<double>(*get_cpp_ptr(__self,__VectorDbl3D__),3,__file);
+  return __self;
+}
+/* call-seq: read_packed(file) -> self
+ *
+ * Resizes to + sets all entries from packed _file_ (see write_packed).
+ */
+VALUE rb_cppvectflt3d_read_packed(VALUE __self,VALUE __file){
+  read_packed<float>(*get_cpp_ptr(__self,__VectorFlt3D__),3,__file);
+  return __self;
+}
+/// Returns slice @a i of @a vec (raises IndexError if there isn't one)
+template <typename _Tp> vector<vector<complex<_Tp> > >& 
+packed_slice(vector<vector<vector<complex<_Tp> > > > &__vec,VALUE __i){
+  int i = NUM2INT(__i);
+  if(i < 0 || i >= (int)__vec.size()) 
+    rb_raise(rb_eIndexError,"no slice %d (size %d)",i,(int)__vec.size());
+  return __vec[i];
+}
+/* call-seq: slice_to_packed(i) -> String
+ *
+ * Returns the 2D slice of entries (i,*,*) packed into a binary String (as
+ * a 2D vector, see to_packed).
+ */
+VALUE rb_cppvectdbl3d_slice_to_packed(VALUE __self,VALUE __i){
+  VectorDbl3D *ptr = get_cpp_ptr(__self,__VectorDbl3D__);
+  return to_packed<double>(packed_slice(*ptr,__i),2);
+}
+/* call-seq: slice_to_packed(i) -> String
+ *
+ * Returns the 2D slice of entries (i,*,*) packed into a binary String (as
+ * a 2D vector, see to_packed).
+ */
+VALUE rb_cppvectflt3d_slice_to_packed(VALUE __self,VALUE __i){
+  VectorFlt3D *ptr = get_cpp_ptr(__self,__VectorFlt3D__);
+  return to_packed<float>(packed_slice(*ptr,__i),2);
+}
+/* call-seq: slice_from_packed(i,str) -> self
+ *
+ * Resizes to + sets the 2D slice of entries (i,*,*) from packed (2D) String
+ * _str_.
+ */
+VALUE rb_cppvectdbl3d_slice_from_packed(VALUE __self,VALUE __i,VALUE __str){
+  VectorDbl3D *ptr = get_cpp_ptr(__self,__VectorDbl3D__);
+  from_packed<double>(packed_slice(*ptr,__i),2,__str);
+  return __self;
+}
+/* call-seq: slice_from_packed(i,str) -> self
+ *
+ * Resizes to + sets the 2D slice of entries (i,*,*) from packed (2D) String
+ * _str_.
+ */
+VALUE rb_cppvectflt3d_slice_from_packed(VALUE __self,VALUE __i,VALUE __str){
+  VectorFlt3D *ptr = get_cpp_ptr(__self,__VectorFlt3D__);
+  from_packed<float>(packed_slice(*ptr,__i),2,__str);
+  return __self;
+}
+//_____________________________________________________________________________
+/* call-seq: [](event,ic,a) -> Complex
+ *
+ * Returns amp _a_ of incoherent term _ic_ for _event_. This converts it to a
+ * Ruby Complex, thus it is slow and should only be used for diagnostic
+ * purposes.
+ */
+VALUE rb_ampstore_entry(VALUE __self,VALUE __ev,VALUE __ic,VALUE __a){
+  AmpStore *ptr = get_cpp_ptr(__self,__AmpStore__);
+  return rb_complex_new((*ptr)(NUM2INT(__ev),NUM2INT(__ic),NUM2INT(__a)));
+}
+/* call-seq: []=(event,ic,a,c) -> c
+ *
+ * Set amp _a_ of incoherent term _ic_ for _event_ (if the column is shared, 
+ * this AmpStore gets its own copy 1st).
+ */
+VALUE rb_ampstore_set_entry(VALUE __self,VALUE __ev,VALUE __ic,VALUE __a,
+			    VALUE __c){
+  AmpStore *ptr = get_cpp_ptr(__self,__AmpStore__);
+  ptr->cols[NUM2INT(__ic)][NUM2INT(__a)].unshare();
+  (*ptr)(NUM2INT(__ev),NUM2INT(__ic),NUM2INT(__a)) = CPP_COMPLEX(float,__c);
+  return __c;
+}
+/* call-seq: size -> num_events
+ *
+ * Returns the number of events held.
+ */
+VALUE rb_ampstore_size(VALUE __self){
+  AmpStore *ptr = get_cpp_ptr(__self,__AmpStore__);
+  return INT2NUM(ptr->num_events);
+}
+/* call-seq: bytes -> Integer
+ *
+ * Returns the number of bytes of amplitudes held (including those shared w/
+ * other AmpStore's).
+ */
+VALUE rb_ampstore_bytes(VALUE __self){
+  AmpStore *ptr = get_cpp_ptr(__self,__AmpStore__);
+  return rb_float_new((double)ptr->bytes());
+}
+/* call-seq: precision = prec -> prec
+ *
+ * Set the arithmetic used by the -log(L) kernels, <tt>:double</tt> or
+ * <tt>:mixed</tt> (see pwa-core.h).
+ */
+VALUE rb_ampstore_set_precision(VALUE __self,VALUE __prec){
+  static ID to_s_id = rb_intern("to_s");
+  AmpStore *ptr = get_cpp_ptr(__self,__AmpStore__);
+  VALUE prec_str = rb_funcall(__prec,to_s_id,0);
+  const char *prec = STR2CSTR(prec_str);
+  if(strcmp(prec,"double") == 0) ptr->precision = PREC_DOUBLE;
+  else if(strcmp(prec,"mixed") == 0) ptr->precision = PREC_MIXED;
+  else rb_raise(rb_eArgError,"unknown precision %s",prec);
+  return __prec;
+}
+/* call-seq: precision -> Symbol
+ *
+ * Returns the arithmetic used by the -log(L) kernels.
+ */
+VALUE rb_ampstore_precision(VALUE __self){
+  AmpStore *ptr = get_cpp_ptr(__self,__AmpStore__);
+  if(ptr->precision == PREC_MIXED) return ID2SYM(rb_intern("mixed"));
+  return ID2SYM(rb_intern("double"));
+}
+/* Clear all entries (free memory) */
+VALUE rb_ampstore_clear(VALUE __self){
+  AmpStore *ptr = get_cpp_ptr(__self,__AmpStore__);
+  ptr->clear();
+  return __self;
+}
+//_____________________________________________________________________________
 
 extern "C" void Init_cppvector(){
   rb_cPWA = rb_define_module("PWA");
@@ -320,6 +811,16 @@ extern "C" void Init_cppvector(){
 		   0);
   rb_define_method(rb_cCppVectorDbl2D,"clear",RUBY_FUNC(rb_cppvectdbl2d_clear),
 		   0);
+  rb_define_method(rb_cCppVectorDbl2D,"to_packed",
+		   RUBY_FUNC(rb_cppvectdbl2d_to_packed),0);
+  rb_define_method(rb_cCppVectorDbl2D,"to_packed_data",
+		   RUBY_FUNC(rb_cppvectdbl2d_to_packed_data),0);
+  rb_define_method(rb_cCppVectorDbl2D,"from_packed",
+		   RUBY_FUNC(rb_cppvectdbl2d_from_packed),1);
+  rb_define_method(rb_cCppVectorDbl2D,"write_packed",
+		   RUBY_FUNC(rb_cppvectdbl2d_write_packed),1);
+  rb_define_method(rb_cCppVectorDbl2D,"read_packed",
+		   RUBY_FUNC(rb_cppvectdbl2d_read_packed),1);
   /* CppVectorFlt2D */
   rb_cCppVectorFlt2D = rb_define_class_under(rb_cPWA,"CppVectorFlt2D",
 					     rb_cObject);
@@ -335,6 +836,16 @@ extern "C" void Init_cppvector(){
 		   0);
   rb_define_method(rb_cCppVectorFlt2D,"clear",RUBY_FUNC(rb_cppvectflt2d_clear),
 		   0);
+  rb_define_method(rb_cCppVectorFlt2D,"to_packed",
+		   RUBY_FUNC(rb_cppvectflt2d_to_packed),0);
+  rb_define_method(rb_cCppVectorFlt2D,"to_packed_data",
+		   RUBY_FUNC(rb_cppvectflt2d_to_packed_data),0);
+  rb_define_method(rb_cCppVectorFlt2D,"from_packed",
+		   RUBY_FUNC(rb_cppvectflt2d_from_packed),1);
+  rb_define_method(rb_cCppVectorFlt2D,"write_packed",
+		   RUBY_FUNC(rb_cppvectflt2d_write_packed),1);
+  rb_define_method(rb_cCppVectorFlt2D,"read_packed",
+		   RUBY_FUNC(rb_cppvectflt2d_read_packed),1);
   /* CppVectorDbl3D */
   rb_cCppVectorDbl3D = rb_define_class_under(rb_cPWA,"CppVectorDbl3D",
 					     rb_cObject);
@@ -350,6 +861,20 @@ extern "C" void Init_cppvector(){
 		   0);
   rb_define_method(rb_cCppVectorDbl3D,"clear",RUBY_FUNC(rb_cppvectdbl3d_clear),
 		   0);
+  rb_define_method(rb_cCppVectorDbl3D,"to_packed",
+		   RUBY_FUNC(rb_cppvectdbl3d_to_packed),0);
+  rb_define_method(rb_cCppVectorDbl3D,"to_packed_data",
+		   RUBY_FUNC(rb_cppvectdbl3d_to_packed_data),0);
+  rb_define_method(rb_cCppVectorDbl3D,"from_packed",
+		   RUBY_FUNC(rb_cppvectdbl3d_from_packed),1);
+  rb_define_method(rb_cCppVectorDbl3D,"write_packed",
+		   RUBY_FUNC(rb_cppvectdbl3d_write_packed),1);
+  rb_define_method(rb_cCppVectorDbl3D,"read_packed",
+		   RUBY_FUNC(rb_cppvectdbl3d_read_packed),1);
+  rb_define_method(rb_cCppVectorDbl3D,"slice_to_packed",
+		   RUBY_FUNC(rb_cppvectdbl3d_slice_to_packed),1);
+  rb_define_method(rb_cCppVectorDbl3D,"slice_from_packed",
+		   RUBY_FUNC(rb_cppvectdbl3d_slice_from_packed),2);
   /* CppVectorFlt3D */
   rb_cCppVectorFlt3D = rb_define_class_under(rb_cPWA,"CppVectorFlt3D",
 					     rb_cObject);
@@ -365,5 +890,31 @@ extern "C" void Init_cppvector(){
 		   0);
   rb_define_method(rb_cCppVectorFlt3D,"clear",RUBY_FUNC(rb_cppvectflt3d_clear),
 		   0);
+  rb_define_method(rb_cCppVectorFlt3D,"to_packed",
+		   RUBY_FUNC(rb_cppvectflt3d_to_packed),0);
+  rb_define_method(rb_cCppVectorFlt3D,"to_packed_data",
+		   RUBY_FUNC(rb_cppvectflt3d_to_packed_data),0);
+  rb_define_method(rb_cCppVectorFlt3D,"from_packed",
+		   RUBY_FUNC(rb_cppvectflt3d_from_packed),1);
+  rb_define_method(rb_cCppVectorFlt3D,"write_packed",
+		   RUBY_FUNC(rb_cppvectflt3d_write_packed),1);
+  rb_define_method(rb_cCppVectorFlt3D,"read_packed",
+		   RUBY_FUNC(rb_cppvectflt3d_read_packed),1);
+  rb_define_method(rb_cCppVectorFlt3D,"slice_to_packed",
+		   RUBY_FUNC(rb_cppvectflt3d_slice_to_packed),1);
+  rb_define_method(rb_cCppVectorFlt3D,"slice_from_packed",
+		   RUBY_FUNC(rb_cppvectflt3d_slice_from_packed),2);
+  /* AmpStore */
+  rb_cAmpStore = rb_define_class_under(rb_cPWA,"AmpStore",rb_cObject);
+  rb_define_singleton_method(rb_cAmpStore,"new",RUBY_FUNC(rb_ampstore_new),0);
+  rb_define_method(rb_cAmpStore,"[]",RUBY_FUNC(rb_ampstore_entry),3);
+  rb_define_method(rb_cAmpStore,"[]=",RUBY_FUNC(rb_ampstore_set_entry),4);
+  rb_define_method(rb_cAmpStore,"size",RUBY_FUNC(rb_ampstore_size),0);
+  rb_define_method(rb_cAmpStore,"bytes",RUBY_FUNC(rb_ampstore_bytes),0);
+  rb_define_method(rb_cAmpStore,"precision=",
+		   RUBY_FUNC(rb_ampstore_set_precision),1);
+  rb_define_method(rb_cAmpStore,"precision",RUBY_FUNC(rb_ampstore_precision),
+		   0);
+  rb_define_method(rb_cAmpStore,"clear",RUBY_FUNC(rb_ampstore_clear),0);
 }
 //_____________________________________________________________________________
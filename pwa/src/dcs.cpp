@@ -2,59 +2,116 @@
 //_____________________________________________________________________________
 #include "ruby-complex.h"
 #include "pwa-src.h"
-#include "cppvector.cpp"
 
-/// Returns the total amplitude for @a amps and @a params
-complex<double> get_amp_total(const vector<complex<float> > &__amps,
-            const vector<complex<double> > &__params){
-  complex<double> amp_tot(0,0);
-  int num_amps = (int)__amps.size();
-  for(int a = 0; a < num_amps; a++) amp_tot += __params[a]*__amps[a];
-  return amp_tot;
-}
+VALUE rb_cDcs;
+//_____________________________________________________________________________
+/// The amp coefficients (+ their derivatives) for each distinct vars Hash of
+/// the cross section points (see Dcs#_distinct_vars), in 1 contiguous table.
+/// Amps are flattened over the incoherent wavesets. Only the derivatives w/r
+/// to the parameters an amp depends on are kept.
+struct DcsCoeffs {
+  int num_amps;                   // over all wavesets
+  vector<int> ic_first;           // [ic] -> its 1st amp (+ 1 past the end)
+  vector<int> pt_vars;            // [pt] -> index of its vars
+  vector<int> pars;               // MINUIT ids each amp depends on...
+  vector<int> pars_first;         // ...[amp] -> its 1st one (+ 1 past end)
+  vector<complex<double> > vals;  // [vars][amp]
+  vector<complex<double> > dvals; // [vars][entry in pars]
 
+  /// Coefficients to use for point @a pt
+  const complex<double>* vals_at(int __pt) const {
+    return vals.empty() ? 0 : &vals[0] + (size_t)pt_vars[__pt]*num_amps;
+  }
+  /// Derivatives to use for point @a pt (indexed like pars)
+  const complex<double>* dvals_at(int __pt) const {
+    return dvals.empty() ? 0 : &dvals[0] + (size_t)pt_vars[__pt]*pars.size();
+  }
+};
 //_____________________________________________________________________________
-/* call-seq: _set_params(pars,vars,set_derivs)
- *
- * Sets <tt>@params</tt> using MINUIT parameters _pars_ and kinematic
- * variables _vars_ (if <tt>:dcs</tt>). If _set_derivs_ is <tt>true</tt>, then
- * <tt>@dparams</tt> is set also.
- */
-VALUE rb_dataset_set_params(VALUE __self,VALUE __pars,VALUE __vars,
-          VALUE __set_derivs){
+/// Fills @a coeffs for MINUIT parameters @a pars (+ the derivatives if 
+/// @a do_derivs, only w/r to those w/ non-nil entries in @a wanted unless
+/// it's nil). Each amp is evaluated for the 1st distinct vars through a 
+/// PWA::VarsProbe; only if it read them (this call, w/ these @a pars) is it 
+/// evaluated for the other distinct vars too, else its values are reused.
+/// Replaces calling Dataset#_set_params for every point.
+void dcs_set_coeffs(VALUE __self,VALUE __pars,bool __do_derivs,
+		    VALUE __wanted,DcsCoeffs &__coeffs){
   static ID set_pars_id = rb_intern("set_pars");
   static ID value_id = rb_intern("value");
   static ID deriv_id = rb_intern("deriv");
-  VALUE amps = rb_iv_get(__self,"@amps"); 
-  VectorDbl2D *params 
-    = get_cpp_ptr(rb_iv_get(__self,"@params"),__VectorDbl2D__);
-  VectorDbl3D *dparams 
-    = get_cpp_ptr(rb_iv_get(__self,"@dparams"),__VectorDbl3D__);
+  static ID par_ids_id = rb_intern("par_ids");
+  static ID distinct_id = rb_intern("_distinct_vars");
+  static ID probe_id = rb_intern("VarsProbe");
+  static ID new_id = rb_intern("new");
+  static ID used_id = rb_intern("__used?");
+  VALUE amps = rb_iv_get(__self,"@amps");
+  VALUE distinct = rb_funcall(__self,distinct_id,0);
+  VALUE pt_vars = rb_ary_entry(distinct,0),vars = rb_ary_entry(distinct,1);
+  VALUE probe_class = rb_const_get(rb_cPWA,probe_id);
+  int num_vars = RARRAY(vars)->len,num_pts = RARRAY(pt_vars)->len;
   int num_ic = RARRAY(amps)->len,num_pars = RARRAY(__pars)->len;
+  __coeffs.pt_vars.resize(num_pts);
+  for(int pt = 0; pt < num_pts; pt++)
+    __coeffs.pt_vars[pt] = NUM2INT(rb_ary_entry(pt_vars,pt));
+  // lay out the table
+  __coeffs.ic_first.clear();
+  __coeffs.pars.clear();
+  __coeffs.pars_first.clear();
+  int num_amps = 0;
+  for(int ic = 0; ic < num_ic; ic++){
+    VALUE ic_amps = rb_ary_entry(amps,ic);
+    __coeffs.ic_first.push_back(num_amps);
+    for(int a = 0; a < RARRAY(ic_amps)->len; a++,num_amps++){
+      VALUE amp = rb_ary_entry(ic_amps,a);
+      __coeffs.pars_first.push_back((int)__coeffs.pars.size());
+      if(!__do_derivs || rb_iv_get(amp,"@use") == Qfalse) continue;
+      VALUE ids = rb_funcall(amp,par_ids_id,0);
+      for(int i = 0; i < RARRAY(ids)->len; i++){
+	int par = NUM2INT(rb_ary_entry(ids,i));
+	if(par >= num_pars || rb_ary_entry(__pars,par) == Qnil) continue;
+	if(__wanted != Qnil && rb_ary_entry(__wanted,par) == Qnil) continue;
+	__coeffs.pars.push_back(par);
+      }
+    }
+  }
+  __coeffs.ic_first.push_back(num_amps);
+  __coeffs.pars_first.push_back((int)__coeffs.pars.size());
+  __coeffs.num_amps = num_amps;
+  int num_dvals = (int)__coeffs.pars.size();
+  __coeffs.vals.assign((size_t)num_vars*num_amps,0.);
+  __coeffs.dvals.assign((size_t)num_vars*num_dvals,0.);
+  // evaluate the amps
+  int amp_index = 0;
   for(int ic = 0; ic < num_ic; ic++){ // loop over incoherent wavesets
     VALUE ic_amps = rb_ary_entry(amps,ic);
-    int num_amps = RARRAY(ic_amps)->len;
-    for(int a = 0; a < num_amps; a++){ // loop over amps in this waveset
+    for(int a = 0; a < RARRAY(ic_amps)->len; a++,amp_index++){
       VALUE amp = rb_ary_entry(ic_amps,a); // current amp
-      if(rb_iv_get(amp,"@use") == Qfalse){
-  (*params)[ic][a] = 0.0;
-  for(int par = 0; par < num_pars; par++) (*dparams)[ic][a][par] = 0.;
-  continue;
-      }
+      if(rb_iv_get(amp,"@use") == Qfalse) continue; // (left at 0)
       rb_funcall(amp,set_pars_id,1,__pars); // call Amp#set_pars on it
-      (*params)[ic][a] = CPP_COMPLEX(float,rb_funcall(amp,value_id,1,__vars));
-      if(__set_derivs == Qfalse) continue;
-      for(int par = 0; par < num_pars; par++){ // loop over parameters
-  if(rb_ary_entry(__pars,par) == Qnil) continue; // amp doesn't use par
-  (*dparams)[ic][a][par] 
-    = CPP_COMPLEX(double,rb_funcall(amp,deriv_id,2,INT2NUM(par),__vars));
+      bool dep = true;
+      int first = __coeffs.pars_first[amp_index];
+      int last = __coeffs.pars_first[amp_index + 1];
+      for(int v = 0; v < num_vars; v++){
+	complex<double> *vals = &__coeffs.vals[(size_t)v*num_amps];
+	complex<double> *dvals = &__coeffs.dvals[0] + (size_t)v*num_dvals;
+	if(!dep && v > 0){ // same as for the 1st vars
+	  vals[amp_index] = __coeffs.vals[amp_index];
+	  for(int k = first; k < last; k++) dvals[k] = __coeffs.dvals[k];
+	  continue;
+	}
+	VALUE amp_vars = rb_ary_entry(vars,v);
+	if(v == 0) amp_vars = rb_funcall(probe_class,new_id,1,amp_vars);
+	vals[amp_index] 
+	  = CPP_COMPLEX(float,rb_funcall(amp,value_id,1,amp_vars));
+	for(int k = first; k < last; k++){
+	  VALUE par = INT2NUM(__coeffs.pars[k]);
+	  dvals[k] = CPP_COMPLEX(double,rb_funcall(amp,deriv_id,2,par,amp_vars));
+	}
+	if(v == 0) dep = RTEST(rb_funcall(amp_vars,used_id,0));
       }
     }
   }
-  return __self;
 }
-
-VALUE rb_cDcs;
 //_____________________________________________________________________________
 /* call-seq: calc_dcs(pars) -> Array
  *
@@ -62,7 +119,6 @@ VALUE rb_cDcs;
  * amps w/ <tt>amp.use == true</tt>.
  */
 VALUE rb_dcs_calc_dcs(VALUE __self,VALUE __pars,VALUE __cov_matrix){
-  static ID vars_id = rb_intern("vars");
   VALUE dcs_pts = rb_iv_get(__self,"@dcs_pts");
   double phsp = NUM2DBL(rb_iv_get(__self,"@phsp_factor"));  
   int num_pts = RARRAY(dcs_pts)->len;
@@ -70,12 +126,7 @@ VALUE rb_dcs_calc_dcs(VALUE __self,VALUE __pars,VALUE __cov_matrix){
   double dIdpar[num_pars];
   VALUE dcs = rb_ary_new2(num_pts);
   VALUE dcs_error = rb_ary_new2(num_pts);
-  VectorFlt3D *amp_vals 
-    = get_cpp_ptr(rb_iv_get(__self,"@amp_vals"),__VectorFlt3D__);
-  VectorDbl2D *params 
-    = get_cpp_ptr(rb_iv_get(__self,"@params"),__VectorDbl2D__);
-  VectorDbl3D *dparams 
-    = get_cpp_ptr(rb_iv_get(__self,"@dparams"),__VectorDbl3D__);
+  AmpStore *amp_vals = get_cpp_ptr(rb_iv_get(__self,"@amp_vals"),__AmpStore__);
   VALUE rb_cov_ary = rb_funcall(__cov_matrix,rb_intern("to_a"),0);
   double cov_matrix[num_pars][num_pars];
   for(int i = 0; i < num_pars; i++){
@@ -83,21 +134,26 @@ VALUE rb_dcs_calc_dcs(VALUE __self,VALUE __pars,VALUE __cov_matrix){
       cov_matrix[i][j] = NUM2DBL(rb_ary_entry(rb_ary_entry(rb_cov_ary,i),j));
     }
   }
+  DcsCoeffs coeffs;
+  dcs_set_coeffs(__self,__pars,true,Qnil,coeffs);
+  const int *pars = coeffs.pars.empty() ? 0 : &coeffs.pars[0];
+  int num_ic = amp_vals->num_ic();
   for(int pt = 0; pt < num_pts; pt++){ // loop over dsigma pts
-    VALUE dcs_pt = rb_ary_entry(dcs_pts,pt);
-    rb_dataset_set_params(__self,__pars,rb_funcall(dcs_pt,vars_id,0),Qtrue);
-    int num_ic = (int)(*amp_vals)[pt].size();
+    const complex<double> *vals = coeffs.vals_at(pt);
+    const complex<double> *dvals = coeffs.dvals_at(pt);
     double intensity = 0.0;
     for(int p = 0; p < num_pars; p++) dIdpar[p] = 0.;
     for(int ic = 0; ic < num_ic; ic++){ // loop over incoherent wavesets
-      complex<double> amp_tot 
-	= get_amp_total((*amp_vals)[pt][ic],(*params)[ic]);
+      int first = coeffs.ic_first[ic],num_amps = amp_vals->num_amps(ic);
+      complex<double> amp_tot = 0.;
+      for(int a = 0; a < num_amps; a++) 
+	amp_tot += vals[first + a]*(*amp_vals)(pt,ic,a);
       intensity += (amp_tot*conj(amp_tot)).real();
-      int num_amps = (int)(*amp_vals)[pt][ic].size();
       for(int a = 0; a < num_amps; a++){ // loop over amps in this waveset
-	complex<double> amp_prod = (*amp_vals)[pt][ic][a]*conj(amp_tot);
-	for(int p = 0; p < num_pars; p++) 
-	  dIdpar[p] += 2*((*dparams)[ic][a][p]*amp_prod).real();
+	complex<double> amp_prod = (*amp_vals)(pt,ic,a)*conj(amp_tot);
+	int last = coeffs.pars_first[first + a + 1];
+	for(int k = coeffs.pars_first[first + a]; k < last; k++)
+	  dIdpar[pars[k]] += 2*(dvals[k]*amp_prod).real();
       }
     }
     double error2 = 0;
@@ -118,67 +174,176 @@ VALUE rb_dcs_calc_dcs(VALUE __self,VALUE __pars,VALUE __cov_matrix){
 /* call-seq: fcn_val(flag,pars,derivs) -> chi2
  *
  * Calculates chi2 given MINUIT parameters _pars_. If _flag_ is 2, derivatives
- * are calculated and set in _derivs_.
+ * are calculated and set in (the non-<tt>nil</tt> entries of) _derivs_.
  */
 static VALUE rb_dcs_fcn_val(VALUE __self,VALUE __flag,VALUE __pars,
 			    VALUE __derivs){
   static ID cs_id = rb_intern("cs");
   static ID cs_err_id = rb_intern("cs_err");
-  static ID vars_id = rb_intern("vars");  
   int num_pars = RARRAY(__pars)->len; // length of MINUIT parameter array
   double chi2 = 0.0;
   double phsp = NUM2DBL(rb_iv_get(__self,"@phsp_factor"));  
   VALUE dcs_pts = rb_iv_get(__self,"@dcs_pts");
-  VALUE do_derivs = (NUM2INT(__flag) == 2) ? Qtrue : Qfalse;
+  bool do_derivs = (NUM2INT(__flag) == 2);
   int num_pts = RARRAY(dcs_pts)->len;
-  VectorFlt3D *amp_vals 
-    = get_cpp_ptr(rb_iv_get(__self,"@amp_vals"),__VectorFlt3D__);
-  VectorDbl2D *params 
-    = get_cpp_ptr(rb_iv_get(__self,"@params"),__VectorDbl2D__);
-  VectorDbl3D *dparams 
-    = get_cpp_ptr(rb_iv_get(__self,"@dparams"),__VectorDbl3D__);
+  AmpStore *amp_vals = get_cpp_ptr(rb_iv_get(__self,"@amp_vals"),__AmpStore__);
   double dchi2dpar[num_pars];
   for(int p = 0; p < num_pars; p++) dchi2dpar[p] = 0.;
+  DcsCoeffs coeffs;
+  dcs_set_coeffs(__self,__pars,do_derivs,__derivs,coeffs);
+  const int *pars = coeffs.pars.empty() ? 0 : &coeffs.pars[0];
+  int num_ic = amp_vals->num_ic();
+  complex<double> dcsdpar[num_pars];
   for(int pt = 0; pt < num_pts; pt++){ // loop over dsigma pts
     VALUE dcs_pt = rb_ary_entry(dcs_pts,pt);
     double cs = NUM2DBL(rb_funcall(dcs_pt,cs_id,0));
     double cs_err = NUM2DBL(rb_funcall(dcs_pt,cs_err_id,0));
-    rb_dataset_set_params(__self,__pars,rb_funcall(dcs_pt,vars_id,0),
-			  do_derivs);
-    int num_ic = (int)(*amp_vals)[pt].size();
+    const complex<double> *vals = coeffs.vals_at(pt);
+    const complex<double> *dvals = coeffs.dvals_at(pt);
     double intensity = 0.0; 
-    complex<double> dcsdpar[num_pars];
     for(int p = 0; p < num_pars; p++) dcsdpar[p] = 0.;
     for(int ic = 0; ic < num_ic; ic++){ // loop over incoherent wavesets
-      complex<double> amp_tot 
-	= get_amp_total((*amp_vals)[pt][ic],(*params)[ic]);
+      int first = coeffs.ic_first[ic],num_amps = amp_vals->num_amps(ic);
+      complex<double> amp_tot = 0.;
+      for(int a = 0; a < num_amps; a++) 
+	amp_tot += vals[first + a]*(*amp_vals)(pt,ic,a);
       intensity += (amp_tot*conj(amp_tot)).real();
-      if(do_derivs == Qfalse) continue;
-      int num_amps = (int)(*amp_vals)[pt][ic].size();
+      if(!do_derivs) continue;
       for(int a = 0; a < num_amps; a++){ // loop over amps in this waveset
-	complex<double> amp_prod = (*amp_vals)[pt][ic][a]*conj(amp_tot);
-	for(int p = 0; p < num_pars; p++) 
-	  dcsdpar[p] += (*dparams)[ic][a][p]*amp_prod;
+	complex<double> amp_prod = (*amp_vals)(pt,ic,a)*conj(amp_tot);
+	int last = coeffs.pars_first[first + a + 1];
+	for(int k = coeffs.pars_first[first + a]; k < last; k++)
+	  dcsdpar[pars[k]] += dvals[k]*amp_prod;
       }
     }
     double cs_calc = phsp*intensity;
     double diff = cs - cs_calc;
     chi2 += diff*diff/(cs_err*cs_err); // add this pt's chi^2 to total
-    if(do_derivs == Qtrue){
+    if(do_derivs){
       for(int p = 1; p < num_pars; p++){
 	complex<double> dsdp = dcsdpar[p]*phsp;
 	dchi2dpar[p] += 2*((2/(cs_err*cs_err))*(cs_calc - cs)*dsdp).real();
       }
-      for(int p = 1; p < num_pars; p++){ // set the derivatives
-	if(rb_ary_entry(__derivs,p) != Qnil){
-	  rb_ary_store(__derivs,p,rb_float_new(dchi2dpar[p]));
-	}
+    }
+  }
+  if(do_derivs){
+    for(int p = 1; p < num_pars; p++){ // set the derivatives
+      if(rb_ary_entry(__derivs,p) != Qnil){
+	rb_ary_store(__derivs,p,rb_float_new(dchi2dpar[p]));
       }
     }
   }
   return rb_float_new(chi2);
 }
 //_____________________________________________________________________________
+/* call-seq: calc_hessian(pars,fisher) -> Array
+ *
+ * Returns the 2nd derivative matrix (Array of Arrays) of chi2 w/r to MINUIT
+ * parameters _pars_. If _fisher_ is <tt>true</tt>, the Fisher information 
+ * (Gauss-Newton approximation, sum over pts of the outer product of the cross
+ * section gradients) is returned instead. The terms involving 2nd derivatives
+ * of the amplitude parameters (see Dataset#_param_d2s, for each distinct
+ * vars) are included in the 2nd derivative matrix.
+ */
+VALUE rb_dcs_calc_hessian(VALUE __self,VALUE __pars,VALUE __fisher){
+  static ID cs_id = rb_intern("cs");
+  static ID cs_err_id = rb_intern("cs_err");
+  static ID distinct_id = rb_intern("_distinct_vars");
+  int num_pars = RARRAY(__pars)->len; // length of MINUIT parameter array
+  double phsp = NUM2DBL(rb_iv_get(__self,"@phsp_factor"));  
+  VALUE dcs_pts = rb_iv_get(__self,"@dcs_pts");
+  int num_pts = RARRAY(dcs_pts)->len;
+  bool fisher = RTEST(__fisher) ? true : false;
+  AmpStore *amp_vals = get_cpp_ptr(rb_iv_get(__self,"@amp_vals"),__AmpStore__);
+  vector<int> act_pars; // only pars used by the amps can contribute
+  vector<int> act_index(num_pars,-1); // MINUIT id -> index in act_pars
+  for(int p = 1; p < num_pars; p++){
+    if(rb_ary_entry(__pars,p) == Qnil) continue;
+    act_index[p] = (int)act_pars.size();
+    act_pars.push_back(p);
+  }
+  int num_act = (int)act_pars.size();
+  vector<double> hess(num_act*num_act,0.),dI(num_act);
+  vector<vector<complex<double> > > damp;
+  DcsCoeffs coeffs;
+  dcs_set_coeffs(__self,__pars,true,Qnil,coeffs);
+  int num_ic = amp_vals->num_ic();
+  vector<complex<double> > amp_tots(num_ic);
+  vector<vector<ParamD2> > d2params; // [vars]
+  if(!fisher){
+    VALUE vars = rb_ary_entry(rb_funcall(__self,distinct_id,0),1);
+    d2params.resize(RARRAY(vars)->len);
+    for(int v = 0; v < (int)d2params.size(); v++)
+      dataset_param_d2s(__self,__pars,rb_ary_entry(vars,v),d2params[v]);
+  }
+  for(int pt = 0; pt < num_pts; pt++){ // loop over dsigma pts
+    VALUE dcs_pt = rb_ary_entry(dcs_pts,pt);
+    double cs = NUM2DBL(rb_funcall(dcs_pt,cs_id,0));
+    double cs_err = NUM2DBL(rb_funcall(dcs_pt,cs_err_id,0));
+    const complex<double> *vals = coeffs.vals_at(pt);
+    const complex<double> *dvals = coeffs.dvals_at(pt);
+    double intensity = 0.0; 
+    damp.resize(num_ic);
+    for(int i = 0; i < num_act; i++) dI[i] = 0.;
+    for(int ic = 0; ic < num_ic; ic++){ // loop over incoherent wavesets
+      int first = coeffs.ic_first[ic],num_amps = amp_vals->num_amps(ic);
+      complex<double> amp_tot = 0.;
+      damp[ic].assign(num_act,0.);
+      for(int a = 0; a < num_amps; a++){ // amp_tot + d(amp_tot)/dpar
+	complex<double> amp_val = (*amp_vals)(pt,ic,a);
+	amp_tot += vals[first + a]*amp_val;
+	int last = coeffs.pars_first[first + a + 1];
+	for(int k = coeffs.pars_first[first + a]; k < last; k++){
+	  int i = act_index[coeffs.pars[k]];
+	  if(i >= 0) damp[ic][i] += dvals[k]*amp_val;
+	}
+      }
+      amp_tots[ic] = amp_tot;
+      intensity += (amp_tot*conj(amp_tot)).real();
+      for(int i = 0; i < num_act; i++) 
+	dI[i] += 2*(damp[ic][i]*conj(amp_tot)).real();
+    }
+    double cs_calc = phsp*intensity;
+    double wt = 2/(cs_err*cs_err);
+    if(!fisher){ // the terms w/ 2nd derivatives of the amp parameters
+      const vector<ParamD2> &d2s = d2params[coeffs.pt_vars[pt]];
+      for(int d = 0; d < (int)d2s.size(); d++){
+	const ParamD2 &d2 = d2s[d];
+	int i = act_index[d2.p],j = act_index[d2.q];
+	complex<double> amp_val = (*amp_vals)(pt,d2.ic,d2.a);
+	double d2I = 2*(conj(amp_tots[d2.ic])*d2.val*amp_val).real();
+	hess[i*num_act + j] += wt*(cs_calc - cs)*phsp*d2I;
+      }
+    }
+    for(int i = 0; i < num_act; i++){
+      for(int j = 0; j <= i; j++){
+	double h = phsp*dI[i]*phsp*dI[j];
+	if(!fisher){
+	  double d2I = 0.;
+	  for(int ic = 0; ic < num_ic; ic++)
+	    d2I += 2*(damp[ic][i]*conj(damp[ic][j])).real();
+	  h += (cs_calc - cs)*phsp*d2I;
+	}
+	hess[i*num_act + j] += wt*h;
+      }
+    }
+  }
+  VALUE rb_hess = rb_ary_new2(num_pars);
+  for(int p = 0; p < num_pars; p++){
+    VALUE row = rb_ary_new2(num_pars);
+    for(int q = 0; q < num_pars; q++) rb_ary_store(row,q,rb_float_new(0.));
+    rb_ary_store(rb_hess,p,row);
+  }
+  for(int i = 0; i < num_act; i++){
+    for(int j = 0; j <= i; j++){
+      VALUE h = rb_float_new(hess[i*num_act + j]);
+      rb_ary_store(rb_ary_entry(rb_hess,act_pars[i]),act_pars[j],h);
+      rb_ary_store(rb_ary_entry(rb_hess,act_pars[j]),act_pars[i],h);
+    }
+  }
+  return rb_hess;
+}
+//_____________________________________________________________________________
 
 extern "C" void Init_dcs(){
   //-+-RDOC-+- 
@@ -186,5 +351,6 @@ extern "C" void Init_dcs(){
   VALUE rb_cDcs = rb_define_module_under(rb_cPWA,"Dcs");
   rb_define_method(rb_cDcs,"fcn_val",RUBY_FUNC(rb_dcs_fcn_val),3);
   rb_define_method(rb_cDcs,"calc_dcs",RUBY_FUNC(rb_dcs_calc_dcs),2);
+  rb_define_method(rb_cDcs,"calc_hessian",RUBY_FUNC(rb_dcs_calc_hessian),2);
 }
 //_____________________________________________________________________________
@@ -2,48 +2,58 @@
 //_____________________________________________________________________________
 #include "ruby-complex.h"
 #include "pwa-src.h"
-#include "cppvector.cpp"
-#include <fstream>
-
-/// Returns the total amplitude for @a amps and @a params
-complex<double> get_amp_total(const vector<complex<float> > &__amps,
-            const vector<complex<double> > &__params){
-  complex<double> amp_tot(0,0);
-  int num_amps = (int)__amps.size();
-  for(int a = 0; a < num_amps; a++) amp_tot += __params[a]*__amps[a];
-  return amp_tot;
-}
+#include "normint.h"
+#include <cstdio>
 
 VALUE rb_cEvt;
 //_____________________________________________________________________________
-/* call-seq: read_in_amps_for_file(cuts,ic,a,file) -> self
+/// Returns the MINUIT parameters w/ non-nil entries in both @a pars and 
+/// @a derivs (the only ones the amps can depend on + MINUIT wants).
+static vector<int> evt_free_pars(VALUE __pars,VALUE __derivs){
+  vector<int> free;
+  int num_pars = RARRAY(__pars)->len;
+  for(int p = 0; p < num_pars; p++){
+    if(rb_ary_entry(__pars,p) != Qnil && rb_ary_entry(__derivs,p) != Qnil) 
+      free.push_back(p);
+  }
+  return free;
+}
+/// Sets the @a free entries of @a derivs from (packed) gradient @a grad, 
+/// leaving the rest (eg. nil) as they are
+static void evt_set_derivs(VALUE __derivs,const vector<int> &__free,
+			   const vector<double> &__grad){
+  for(int k = 0; k < (int)__free.size(); k++)
+    rb_ary_store(__derivs,__free[k],rb_float_new(__grad[k]));
+}
+//_____________________________________________________________________________
+/* call-seq: read_in_amps_for_file(cuts,ic,a,file,first) -> self
  *
- * Reads in all amplitudes for _file_ w/ incoherent index _ic_, amplitude 
- * index _a_ and using _cuts_ (<tt>nil</tt> for no cuts).
+ * Reads in amplitudes for _file_ w/ incoherent index _ic_, amplitude 
+ * index _a_ and using _cuts_ (<tt>nil</tt> for no cuts). The 1st _first_ 
+ * events which pass the cuts are skipped (so a Dataset can be split up into 
+ * event ranges), the following ones fill all of <tt>@amp_vals</tt>. If the
+ * same file (w/ the same cuts and events) has already been read in, by this
+ * or any other Dataset, its amplitudes are shared instead (see 
+ * Evt.amp_cache_stats).
  */
 VALUE rb_evt_read_in_amps_for_file(VALUE __self,VALUE __cuts,VALUE __ic,
-				   VALUE __a,VALUE __file){  
-  VectorFlt3D *amp_vals 
-    = get_cpp_ptr(rb_iv_get(__self,"@amp_vals"),__VectorFlt3D__);
-  int num_events = (int)(*amp_vals).size();  
+				   VALUE __a,VALUE __file,VALUE __first){  
+  AmpStore *amp_vals = get_cpp_ptr(rb_iv_get(__self,"@amp_vals"),__AmpStore__);
+  int num_events = amp_vals->num_events;
   int ic = NUM2INT(__ic),a = NUM2INT(__a);
-  // open the file
-  ifstream in_file(STR2CSTR(__file));
-  complex<float> amp;
-  int event = 0,event_index = 0;
-  double cut = 1;
-  while(in_file.read((char*)&amp,sizeof(amp))){
-    if(__cuts != Qnil) cut = NUM2DBL(rb_ary_entry(__cuts,event));    
-    event++;
-    if(cut > 0){
-      (*amp_vals)[event_index][ic][a] = amp;      
-      event_index++;
-    }
+  vector<double> cuts;
+  if(__cuts != Qnil){
+    int num_cuts = RARRAY(__cuts)->len;
+    cuts.resize(num_cuts);
+    for(int ev = 0; ev < num_cuts; ev++) 
+      cuts[ev] = NUM2DBL(rb_ary_entry(__cuts,ev));
   }
-  if(event_index != num_events){
+  int num_read = amp_vals->read_column(ic,a,STR2CSTR(__file),
+				       __cuts == Qnil ? 0 : &cuts,NUM2INT(__first));
+  if(num_read != num_events){
     char error[100];
     sprintf(error,"Read incorrect number of events (%d instead of %d)\n",
-	    event_index,num_events);
+	    num_read,num_events);
     rb_fatal(error);
   }
   return __self;
@@ -52,64 +62,37 @@ VALUE rb_evt_read_in_amps_for_file(VALUE __self,VALUE __cuts,VALUE __ic,
 /* call-seq: calc_log_liklihood(flag,pars,derivs) -> -log(L)
  *
  * Returns the <tt>-log(L)</tt> given MINUIT parameters _pars_. If _flag_ is 2,
- * derivatives are calculated and set in _derivs_.
+ * derivatives are calculated and set in _derivs_ (only w/r to parameters 
+ * w/ non-<tt>nil</tt> entries in it and in _pars_, the rest are left as they
+ * are).
  */
 VALUE rb_evt_calc_log_liklihood(VALUE __self,VALUE __flag,VALUE __pars,
 				VALUE __derivs){
-  VectorFlt3D *amp_vals 
-    = get_cpp_ptr(rb_iv_get(__self,"@amp_vals"),__VectorFlt3D__);
+  AmpStore *amp_vals = get_cpp_ptr(rb_iv_get(__self,"@amp_vals"),__AmpStore__);
   VectorDbl2D *params 
     = get_cpp_ptr(rb_iv_get(__self,"@params"),__VectorDbl2D__);
   VectorDbl3D *dparams 
     = get_cpp_ptr(rb_iv_get(__self,"@dparams"),__VectorDbl3D__);
   VALUE wts_ary = rb_iv_get(__self,"@wts");
-  int num_events = (int)(*amp_vals).size();
-  int num_ic = (int)(*params).size();
-  double log_l = 0;
-  complex<double> amp_tot;
+  int num_events = amp_vals->num_events;
   bool do_derivs = NUM2INT(__flag) == 2 ? true : false;
-  int num_pars = RARRAY(__pars)->len; // length of MINUIT parameter array
-  vector<vector<complex<double> > > dl_dpar(num_ic);
-  vector<int> num_amps(num_ic);
-  for(int ic = 0; ic < num_ic; ic++){
-    num_amps[ic] = (int)(*params)[ic].size();
-    dl_dpar[ic].assign(num_amps[ic],0.);
-  }
-  for(int ev = 0; ev < num_events; ev++){ // loop over events
-    double intensity = 0.;
-    double wt = NUM2DBL(rb_ary_entry(wts_ary,ev));
-    for(int ic = 0; ic < num_ic; ic++){
-      amp_tot = get_amp_total((*amp_vals)[ev][ic],(*params)[ic]);
-      intensity += (amp_tot*conj(amp_tot)).real();
-    }
-    log_l -= wt*log(intensity);
-    if(do_derivs){
-      for(int ic = 0; ic < num_ic; ic++){
-	amp_tot = get_amp_total((*amp_vals)[ev][ic],(*params)[ic]);
-	for(int a = 0; a < num_amps[ic]; a++){
-	  complex<double> dl = -(*amp_vals)[ev][ic][a]*conj(amp_tot)/intensity;
-	  dl_dpar[ic][a] += wt*dl;
-	}
-      }
-    }
-  }
-  if(do_derivs){
-    for(int p = 0; p < num_pars; p++){
-      complex<double> dl_dp = 0.;
-      for(int ic = 0; ic < num_ic; ic++){
-	for(int a = 0; a < num_amps[ic]; a++)
-	  dl_dp += (*dparams)[ic][a][p]*dl_dpar[ic][a];
-      }
-      rb_ary_store(__derivs,p,rb_float_new(2*dl_dp.real()));  
-    }
-  }
+  vector<double> wts(num_events);
+  for(int ev = 0; ev < num_events; ev++) 
+    wts[ev] = NUM2DBL(rb_ary_entry(wts_ary,ev));
+  vector<int> free;
+  if(do_derivs) free = evt_free_pars(__pars,__derivs);
+  vector<double> grad(free.size() + 1,0.); // (+1 so it's never empty)
+  double log_l = evt_log_liklihood(*amp_vals,*params,*dparams,wts,free,
+				   &grad[0]);
+  if(do_derivs) evt_set_derivs(__derivs,free,grad);
   return rb_float_new(log_l);
 }
 //_____________________________________________________________________________
 /* call-seq: calc_norm(flag,pars,derivs) -> norm_int
  *
  * Returns the normalization integral value given MINUIT parameters _pars_. 
- * If _flag_ is 2, derivatives are calculated and set in _derivs_.
+ * If _flag_ is 2, derivatives are calculated and set in _derivs_ (see 
+ * calc_log_liklihood).
  */
 static VALUE rb_evt_calc_norm(VALUE __self,VALUE __flag,VALUE __pars,
 			      VALUE __derivs){  
@@ -119,33 +102,125 @@ static VALUE rb_evt_calc_norm(VALUE __self,VALUE __flag,VALUE __pars,
     = get_cpp_ptr(rb_iv_get(__self,"@params"),__VectorDbl2D__);
   VectorDbl3D *dparams 
     = get_cpp_ptr(rb_iv_get(__self,"@dparams"),__VectorDbl3D__);
-  int num_ic = (int)(*params).size();
-  complex<double> norm = 0.0;
   bool do_derivs = NUM2INT(__flag) == 2 ? true : false;
+  vector<int> free;
+  if(do_derivs) free = evt_free_pars(__pars,__derivs);
+  vector<double> grad(free.size() + 1,0.); // (+1 so it's never empty)
+  double norm = evt_norm(*norm_vals,*params,*dparams,free,&grad[0]);
+  if(do_derivs) evt_set_derivs(__derivs,free,grad);
+  return rb_float_new(norm);
+}
+//_____________________________________________________________________________
+/* call-seq: calc_hessian(pars,fisher,num_threads) -> Array
+ *
+ * Returns the 2nd derivative matrix (Array of Arrays) of 
+ * <tt>-log(L) + norm_int</tt> w/r to MINUIT parameters _pars_ (the norm_int
+ * only if <tt>include_norm?</tt>), summed over the events on up to 
+ * _num_threads_ threads. If _fisher_ is
+ * <tt>true</tt>, the Fisher information (sum over events of the outer product
+ * of the intensity gradients) is returned instead. The terms involving 2nd
+ * derivatives of the amplitude parameters (see Dataset#_param_d2s) are
+ * included in the 2nd derivative matrix. <tt>@params</tt> and
+ * <tt>@dparams</tt> must already be set.
+ */
+VALUE rb_evt_calc_hessian(VALUE __self,VALUE __pars,VALUE __fisher,
+			  VALUE __num_threads){
+  static ID include_norm_id = rb_intern("include_norm?");
+  AmpStore *amp_vals = get_cpp_ptr(rb_iv_get(__self,"@amp_vals"),__AmpStore__);
+  VectorDbl2D *params 
+    = get_cpp_ptr(rb_iv_get(__self,"@params"),__VectorDbl2D__);
+  VectorDbl3D *dparams 
+    = get_cpp_ptr(rb_iv_get(__self,"@dparams"),__VectorDbl3D__);
+  VectorFlt3D *norm_vals = 0;
+  if(rb_iv_get(__self,"@norm_vals") != Qnil 
+     && RTEST(rb_funcall(__self,include_norm_id,0))){
+    norm_vals = get_cpp_ptr(rb_iv_get(__self,"@norm_vals"),__VectorFlt3D__);
+  }
+  VALUE wts_ary = rb_iv_get(__self,"@wts");
+  int num_events = amp_vals->num_events;
   int num_pars = RARRAY(__pars)->len; // length of MINUIT parameter array
-  complex<double> dnorm_dpar[num_pars];
-  for(int p = 0; p < num_pars; p++) dnorm_dpar[p] = 0.;
-
-  for(int ic = 0; ic < num_ic; ic++){
-    int num_amps = (int)(*norm_vals)[ic].size();
-    for(int a1 = 0; a1 < num_amps; a1++){
-      complex<double> conj_par_norm,norm_deriv_sum = 0.;
-      for(int a2 = 0; a2 < num_amps; a2++){
-	conj_par_norm = conj((*params)[ic][a2])*(*norm_vals)[ic][a1][a2];
-	norm += (*params)[ic][a1]*conj_par_norm;
-	norm_deriv_sum += conj_par_norm;
-      }
-      if(do_derivs){
-	for(int p = 0; p < num_pars; p++)
-	  dnorm_dpar[p] += (*dparams)[ic][a1][p]*norm_deriv_sum;
-      }
-    }
+  bool fisher = RTEST(__fisher) ? true : false;
+  vector<double> wts(num_events),hess;
+  for(int ev = 0; ev < num_events; ev++) 
+    wts[ev] = NUM2DBL(rb_ary_entry(wts_ary,ev));
+  vector<bool> free(num_pars);
+  for(int p = 0; p < num_pars; p++) free[p] = rb_ary_entry(__pars,p) != Qnil;
+  vector<ParamD2> d2params;
+  if(!fisher) dataset_param_d2s(__self,__pars,Qnil,d2params);
+  vector<int> act_pars = evt_hessian(*amp_vals,*params,*dparams,d2params,
+				     norm_vals,wts,free,fisher,hess,
+				     NUM2INT(__num_threads));
+  int num_act = (int)act_pars.size();
+  VALUE rb_hess = rb_ary_new2(num_pars);
+  for(int p = 0; p < num_pars; p++){
+    VALUE row = rb_ary_new2(num_pars);
+    for(int q = 0; q < num_pars; q++) rb_ary_store(row,q,rb_float_new(0.));
+    rb_ary_store(rb_hess,p,row);
   }
-  if(do_derivs){
-    for(int p = 0; p < num_pars; p++)
-      rb_ary_store(__derivs,p,rb_float_new(2*dnorm_dpar[p].real()));
+  for(int i = 0; i < num_act; i++){
+    VALUE row = rb_ary_entry(rb_hess,act_pars[i]);
+    for(int j = 0; j < num_act; j++)
+      rb_ary_store(row,act_pars[j],rb_float_new(hess[i*num_act + j]));
   }
-  return rb_float_new(norm.real());
+  return rb_hess;
+}
+//_____________________________________________________________________________
+/* call-seq: read_norm_int_file(file,amp_files) -> true/false
+ *
+ * Sets <tt>@norm_vals</tt> from norm-int _file_ for the amps named in 
+ * _amp_files_ (an Array of file names for each incoherent index). If there's
+ * a valid binary sidecar (see normint.h) it's read, else the XML is scanned
+ * natively. Wave names are looked up in a hash, not searched for. Returns 
+ * whether the sidecar was used.
+ */
+VALUE rb_evt_read_norm_int_file(VALUE __self,VALUE __file,VALUE __amp_files){
+  VectorFlt3D *norm_vals 
+    = get_cpp_ptr(rb_iv_get(__self,"@norm_vals"),__VectorFlt3D__);
+  char error[512] = "";
+  bool from_bin = false;
+  { // (rb_raise doesn't run destructors, so these must be gone 1st)
+    int num_ic = RARRAY(__amp_files)->len;
+    vector<vector<string> > amp_files(num_ic);
+    for(int ic = 0; ic < num_ic; ic++){
+      VALUE files = rb_ary_entry(__amp_files,ic);
+      for(int a = 0; a < RARRAY(files)->len; a++)
+	amp_files[ic].push_back(STR2CSTR(rb_ary_entry(files,a)));
+    }
+    vector<NormIntSet> sets;
+    string msg;
+    if(!read_norm_int(STR2CSTR(__file),sets,msg,from_bin)
+       || !fill_norm_vals(sets,amp_files,*norm_vals,msg))
+      snprintf(error,sizeof(error),"%s",msg.c_str());
+  }
+  if(error[0] != 0) rb_raise(rb_eRuntimeError,"%s",error);
+  return from_bin ? Qtrue : Qfalse;
+}
+//_____________________________________________________________________________
+/* call-seq: Evt.amp_cache_stats -> Hash
+ *
+ * Returns the number of <tt>'columns'</tt> (amps files w/ cuts) held in the 
+ * amplitude column cache, the <tt>'bytes'</tt> they use, the 
+ * <tt>'bytes-saved'</tt> by sharing them (vs each wave of each Dataset 
+ * having its own copy) and the number of <tt>'hits'</tt> (columns shared 
+ * rather than read).
+ */
+VALUE rb_evt_amp_cache_stats(VALUE __self){
+  AmpCacheStats stats = amp_cache_stats();
+  VALUE hash = rb_hash_new();
+  rb_hash_aset(hash,rb_str_new2("columns"),INT2NUM(stats.columns));
+  rb_hash_aset(hash,rb_str_new2("bytes"),rb_float_new((double)stats.bytes));
+  rb_hash_aset(hash,rb_str_new2("bytes-saved"),
+	       rb_float_new((double)stats.bytes_saved));
+  rb_hash_aset(hash,rb_str_new2("hits"),INT2NUM(stats.hits));
+  return hash;
+}
+/* call-seq: Evt.purge_amp_cache -> nil
+ *
+ * Frees the cached amplitude columns which no Dataset uses anymore.
+ */
+VALUE rb_evt_purge_amp_cache(VALUE __self){
+  amp_cache_purge();
+  return Qnil;
 }
 //_____________________________________________________________________________
 
@@ -154,9 +229,16 @@ extern "C" void Init_evt(){
   rb_cPWA = rb_define_module("PWA");
   VALUE rb_cEvt = rb_define_module_under(rb_cPWA,"Evt");
   rb_define_method(rb_cEvt,"read_in_amps_for_file",
-		   RUBY_FUNC(rb_evt_read_in_amps_for_file),4);
+		   RUBY_FUNC(rb_evt_read_in_amps_for_file),5);
   rb_define_method(rb_cEvt,"calc_log_liklihood",
 		   RUBY_FUNC(rb_evt_calc_log_liklihood),3);
   rb_define_method(rb_cEvt,"calc_norm",RUBY_FUNC(rb_evt_calc_norm),3);
+  rb_define_method(rb_cEvt,"calc_hessian",RUBY_FUNC(rb_evt_calc_hessian),3);
+  rb_define_method(rb_cEvt,"read_norm_int_file",
+		   RUBY_FUNC(rb_evt_read_norm_int_file),2);
+  rb_define_singleton_method(rb_cEvt,"amp_cache_stats",
+			     RUBY_FUNC(rb_evt_amp_cache_stats),0);
+  rb_define_singleton_method(rb_cEvt,"purge_amp_cache",
+			     RUBY_FUNC(rb_evt_purge_amp_cache),0);
 }
 //_____________________________________________________________________________
@@ -0,0 +1,696 @@
+// Author: Mike Williams
+//_____________________________________________________________________________
+#include "ruby-complex.h"
+#include "pwa-src.h"
+#include "timers.h"
+#include "numa.h"
+#include <cstdio>
+#include <cstdlib>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+
+VALUE rb_cFcnSum;
+/// Max number of events in 1 task (a multiple of the events in a page)
+static const int FCN_TASK_EVENTS = 32768;
+//_____________________________________________________________________________
+/// A single Dataset held by a FcnSum.
+struct FcnSumDataset {
+  VALUE dataset;          // the PWA::Dataset
+  bool evt;               // type is :evt (else :dcs)
+  VALUE wts_ary;          // Ruby @wts that wts was copied from
+  vector<double> wts;     // event weights (evt only)
+  VALUE rb_derivs;        // derivs Array passed to fcn_val (dcs only)
+  vector<double> grad;    // d(-log(L) + norm)/dpar (evt), dchi2/dpar (dcs)
+                          // for the free pars (packed, see FcnSum::free)
+  bool use_norm;          // add the norm-int? (evt only, see include_norm?)
+  AmpStore *amp_vals;
+  VectorFlt3D *norm_vals;
+  VectorDbl2D *params;
+  VectorDbl3D *dparams;
+  double fcn_val;
+  int tid;                // thread which calculated it (dcs only)
+  PhaseTimer calc_timer;  // fcn_val time (dcs only, last call)
+};
+/// Events of an evt Dataset whose amps are all on 1 NUMA node. These are what
+/// the threads calculate (so they can run over the events local to them).
+struct FcnSumTask {
+  int dset;               // index in dsets
+  int node;               // NUMA node the amps are on
+  int first,last;         // events [first,last)
+  bool norm;              // calculate the norm-int too? (1 task per Dataset)
+  double bytes;           // amps + weights (+ norm-ints) read
+  double log_l,norm_val;
+  vector<double> grad;    // d(-log(L) (+ norm))/dpar for these events
+                          // (packed, see FcnSum::free)
+  int tid;                // thread which calculated it
+  bool remote;            // ...and it wasn't pinned to node?
+  PhaseTimer calc_timer;  // -log(L) time
+  PhaseTimer norm_timer;  // norm-int time
+};
+struct FcnSumThread;
+/// Sums fcn (and its derivatives) over a fixed list of Datasets.
+struct FcnSum {
+  vector<FcnSumDataset> dsets;
+  vector<int> evt_dsets;   // indicies (in dsets) of :evt Datasets
+  vector<int> free;       // MINUIT ids derivatives are wanted for (this call)
+  vector<double> grad;    // summed derivatives (packed, grad[k] for free[k])
+  int num_threads;         // max number of threads to use
+  vector<FcnSumTask> tasks;        // evt Dataset tasks (this call)
+  vector<vector<int> > node_tasks; // [node] indicies (in tasks) on each node
+  vector<int> node_next;   // [node] next entry in node_tasks to calculate
+  pthread_mutex_t lock;    // protects node_next and the pool_ members
+  // worker threads (created as needed, kept until FcnSum is freed)
+  vector<pthread_t> pool;
+  vector<FcnSumThread*> pool_threads; // [w] passed to pool[w]
+  pid_t pool_pid;          // process which created pool (threads don't fork)
+  pthread_cond_t work_cond; // signalled when a call starts (or pool_stop)
+  pthread_cond_t done_cond; // signalled when the last worker is done
+  int pool_call;           // incremented each call the workers are used
+  int pool_active;         // workers (tid's 1...pool_active) used this call
+  int pool_running;        // ...still calculating tasks
+  bool pool_stop;          // should the workers exit?
+  // instrumentation (summed over calls until reset_stats)
+  PhaseTimer total_timer,set_params_timer,log_l_timer,norm_timer,dcs_timer;
+  double events;           // events run over
+  double bytes;            // amps, weights and norm-ints read
+  double busy_time;        // time threads spent calculating Datasets
+  double thread_time;      // (threaded section wall time) x (threads used)
+  vector<double> node_bytes;        // [node] bytes read by tasks on each node
+  vector<double> node_remote_bytes; // ...by threads not pinned to the node
+  vector<double> node_busy;         // time threads spent on node's tasks
+  bool trace;              // record trace_events?
+  vector<TraceEvent> trace_events; // of the last call (if trace)
+};
+/// Passed to each thread running fcnsum_worker
+struct FcnSumThread {
+  FcnSum *fsum;
+  int tid;
+  int node;    // NUMA node whose tasks it does 1st (then helps w/ the rest)
+  bool pinned; // is it pinned to node?
+  int call;    // last FcnSum::pool_call it's seen (pool threads only)
+};
+//_____________________________________________________________________________
+/// Initializes the (empty) worker pool of @a fsum
+void fcnsum_init_pool(FcnSum *__fsum){
+  pthread_mutex_init(&(__fsum->lock),0);
+  pthread_cond_init(&(__fsum->work_cond),0);
+  pthread_cond_init(&(__fsum->done_cond),0);
+  __fsum->pool.clear();
+  for(int w = 0; w < (int)__fsum->pool_threads.size(); w++) 
+    delete __fsum->pool_threads[w];
+  __fsum->pool_threads.clear();
+  __fsum->pool_pid = getpid();
+  __fsum->pool_call = __fsum->pool_active = __fsum->pool_running = 0;
+  __fsum->pool_stop = false;
+}
+/// Tell Ruby to use this function when garbage collecting FcnSum
+void fcnsum_free(void *__ptr){
+  FcnSum *fsum = (FcnSum*)__ptr;
+  if(fsum->pool_pid == getpid()){ // (a forked copy has no threads to stop)
+    pthread_mutex_lock(&(fsum->lock));
+    fsum->pool_stop = true;
+    pthread_cond_broadcast(&(fsum->work_cond));
+    pthread_mutex_unlock(&(fsum->lock));
+    for(int w = 0; w < (int)fsum->pool.size(); w++) 
+      pthread_join(fsum->pool[w],0);
+  }
+  for(int w = 0; w < (int)fsum->pool_threads.size(); w++) 
+    delete fsum->pool_threads[w];
+  pthread_cond_destroy(&(fsum->work_cond));
+  pthread_cond_destroy(&(fsum->done_cond));
+  pthread_mutex_destroy(&(fsum->lock));
+  delete fsum;
+}
+/// Tell Ruby to use this function when marking FcnSum
+void fcnsum_mark(void *__ptr){
+  FcnSum *fsum = (FcnSum*)__ptr;
+  for(int d = 0; d < (int)fsum->dsets.size(); d++){
+    rb_gc_mark(fsum->dsets[d].dataset);
+    rb_gc_mark(fsum->dsets[d].wts_ary);
+    rb_gc_mark(fsum->dsets[d].rb_derivs);
+  }
+}
+//_____________________________________________________________________________
+/// Calculates -log(L) (and the norm-int) for @a task (no Ruby calls). The
+/// derivatives of both are added to the task's packed gradient.
+void fcnsum_calc_task(FcnSum *__fsum,FcnSumTask &__task){
+  FcnSumDataset &dset = __fsum->dsets[__task.dset];
+  double *grad = __task.grad.empty() ? 0 : &__task.grad[0];
+  __task.calc_timer.start();
+  __task.log_l = evt_log_liklihood(*dset.amp_vals,*dset.params,*dset.dparams,
+				   dset.wts,__fsum->free,grad,__task.first,
+				   __task.last);
+  __task.calc_timer.stop();
+  if(__task.norm){
+    __task.norm_timer.start();
+    __task.norm_val = evt_norm(*dset.norm_vals,*dset.params,*dset.dparams,
+			       __fsum->free,grad);
+    __task.norm_timer.stop();
+  }
+}
+/// Returns the next task to calculate (-1 if there are none left), taking
+/// those on @a node 1st.
+int fcnsum_next_task(FcnSum *__fsum,int __node){
+  int task = -1;
+  int num_nodes = (int)__fsum->node_tasks.size();
+  pthread_mutex_lock(&(__fsum->lock));
+  for(int i = 0; i < num_nodes && task < 0; i++){
+    int n = (__node + i) % num_nodes;
+    if(__fsum->node_next[n] < (int)__fsum->node_tasks[n].size())
+      task = __fsum->node_tasks[n][__fsum->node_next[n]++];
+  }
+  pthread_mutex_unlock(&(__fsum->lock));
+  return task;
+}
+/// Calculates evt Dataset tasks until there are none left
+void fcnsum_run_tasks(FcnSumThread *__worker){
+  FcnSum *fsum = __worker->fsum;
+  int t;
+  while((t = fcnsum_next_task(fsum,__worker->node)) >= 0){
+    FcnSumTask &task = fsum->tasks[t];
+    task.tid = __worker->tid;
+    task.remote = !(__worker->pinned && __worker->node == task.node);
+    fcnsum_calc_task(fsum,task);
+  }
+}
+/// Run by each pool thread: waits for a call which uses it, runs tasks, then
+/// waits for the next one (until pool_stop)
+void* fcnsum_worker(void *__ptr){
+  FcnSumThread *thread = (FcnSumThread*)__ptr;
+  FcnSum *fsum = thread->fsum;
+  if(thread->pinned) 
+    thread->pinned = pin_thread(numa_topology().node_cpus[thread->node]);
+  pthread_mutex_lock(&(fsum->lock));
+  while(true){
+    while(!fsum->pool_stop && fsum->pool_call == thread->call)
+      pthread_cond_wait(&(fsum->work_cond),&(fsum->lock));
+    if(fsum->pool_stop) break;
+    thread->call = fsum->pool_call;
+    if(thread->tid > fsum->pool_active) continue; // not needed this call
+    pthread_mutex_unlock(&(fsum->lock));
+    fcnsum_run_tasks(thread);
+    pthread_mutex_lock(&(fsum->lock));
+    if(--fsum->pool_running == 0) pthread_cond_signal(&(fsum->done_cond));
+  }
+  pthread_mutex_unlock(&(fsum->lock));
+  return 0;
+}
+/// Returns the number of pool workers available (up to @a num_workers), 
+/// starting more if there are too few (w/ all signals blocked, Ruby handles
+/// those). Each is spread over the NUMA nodes and pinned to its node so it 
+/// sweeps through local memory (but not if there's only 1 node).
+int fcnsum_grow_pool(FcnSum *__fsum,int __num_workers){
+  if(__fsum->pool_pid != getpid()) fcnsum_init_pool(__fsum); // forked
+  int num_nodes = numa_topology().num_nodes();
+  if((int)__fsum->pool.size() < __num_workers){
+    sigset_t all_sigs,old_sigs;
+    sigfillset(&all_sigs);
+    pthread_sigmask(SIG_SETMASK,&all_sigs,&old_sigs);
+    for(int w = (int)__fsum->pool.size(); w < __num_workers; w++){
+      FcnSumThread *thread = new FcnSumThread();
+      thread->fsum = __fsum;
+      thread->tid = w + 1;
+      thread->node = w % num_nodes;
+      thread->pinned = (num_nodes > 1);
+      thread->call = __fsum->pool_call; // (it may start after the next one)
+      pthread_t worker;
+      if(pthread_create(&worker,0,fcnsum_worker,thread) != 0){
+	delete thread;
+	break;
+      }
+      __fsum->pool.push_back(worker);
+      __fsum->pool_threads.push_back(thread);
+    }
+    pthread_sigmask(SIG_SETMASK,&old_sigs,0);
+  }
+  return min(__num_workers,(int)__fsum->pool.size());
+}
+/// Arguments passed (via rb_protect) to fcnsum_calc_dcs
+struct FcnSumDcsArgs {
+  FcnSum *fsum;
+  VALUE flag;
+  VALUE pars;
+};
+/// Calculates all dcs Datasets (these need to call Ruby for each point)
+VALUE fcnsum_calc_dcs(VALUE __args){
+  static ID fcn_val_id = rb_intern("fcn_val");
+  FcnSumDcsArgs *args = (FcnSumDcsArgs*)__args;
+  FcnSum *fsum = args->fsum;
+  int num_pars = RARRAY(args->pars)->len; // length of MINUIT parameter array
+  int num_free = (int)fsum->free.size();
+  for(int d = 0; d < (int)fsum->dsets.size(); d++){
+    FcnSumDataset &dset = fsum->dsets[d];
+    if(dset.evt) continue;
+    VALUE rb_derivs = dset.rb_derivs; // (nil entries are skipped)
+    for(int p = 0; p < num_pars; p++) rb_ary_store(rb_derivs,p,Qnil);
+    for(int k = 0; k < num_free; k++) 
+      rb_ary_store(rb_derivs,fsum->free[k],INT2FIX(0));
+    dset.tid = 0;
+    dset.calc_timer.clear();
+    dset.calc_timer.start();
+    dset.fcn_val = NUM2DBL(rb_funcall(dset.dataset,fcn_val_id,3,args->flag,
+				      args->pars,rb_derivs));
+    dset.calc_timer.stop();
+    dset.grad.assign(num_free,0.);
+    for(int k = 0; k < num_free; k++){
+      VALUE deriv = rb_ary_entry(rb_derivs,fsum->free[k]);
+      if(deriv != Qnil) dset.grad[k] = NUM2DBL(deriv);
+    }
+  }
+  return Qnil;
+}
+//_____________________________________________________________________________
+/* call-seq: new(datasets) -> FcnSum
+ *
+ * Creates a new FcnSum over Array of PWA::Dataset's _datasets_.
+ */
+VALUE rb_fcnsum_new(VALUE __class,VALUE __datasets){
+  static VALUE evt_sym = ID2SYM(rb_intern("evt"));
+  FcnSum *fsum = new FcnSum();
+  fcnsum_init_pool(fsum);
+  fsum->num_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if(getenv("PWA_NUM_THREADS") != 0) 
+    fsum->num_threads = atoi(getenv("PWA_NUM_THREADS"));
+  if(fsum->num_threads < 1) fsum->num_threads = 1;
+  fsum->events = fsum->bytes = 0.;
+  fsum->busy_time = fsum->thread_time = 0.;
+  fsum->trace = false;
+  int num_dsets = RARRAY(__datasets)->len;
+  fsum->dsets.resize(num_dsets);
+  for(int d = 0; d < num_dsets; d++){
+    FcnSumDataset &dset = fsum->dsets[d];
+    dset.dataset = rb_ary_entry(__datasets,d);
+    dset.evt = (rb_iv_get(dset.dataset,"@type") == evt_sym);
+    dset.wts_ary = Qnil;
+    dset.rb_derivs = dset.evt ? Qnil : rb_ary_new();
+    dset.amp_vals = 0;
+    dset.norm_vals = 0;
+    dset.params = 0;
+    dset.dparams = 0;
+    dset.use_norm = true;
+    dset.fcn_val = 0.;
+    dset.tid = 0;
+    if(dset.evt) fsum->evt_dsets.push_back(d);
+  }
+  return Data_Wrap_Struct(__class,fcnsum_mark,fcnsum_free,fsum);
+}
+//_____________________________________________________________________________
+/* call-seq: fcn(flag,pars,derivs) -> fcn_val
+ *
+ * Returns the sum of <tt>fcn_val</tt> over all Datasets given MINUIT 
+ * parameters _pars_. If _flag_ is 2, the summed derivatives are added to 
+ * (non-<tt>nil</tt> entries of) _derivs_. Event-based Datasets are calculated
+ * on up to _num_threads_ threads (split into chunks of events, each handled by
+ * a thread pinned to the NUMA node its amps are on), while the differential 
+ * cross section Datasets are calculated by the calling thread.
+ */
+VALUE rb_fcnsum_fcn(VALUE __self,VALUE __flag,VALUE __pars,VALUE __derivs){
+  static ID set_params_id = rb_intern("_set_params");
+  static ID include_norm_id = rb_intern("include_norm?");
+  static ID name_id = rb_intern("name");
+  FcnSum *fsum;
+  Data_Get_Struct(__self,FcnSum,fsum);
+  bool do_derivs = NUM2INT(__flag) == 2 ? true : false;
+  VALUE set_derivs = do_derivs ? __derivs : Qfalse; // (only MINUIT's ones)
+  int num_pars = RARRAY(__pars)->len; // length of MINUIT parameter array
+  int num_dsets = (int)fsum->dsets.size();
+  // only the parameters MINUIT wants (+ the amps use) are differentiated
+  fsum->free.clear();
+  for(int p = 0; p < num_pars && do_derivs; p++){
+    if(rb_ary_entry(__derivs,p) != Qnil && rb_ary_entry(__pars,p) != Qnil)
+      fsum->free.push_back(p);
+  }
+  int num_free = (int)fsum->free.size();
+  fsum->grad.assign(num_free,0.);
+  fsum->total_timer.start();
+  if(fsum->trace) fsum->trace_events.clear();
+  const NumaTopology &topo = numa_topology();
+  int num_nodes = topo.num_nodes();
+  fsum->tasks.clear();
+  fsum->node_tasks.assign(num_nodes,vector<int>());
+  fsum->node_next.assign(num_nodes,0);
+  if((int)fsum->node_bytes.size() < num_nodes){
+    fsum->node_bytes.resize(num_nodes,0.);
+    fsum->node_remote_bytes.resize(num_nodes,0.);
+    fsum->node_busy.resize(num_nodes,0.);
+  }
+  //
+  // set up the evt Datasets (all Ruby calls must be made from this thread)
+  //
+  fsum->set_params_timer.start();
+  for(int t = 0; t < (int)fsum->evt_dsets.size(); t++){
+    FcnSumDataset &dset = fsum->dsets[fsum->evt_dsets[t]];
+    rb_funcall(dset.dataset,set_params_id,3,__pars,Qnil,set_derivs);
+    dset.amp_vals 
+      = get_cpp_ptr(rb_iv_get(dset.dataset,"@amp_vals"),__AmpStore__);
+    dset.norm_vals 
+      = get_cpp_ptr(rb_iv_get(dset.dataset,"@norm_vals"),__VectorFlt3D__);
+    dset.params 
+      = get_cpp_ptr(rb_iv_get(dset.dataset,"@params"),__VectorDbl2D__);
+    dset.dparams 
+      = get_cpp_ptr(rb_iv_get(dset.dataset,"@dparams"),__VectorDbl3D__);
+    VALUE wts_ary = rb_iv_get(dset.dataset,"@wts");
+    int num_events = dset.amp_vals->num_events;
+    if(wts_ary != dset.wts_ary || (int)dset.wts.size() != num_events){
+      dset.wts.resize(num_events);
+      for(int ev = 0; ev < num_events; ev++) 
+	dset.wts[ev] = NUM2DBL(rb_ary_entry(wts_ary,ev));
+      dset.wts_ary = wts_ary;
+    }
+    dset.use_norm = RTEST(rb_funcall(dset.dataset,include_norm_id,0));
+    dset.fcn_val = 0.;
+    dset.grad.assign(num_free,0.);
+    // what the kernels will read
+    int num_amps = 0,num_norms = 0;
+    for(int ic = 0; ic < (int)dset.params->size(); ic++){
+      int n = (int)(*dset.params)[ic].size();
+      num_amps += n;
+      num_norms += n*n;
+    }
+    fsum->events += num_events;
+    fsum->bytes += num_events*(num_amps*sizeof(complex<float>) 
+			       + sizeof(double));
+    if(dset.use_norm) fsum->bytes += num_norms*sizeof(complex<float>);
+    //
+    // split its events into tasks, each w/ amps on only 1 NUMA node (the
+    // Dataset may have been read in w/ a different topology, so wrap around)
+    //
+    const vector<int> &node_first = dset.amp_vals->node_first;
+    int first_task = (int)fsum->tasks.size();
+    for(int n = 0; n < dset.amp_vals->num_nodes(); n++){
+      for(int first = node_first[n]; first < node_first[n + 1]; 
+	  first += FCN_TASK_EVENTS){
+	FcnSumTask task;
+	task.dset = fsum->evt_dsets[t];
+	task.node = n % num_nodes;
+	task.first = first;
+	task.last = min(first + FCN_TASK_EVENTS,node_first[n + 1]);
+	fsum->tasks.push_back(task);
+      }
+    }
+    if((int)fsum->tasks.size() == first_task){ // no events (still need norm)
+      FcnSumTask task;
+      task.dset = fsum->evt_dsets[t];
+      task.node = 0;
+      task.first = task.last = 0;
+      fsum->tasks.push_back(task);
+    }
+    for(int k = first_task; k < (int)fsum->tasks.size(); k++){
+      FcnSumTask &task = fsum->tasks[k];
+      task.norm = (k == first_task && dset.use_norm);
+      task.bytes = (task.last - task.first)*(num_amps*sizeof(complex<float>) 
+					     + sizeof(double));
+      if(task.norm) task.bytes += num_norms*sizeof(complex<float>);
+      task.log_l = task.norm_val = 0.;
+      task.grad.assign(num_free,0.);
+      task.tid = 0;
+      task.remote = true;
+      fsum->node_tasks[task.node].push_back(k);
+    }
+  }
+  double set_params_time = fsum->set_params_timer.stop();
+  if(fsum->trace){
+    fsum->trace_events.push_back(TraceEvent("set-params",0,
+					    fsum->set_params_timer.wall_start,
+					    set_params_time));
+  }
+  //
+  // wake up the pool workers needed (started on the 1st call that needs 
+  // them, they then wait for the next call rather than exiting)
+  //
+  double threads_start = wall_time();
+  int num_tasks = (int)fsum->tasks.size();
+  int num_workers = 0;
+  if(num_tasks > 1) num_workers = min(fsum->num_threads,num_tasks) - 1;
+  num_workers = fcnsum_grow_pool(fsum,num_workers);
+  // this thread (Ruby's) isn't pinned, it takes whatever node is left
+  FcnSumThread self_thread = {fsum,0,num_workers % num_nodes,false,0};
+  if(num_workers > 0){
+    pthread_mutex_lock(&(fsum->lock));
+    fsum->pool_active = fsum->pool_running = num_workers;
+    fsum->pool_call++;
+    pthread_cond_broadcast(&(fsum->work_cond));
+    pthread_mutex_unlock(&(fsum->lock));
+  }
+  //
+  // do the dcs Datasets here while the workers run (if Ruby raises, the 
+  // workers must still finish before passing it on)
+  //
+  FcnSumDcsArgs dcs_args = {fsum,__flag,__pars};
+  int state = 0;
+  rb_protect(fcnsum_calc_dcs,(VALUE)&dcs_args,&state);
+  if(state == 0) fcnsum_run_tasks(&self_thread); // then help w/ tasks left
+  if(num_workers > 0){
+    pthread_mutex_lock(&(fsum->lock));
+    while(fsum->pool_running > 0) 
+      pthread_cond_wait(&(fsum->done_cond),&(fsum->lock));
+    pthread_mutex_unlock(&(fsum->lock));
+  }
+  if(state != 0) rb_jump_tag(state);
+  fsum->thread_time += (wall_time() - threads_start)*(num_workers + 1);
+  //
+  // sum them up (always in the same order, so the result doesn't depend on 
+  // which threads did what)
+  //
+  vector<string> names(num_dsets);
+  if(fsum->trace){
+    for(int d = 0; d < num_dsets; d++) 
+      names[d] = STR2CSTR(rb_funcall(fsum->dsets[d].dataset,name_id,0));
+  }
+  for(int k = 0; k < num_tasks; k++){
+    const FcnSumTask &task = fsum->tasks[k];
+    FcnSumDataset &dset = fsum->dsets[task.dset];
+    dset.fcn_val += 2*(task.log_l + task.norm_val);
+    for(int i = 0; i < num_free; i++) dset.grad[i] += task.grad[i];
+    double busy = task.calc_timer.wall + task.norm_timer.wall;
+    fsum->busy_time += busy;
+    fsum->log_l_timer.add(task.calc_timer);
+    fsum->norm_timer.add(task.norm_timer);
+    fsum->node_bytes[task.node] += task.bytes;
+    if(task.remote) fsum->node_remote_bytes[task.node] += task.bytes;
+    fsum->node_busy[task.node] += busy;
+    if(fsum->trace){
+      const string &name = names[task.dset];
+      fsum->trace_events.push_back(TraceEvent("log-liklihood(" + name + ")",
+					      task.tid,
+					      task.calc_timer.wall_start,
+					      task.calc_timer.wall));
+      if(task.norm){
+	fsum->trace_events.push_back(TraceEvent("norm-int(" + name + ")",
+						task.tid,
+						task.norm_timer.wall_start,
+						task.norm_timer.wall));
+      }
+    }
+  }
+  double fcn_val = 0.;
+  for(int d = 0; d < num_dsets; d++){
+    FcnSumDataset &dset = fsum->dsets[d];
+    if(!dset.evt){
+      fsum->busy_time += dset.calc_timer.wall;
+      fsum->dcs_timer.add(dset.calc_timer);
+      if(fsum->trace){
+	fsum->trace_events.push_back(TraceEvent("dcs(" + names[d] + ")",
+						dset.tid,
+						dset.calc_timer.wall_start,
+						dset.calc_timer.wall));
+      }
+    }
+    fcn_val += dset.fcn_val;
+    double scale = dset.evt ? 2. : 1.;
+    for(int k = 0; k < num_free; k++) fsum->grad[k] += scale*dset.grad[k];
+  }
+  for(int k = 0; k < num_free; k++){
+    int p = fsum->free[k];
+    VALUE deriv = rb_ary_entry(__derivs,p);
+    rb_ary_store(__derivs,p,rb_float_new(NUM2DBL(deriv) + fsum->grad[k]));
+  }
+  double total_time = fsum->total_timer.stop();
+  if(fsum->trace){
+    fsum->trace_events.push_back(TraceEvent("fcn-sum",0,
+					    fsum->total_timer.wall_start,
+					    total_time));
+  }
+  return rb_float_new(fcn_val);
+}
+//_____________________________________________________________________________
+/// Returns <tt>[calls,wall,cpu]</tt> for @a timer
+VALUE fcnsum_timer_to_ary(const PhaseTimer &__timer){
+  VALUE ary = rb_ary_new2(3);
+  rb_ary_store(ary,0,INT2NUM(__timer.calls));
+  rb_ary_store(ary,1,rb_float_new(__timer.wall));
+  rb_ary_store(ary,2,rb_float_new(__timer.cpu));
+  return ary;
+}
+/* call-seq: phase_times -> Hash
+ *
+ * Returns <tt>[calls,wall,cpu]</tt> (times in seconds) for each phase of 
+ * _fcn_ (<tt>'fcn-sum'</tt> is the total) since the last _reset_stats_. The
+ * wall times of Datasets calculated in parallel add up, so they can be more 
+ * than the total.
+ */
+VALUE rb_fcnsum_phase_times(VALUE __self){
+  FcnSum *fsum;
+  Data_Get_Struct(__self,FcnSum,fsum);
+  VALUE times = rb_hash_new();
+  rb_hash_aset(times,rb_str_new2("fcn-sum"),
+	       fcnsum_timer_to_ary(fsum->total_timer));
+  rb_hash_aset(times,rb_str_new2("set-params"),
+	       fcnsum_timer_to_ary(fsum->set_params_timer));
+  rb_hash_aset(times,rb_str_new2("log-liklihood"),
+	       fcnsum_timer_to_ary(fsum->log_l_timer));
+  rb_hash_aset(times,rb_str_new2("norm-int"),
+	       fcnsum_timer_to_ary(fsum->norm_timer));
+  rb_hash_aset(times,rb_str_new2("dcs"),fcnsum_timer_to_ary(fsum->dcs_timer));
+  return times;
+}
+/* call-seq: counters -> Hash
+ *
+ * Returns the number of <tt>'events'</tt> run over, <tt>'bytes'</tt> of 
+ * amps, weights and norm-ints read and the <tt>'thread-utilization'</tt> 
+ * (fraction of the time the threads were busy) since the last _reset_stats_.
+ * For each NUMA node _n_ (see FcnSum.numa_nodes), <tt>'node<i>n</i>-bytes'</tt>
+ * is how much of that was read from it, <tt>'node<i>n</i>-remote-bytes'</tt>
+ * how much of that was read by threads not pinned to it (so maybe across the
+ * interconnect) and <tt>'node<i>n</i>-busy'</tt> the time (in seconds) threads
+ * spent reading it.
+ */
+VALUE rb_fcnsum_counters(VALUE __self){
+  FcnSum *fsum;
+  Data_Get_Struct(__self,FcnSum,fsum);
+  VALUE counters = rb_hash_new();
+  rb_hash_aset(counters,rb_str_new2("events"),rb_float_new(fsum->events));
+  rb_hash_aset(counters,rb_str_new2("bytes"),rb_float_new(fsum->bytes));
+  double util = 0.;
+  if(fsum->thread_time > 0) util = fsum->busy_time/fsum->thread_time;
+  rb_hash_aset(counters,rb_str_new2("thread-utilization"),rb_float_new(util));
+  for(int n = 0; n < (int)fsum->node_bytes.size(); n++){
+    char name[64];
+    sprintf(name,"node%d-bytes",n);
+    rb_hash_aset(counters,rb_str_new2(name),rb_float_new(fsum->node_bytes[n]));
+    sprintf(name,"node%d-remote-bytes",n);
+    rb_hash_aset(counters,rb_str_new2(name),
+		 rb_float_new(fsum->node_remote_bytes[n]));
+    sprintf(name,"node%d-busy",n);
+    rb_hash_aset(counters,rb_str_new2(name),rb_float_new(fsum->node_busy[n]));
+  }
+  return counters;
+}
+/* call-seq: reset_stats -> self
+ *
+ * Sets all timers and counters back to 0.
+ */
+VALUE rb_fcnsum_reset_stats(VALUE __self){
+  FcnSum *fsum;
+  Data_Get_Struct(__self,FcnSum,fsum);
+  fsum->total_timer.clear();
+  fsum->set_params_timer.clear();
+  fsum->log_l_timer.clear();
+  fsum->norm_timer.clear();
+  fsum->dcs_timer.clear();
+  fsum->events = fsum->bytes = 0.;
+  fsum->busy_time = fsum->thread_time = 0.;
+  fsum->node_bytes.assign(fsum->node_bytes.size(),0.);
+  fsum->node_remote_bytes.assign(fsum->node_remote_bytes.size(),0.);
+  fsum->node_busy.assign(fsum->node_busy.size(),0.);
+  return __self;
+}
+//_____________________________________________________________________________
+/* call-seq: trace = true/false
+ *
+ * Record trace events during each _fcn_ call?
+ */
+VALUE rb_fcnsum_set_trace(VALUE __self,VALUE __trace){
+  FcnSum *fsum;
+  Data_Get_Struct(__self,FcnSum,fsum);
+  fsum->trace = RTEST(__trace);
+  if(!fsum->trace) fsum->trace_events.clear();
+  return __trace;
+}
+/* call-seq: trace_events -> Array
+ *
+ * Returns the trace events recorded during the last _fcn_ call (if _trace_ 
+ * is set) as <tt>[name,thread,start,duration]</tt> (times in seconds, the 
+ * start is since the epoch).
+ */
+VALUE rb_fcnsum_trace_events(VALUE __self){
+  FcnSum *fsum;
+  Data_Get_Struct(__self,FcnSum,fsum);
+  int num_events = (int)fsum->trace_events.size();
+  VALUE events = rb_ary_new2(num_events);
+  for(int e = 0; e < num_events; e++){
+    const TraceEvent &event = fsum->trace_events[e];
+    VALUE ary = rb_ary_new2(4);
+    rb_ary_store(ary,0,rb_str_new2(event.name.c_str()));
+    rb_ary_store(ary,1,INT2NUM(event.tid));
+    rb_ary_store(ary,2,rb_float_new(event.ts));
+    rb_ary_store(ary,3,rb_float_new(event.dur));
+    rb_ary_store(events,e,ary);
+  }
+  return events;
+}
+//_____________________________________________________________________________
+/* call-seq: num_threads -> Fixnum
+ *
+ * Maximum number of threads used to calculate event-based Datasets.
+ */
+VALUE rb_fcnsum_num_threads(VALUE __self){
+  FcnSum *fsum;
+  Data_Get_Struct(__self,FcnSum,fsum);
+  return INT2NUM(fsum->num_threads);
+}
+/* call-seq: num_threads = n
+ *
+ * Set the maximum number of threads used to calculate event-based Datasets.
+ */
+VALUE rb_fcnsum_set_num_threads(VALUE __self,VALUE __n){
+  FcnSum *fsum;
+  Data_Get_Struct(__self,FcnSum,fsum);
+  fsum->num_threads = NUM2INT(__n) < 1 ? 1 : NUM2INT(__n);
+  return __n;
+}
+//_____________________________________________________________________________
+/* call-seq: FcnSum.numa_nodes -> Array
+ *
+ * Returns the CPUs on each NUMA node that amps are spread over and threads
+ * are pinned to. These come from sysfs, unless overridden by setting 
+ * <tt>PWA_NUMA_NODES</tt> (before any amps are read in) to a number of 
+ * (fake) nodes or to a cpulist for each node separated by <tt>':'</tt> (eg 
+ * <tt>'0-3:4-7'</tt>).
+ */
+VALUE rb_fcnsum_numa_nodes(VALUE __class){
+  const NumaTopology &topo = numa_topology();
+  VALUE nodes = rb_ary_new2(topo.num_nodes());
+  for(int n = 0; n < topo.num_nodes(); n++){
+    VALUE cpus = rb_ary_new2(topo.node_cpus[n].size());
+    for(int c = 0; c < (int)topo.node_cpus[n].size(); c++)
+      rb_ary_store(cpus,c,INT2NUM(topo.node_cpus[n][c]));
+    rb_ary_store(nodes,n,cpus);
+  }
+  return nodes;
+}
+//_____________________________________________________________________________
+
+extern "C" void Init_fcn_sum(){
+  //-+-RDOC-+- 
+  rb_cPWA = rb_define_module("PWA");
+  rb_cFcnSum = rb_define_class_under(rb_cPWA,"FcnSum",rb_cObject);
+  rb_define_singleton_method(rb_cFcnSum,"new",RUBY_FUNC(rb_fcnsum_new),1);
+  rb_define_singleton_method(rb_cFcnSum,"numa_nodes",
+			     RUBY_FUNC(rb_fcnsum_numa_nodes),0);
+  rb_define_method(rb_cFcnSum,"fcn",RUBY_FUNC(rb_fcnsum_fcn),3);
+  rb_define_method(rb_cFcnSum,"num_threads",RUBY_FUNC(rb_fcnsum_num_threads),
+		   0);
+  rb_define_method(rb_cFcnSum,"num_threads=",
+		   RUBY_FUNC(rb_fcnsum_set_num_threads),1);
+  rb_define_method(rb_cFcnSum,"phase_times",RUBY_FUNC(rb_fcnsum_phase_times),
+		   0);
+  rb_define_method(rb_cFcnSum,"counters",RUBY_FUNC(rb_fcnsum_counters),0);
+  rb_define_method(rb_cFcnSum,"reset_stats",RUBY_FUNC(rb_fcnsum_reset_stats),
+		   0);
+  rb_define_method(rb_cFcnSum,"trace=",RUBY_FUNC(rb_fcnsum_set_trace),1);
+  rb_define_method(rb_cFcnSum,"trace_events",
+		   RUBY_FUNC(rb_fcnsum_trace_events),0);
+}
+//_____________________________________________________________________________
@@ -6,8 +6,8 @@
 //_____________________________________________________________________________
 #include "ruby-complex.h"
 #include "pwa-src.h"
-#include "cppvector.cpp"
-#include <fstream>
+#include "normint.h"
+#include <cstdio>
 
 VALUE rb_cNormInt;
 //_____________________________________________________________________________
@@ -24,60 +24,24 @@ VALUE calc_coherent_sums(VALUE __self, VALUE __num_files, VALUE __cuts_on,
   int cuts_on = NUM2INT(__cuts_on);
   int num_amps = NUM2INT(__num_files);
   int num_evts = NUM2INT(__num_evts);
-  double cut_check;
   int good_events = 0;
-  ifstream in_file[num_amps];
-  char *amp_names[num_amps];
-
-  // array to hold the sums
-  complex<float> cross_terms[num_amps][num_amps];
-  // Naming and opening files...
-  for(int iter = 0;iter<num_amps;iter++){
-    amp_names[iter] = STR2CSTR(rb_ary_entry(rb_iv_get(__self,
-						      "@coh_amps"),iter));
-    in_file[iter].open(amp_names[iter]);
-  }
-  bool take_event;
-  complex<float> amp[num_amps];
-  int event = 0;
-  int read_tag = 0;
-  while(event<num_evts && read_tag<1){
-    for(int j = 1;j<num_amps;j++){
-      if(in_file[j].eof())  read_tag++;
-    }
-    if(cuts_on){
-      cut_check = NUM2DBL(rb_ary_entry(__cuts_ary,event));
-      if(cut_check >= 0.0){
-	take_event = true;
-      }
-      else take_event = false;
-    }
-    else if(!cuts_on){
-      take_event = true;
-    }
-    // read the amp vals...
-    for(int amp_num = 0;amp_num<num_amps;amp_num++){
-      in_file[amp_num].read((char*)&amp[amp_num],sizeof(amp[amp_num]));
-    }
-
-    if(take_event){
-      good_events++;
-      for(int row = 0;row<num_amps;row++){
-	for(int col = row;col<num_amps;col++){
-	  cross_terms[row][col] = cross_terms[row][col]
-	    + amp[row] * conj(amp[col]);
-	}
-      }
-    }
-    event++;
+  // Naming the files...
+  VALUE coh_amps = rb_iv_get(__self,"@coh_amps");
+  vector<const char*> amp_names(num_amps);
+  for(int iter = 0;iter<num_amps;iter++)
+    amp_names[iter] = STR2CSTR(rb_ary_entry(coh_amps,iter));
+  vector<double> cuts;
+  if(cuts_on){
+    int num_cuts = RARRAY(__cuts_ary)->len;
+    cuts.resize(num_cuts);
+    for(int ev = 0;ev<num_cuts;ev++) 
+      cuts[ev] = NUM2DBL(rb_ary_entry(__cuts_ary,ev));
   }
+  // the sums are done by the (Ruby free) core
+  VectorFlt2D cross_terms;
+  int event = norm_int_sums(amp_names,cuts_on ? &cuts : 0,num_evts,
+			    cross_terms,good_events);
   cout << "Events used: " << good_events << "\n";
-  // impose symmetry...
-  for(int row = 0;row<num_amps;row++){
-    for(int col = 0;col<=row;col++){
-      cross_terms[row][col] = conj(cross_terms[col][row]);
-    }
-  }
   // assign values to VectorFlt2D...
   for(int i = 0;i<num_amps;i++){
     for(int j = 0;j<num_amps;j++){
@@ -87,30 +51,56 @@ VALUE calc_coherent_sums(VALUE __self, VALUE __num_files, VALUE __cuts_on,
   return rb_int_new(event);
 }
 
-
 //
 // function to count the number of events for which amplitudes were generated.
 //
 //
 VALUE count_amps(VALUE __self, VALUE __file_name){
-  char *filename = STR2CSTR(__file_name);
-  ifstream in_file;
-  in_file.open(filename);
-  int event = 0;
-  complex<float> amp;
+  return rb_int_new(amps_file_events(STR2CSTR(__file_name)));
+}
 
-  while(!in_file.eof()){
-    event++;
-    in_file.read((char*)&amp,sizeof(amp));
+//_____________________________________________________________________________
+/* call-seq: write_norm_int_bin(xml_file,sets) -> String
+ *
+ * Writes the binary sidecar for norm-int _xml_file_ (which must already be
+ * written + closed) and returns its name. Each entry of _sets_ is an 
+ * incoherent waveset: <tt>[coherence,files,sums,factor]</tt> where _sums_ 
+ * is the CppVectorFlt2D of coherent sums (scaled by _factor_) for amps 
+ * _files_.
+ */
+VALUE rb_write_norm_int_bin(VALUE __self,VALUE __xml_file,VALUE __sets){
+  char bin_file[1024];
+  bool ok;
+  { // (rb_raise doesn't run destructors, so these must be gone 1st)
+    int num_sets = RARRAY(__sets)->len;
+    vector<NormIntSet> sets(num_sets);
+    for(int s = 0; s < num_sets; s++){
+      VALUE set = rb_ary_entry(__sets,s),files = rb_ary_entry(set,1);
+      VectorFlt2D *sums = get_cpp_ptr(rb_ary_entry(set,2),__VectorFlt2D__);
+      double factor = NUM2DBL(rb_ary_entry(set,3));
+      int n = RARRAY(files)->len;
+      sets[s].coherence = STR2CSTR(rb_ary_entry(set,0));
+      for(int i = 0; i < n; i++){
+	sets[s].files.push_back(STR2CSTR(rb_ary_entry(files,i)));
+	for(int j = 0; j < n; j++){
+	  complex<float> val = (*sums)[i][j];
+	  sets[s].vals.push_back(complex<double>(val.real()*factor,
+						 val.imag()*factor));
+	}
+      }
+    }
+    string name = norm_int_bin_name(STR2CSTR(__xml_file));
+    snprintf(bin_file,sizeof(bin_file),"%s",name.c_str());
+    ok = write_norm_int_bin(bin_file,sets,STR2CSTR(__xml_file));
   }
-  return rb_int_new(event-1);
+  if(!ok) rb_raise(rb_eIOError,"can't write %s",bin_file);
+  return rb_str_new2(bin_file);
 }
-
-
-
 //_____________________________________________________________________________
 extern "C" void Init_norm_int(){
   rb_define_global_function("calc_coherent_sums",
 			    RUBY_FUNC(calc_coherent_sums),4);
   rb_define_global_function("count_amps",RUBY_FUNC(count_amps),1);
+  rb_define_global_function("write_norm_int_bin",
+			    RUBY_FUNC(rb_write_norm_int_bin),2);
 }
@@ -0,0 +1,351 @@
+// Author: Mike Williams
+//_____________________________________________________________________________
+#include "normint.h"
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+#include <sys/stat.h>
+
+/// 1st 8 bytes of a binary norm-int file
+static const char NORM_INT_MAGIC[9] = "PWANORM1";
+/// Written after the magic to catch files from machines w/ other byte orders
+static const int32_t NORM_INT_ORDER = 0x01020304;
+//_____________________________________________________________________________
+/// FNV-1a hash of @a str
+static unsigned int name_hash(const string &__str){
+  unsigned int hash = 2166136261u;
+  for(size_t c = 0; c < __str.size(); c++){
+    hash ^= (unsigned char)__str[c];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+//_____________________________________________________________________________
+void NameIndex::build(const vector<string> &__names){
+  _names = __names;
+  size_t size = 8;
+  while(size < 2*_names.size()) size *= 2; // keep it at most 1/2 full
+  _slots.assign(size,-1);
+  for(int n = 0; n < (int)_names.size(); n++){
+    size_t slot = name_hash(_names[n]) & (size - 1);
+    while(_slots[slot] >= 0 && _names[_slots[slot]] != _names[n])
+      slot = (slot + 1) & (size - 1);
+    if(_slots[slot] < 0) _slots[slot] = n;
+  }
+}
+//_____________________________________________________________________________
+int NameIndex::find(const string &__name) const {
+  if(_slots.empty()) return -1;
+  size_t mask = _slots.size() - 1,slot = name_hash(__name) & mask;
+  while(_slots[slot] >= 0){
+    if(_names[_slots[slot]] == __name) return _slots[slot];
+    slot = (slot + 1) & mask;
+  }
+  return -1;
+}
+//_____________________________________________________________________________
+/// Reads all of @a file into @a text
+static bool read_file(const char *__file,string &__text){
+  FILE *file = fopen(__file,"rb");
+  if(file == 0) return false;
+  char buf[1 << 16];
+  size_t num;
+  __text.clear();
+  while((num = fread(buf,1,sizeof(buf),file)) > 0) __text.append(buf,num);
+  bool ok = !ferror(file);
+  fclose(file);
+  return ok;
+}
+//_____________________________________________________________________________
+/// Replaces the predefined XML entities in @a str
+static string xml_unescape(const string &__str){
+  if(__str.find('&') == string::npos) return __str;
+  static const char *ents[5][2] = {
+    {"&amp;","&"},{"&lt;","<"},{"&gt;",">"},{"&quot;","\""},{"&apos;","'"}
+  };
+  string str;
+  for(size_t c = 0; c < __str.size(); c++){
+    int e = 0;
+    while(__str[c] == '&' && e < 5
+	  && __str.compare(c,strlen(ents[e][0]),ents[e][0]) != 0) e++;
+    if(__str[c] != '&' || e == 5) str += __str[c];
+    else{
+      str += ents[e][1];
+      c += strlen(ents[e][0]) - 1;
+    }
+  }
+  return str;
+}
+//_____________________________________________________________________________
+/// Returns the value of attribute @a name in start tag text @a tag
+static string xml_attribute(const string &__tag,const char *__name){
+  string key = string(__name) + "=";
+  size_t pos = 0;
+  while((pos = __tag.find(key,pos)) != string::npos){
+    bool start = (pos == 0 || isspace(__tag[pos - 1]));
+    pos += key.size();
+    if(!start || pos >= __tag.size()) continue;
+    char quote = __tag[pos];
+    size_t end = __tag.find(quote,pos + 1);
+    if((quote != '"' && quote != '\'') || end == string::npos) break;
+    return xml_unescape(__tag.substr(pos + 1,end - pos - 1));
+  }
+  return "";
+}
+//_____________________________________________________________________________
+/// Parses a row of "(re,im)|(re,im)|..." starting at @a text (which ends at
+/// the next '<') onto the end of @a vals. Returns the number of entries (-1
+/// if it's not valid).
+static int parse_row(const char *__text,vector<complex<double> > &__vals){
+  const char *p = __text;
+  int num = 0;
+  while(true){
+    while(isspace(*p) || *p == '|') p++;
+    if(*p == '<' || *p == 0) return num;
+    if(*p != '(') return -1;
+    char *end;
+    double re = strtod(p + 1,&end);
+    if(end == p + 1 || *end != ',') return -1;
+    p = end + 1;
+    double im = strtod(p,&end);
+    if(end == p || *end != ')') return -1;
+    p = end + 1;
+    __vals.push_back(complex<double>(re,im));
+    num++;
+  }
+}
+//_____________________________________________________________________________
+bool read_norm_int_xml(const char *__file,vector<NormIntSet> &__sets,
+		       string &__error){
+  __sets.clear();
+  string text;
+  if(!read_file(__file,text)){
+    __error = string("can't read ") + __file;
+    return false;
+  }
+  const char *doc = text.c_str();
+  NormIntSet *set = 0;
+  int num_rows = 0;
+  size_t pos = 0;
+  while((pos = text.find('<',pos)) != string::npos){
+    // skip comments, <?xml ...?>, <!DOCTYPE ...>
+    if(text.compare(pos,4,"<!--") == 0){
+      pos = text.find("-->",pos);
+      if(pos == string::npos) break;
+      continue;
+    }
+    size_t end = text.find('>',pos);
+    if(end == string::npos) break;
+    string tag = text.substr(pos + 1,end - pos - 1);
+    pos = end + 1;
+    if(tag.empty() || tag[0] == '?' || tag[0] == '!') continue;
+    bool close = (tag[0] == '/'),empty = (tag[tag.size() - 1] == '/');
+    size_t name_end = tag.find_first_of(" \t\r\n/",close ? 1 : 0);
+    if(name_end == string::npos) name_end = tag.size();
+    string name = tag.substr(close ? 1 : 0,name_end - (close ? 1 : 0));
+    if(name == "incoherent-waveset"){
+      if(!close){
+	__sets.push_back(NormIntSet());
+	set = &__sets.back();
+	set->coherence = xml_attribute(tag,"coherence-string");
+	num_rows = 0;
+      }
+      if(close || empty){
+	if(set != 0 && num_rows != set->num_waves()){
+	  __error = "incoherent-waveset " + set->coherence + " has the wrong "
+	    + "number of rows";
+	  return false;
+	}
+	set = 0;
+      }
+    }
+    else if(name == "wave" && !close && set != 0)
+      set->files.push_back(xml_attribute(tag,"file"));
+    else if(name == "row" && !close && !empty && set != 0){
+      int num = parse_row(doc + pos,set->vals);
+      if(num != set->num_waves()){
+	__error = "bad row in incoherent-waveset " + set->coherence;
+	return false;
+      }
+      num_rows++;
+    }
+  }
+  if(set != 0){
+    __error = string("unexpected end of ") + __file;
+    return false;
+  }
+  return true;
+}
+//_____________________________________________________________________________
+/// Sets @a stamp to the size + mtime of @a file (returns false if it's not
+/// there)
+static bool file_stamp(const char *__file,int64_t __stamp[2]){
+  struct stat st;
+  if(__file == 0 || stat(__file,&st) != 0) return false;
+  __stamp[0] = (int64_t)st.st_size;
+  __stamp[1] = (int64_t)st.st_mtime;
+  return true;
+}
+//_____________________________________________________________________________
+static void write_string(FILE *__file,const string &__str){
+  int32_t len = (int32_t)__str.size();
+  fwrite(&len,sizeof(int32_t),1,__file);
+  fwrite(__str.data(),1,len,__file);
+}
+//_____________________________________________________________________________
+bool write_norm_int_bin(const char *__file,const vector<NormIntSet> &__sets,
+			const char *__xml_file){
+  int64_t stamp[2] = {-1,-1};
+  file_stamp(__xml_file,stamp);
+  FILE *file = fopen(__file,"wb");
+  if(file == 0) return false;
+  int32_t num_sets = (int32_t)__sets.size();
+  fwrite(NORM_INT_MAGIC,1,8,file);
+  fwrite(&NORM_INT_ORDER,sizeof(int32_t),1,file);
+  fwrite(stamp,sizeof(int64_t),2,file);
+  fwrite(&num_sets,sizeof(int32_t),1,file);
+  for(int s = 0; s < num_sets; s++){
+    const NormIntSet &set = __sets[s];
+    int32_t n = set.num_waves();
+    write_string(file,set.coherence);
+    fwrite(&n,sizeof(int32_t),1,file);
+    for(int w = 0; w < n; w++) write_string(file,set.files[w]);
+    for(int i = 0; i < n; i++) // (the rest is its conjugate)
+      fwrite(&set(i,i),sizeof(complex<double>),n - i,file);
+  }
+  bool ok = !ferror(file);
+  return (fclose(file) == 0) && ok;
+}
+//_____________________________________________________________________________
+/// Reads a string written by write_string from @a ptr (up to @a end)
+static bool read_string(const char *&__ptr,const char *__end,string &__str){
+  int32_t len;
+  if(__ptr + sizeof(int32_t) > __end) return false;
+  memcpy(&len,__ptr,sizeof(int32_t));
+  __ptr += sizeof(int32_t);
+  if(len < 0 || __ptr + len > __end) return false;
+  __str.assign(__ptr,len);
+  __ptr += len;
+  return true;
+}
+//_____________________________________________________________________________
+bool read_norm_int_bin(const char *__file,vector<NormIntSet> &__sets,
+		       string &__error,const char *__xml_file){
+  __sets.clear();
+  string data;
+  if(!read_file(__file,data)){
+    __error = string("can't read ") + __file;
+    return false;
+  }
+  const char *ptr = data.data(),*end = ptr + data.size();
+  int32_t order = 0,num_sets = 0;
+  int64_t stamp[2],xml_stamp[2];
+  size_t header = 8 + 2*sizeof(int32_t) + 2*sizeof(int64_t);
+  if(data.size() < header || memcmp(ptr,NORM_INT_MAGIC,8) != 0){
+    __error = string(__file) + " isn't a binary norm-int file";
+    return false;
+  }
+  memcpy(&order,ptr + 8,sizeof(int32_t));
+  memcpy(stamp,ptr + 8 + sizeof(int32_t),2*sizeof(int64_t));
+  memcpy(&num_sets,ptr + 8 + sizeof(int32_t) + 2*sizeof(int64_t),
+	 sizeof(int32_t));
+  ptr += header;
+  if(order != NORM_INT_ORDER){
+    __error = string(__file) + " was written w/ a different byte order";
+    return false;
+  }
+  if(file_stamp(__xml_file,xml_stamp)
+     && (xml_stamp[0] != stamp[0] || xml_stamp[1] != stamp[1])){
+    __error = string(__xml_file) + " has changed since " + __file
+      + " was written";
+    return false;
+  }
+  __sets.resize(max(num_sets,0));
+  for(int s = 0; s < num_sets; s++){
+    NormIntSet &set = __sets[s];
+    int32_t n = -1;
+    bool ok = read_string(ptr,end,set.coherence);
+    if(ok && ptr + sizeof(int32_t) <= end){
+      memcpy(&n,ptr,sizeof(int32_t));
+      ptr += sizeof(int32_t);
+    }
+    ok = ok && n >= 0;
+    if(ok) set.files.resize(n);
+    for(int w = 0; ok && w < n; w++) ok = read_string(ptr,end,set.files[w]);
+    size_t num_vals = (size_t)n*(n + 1)/2;
+    if(!ok || ptr + num_vals*sizeof(complex<double>) > end){
+      __error = string("unexpected end of ") + __file;
+      __sets.clear();
+      return false;
+    }
+    set.vals.resize((size_t)n*n);
+    for(int i = 0; i < n; i++){
+      memcpy(&set.vals[(size_t)i*n + i],ptr,(n - i)*sizeof(complex<double>));
+      ptr += (n - i)*sizeof(complex<double>);
+      for(int j = i + 1; j < n; j++)
+	set.vals[(size_t)j*n + i] = conj(set.vals[(size_t)i*n + j]);
+    }
+  }
+  return true;
+}
+//_____________________________________________________________________________
+string norm_int_bin_name(const string &__xml_file){
+  size_t len = __xml_file.size();
+  if(len >= 4 && __xml_file.compare(len - 4,4,".xml") == 0)
+    return __xml_file.substr(0,len - 4) + ".bin";
+  return __xml_file + ".bin";
+}
+//_____________________________________________________________________________
+bool read_norm_int(const char *__xml_file,vector<NormIntSet> &__sets,
+		   string &__error,bool &__from_bin){
+  string bin_file = norm_int_bin_name(__xml_file),bin_error;
+  struct stat st;
+  __from_bin = false;
+  if(stat(bin_file.c_str(),&st) == 0
+     && read_norm_int_bin(bin_file.c_str(),__sets,bin_error,__xml_file)){
+    __from_bin = true;
+    return true;
+  }
+  return read_norm_int_xml(__xml_file,__sets,__error);
+}
+//_____________________________________________________________________________
+bool fill_norm_vals(const vector<NormIntSet> &__sets,
+		    const vector<vector<string> > &__amp_files,
+		    VectorFlt3D &__norm_vals,string &__error){
+  int num_ic = (int)__amp_files.size();
+  for(int s = 0; s < (int)__sets.size(); s++){
+    const NormIntSet &set = __sets[s];
+    NameIndex index(set.files);
+    for(int ic = 0; ic < num_ic; ic++){
+      int num_amps = (int)__amp_files[ic].size();
+      if(ic >= (int)__norm_vals.size()
+	 || num_amps > (int)__norm_vals[ic].size()){
+	__error = "norm-int values aren't sized for the amps";
+	return false;
+      }
+      vector<int> ind(num_amps); // amp -> index in set (-1 if it's not)
+      for(int a = 0; a < num_amps; a++)
+	ind[a] = index.find(__amp_files[ic][a]);
+      for(int a1 = 0; a1 < num_amps; a1++){
+	if(ind[a1] < 0) continue;
+	vector<complex<float> > &row = __norm_vals[ic][a1];
+	for(int a2 = 0; a2 < num_amps; a2++){
+	  if(ind[a2] < 0){
+	    __error = "no norm-int entry for " + __amp_files[ic][a2];
+	    return false;
+	  }
+	  if(a2 >= (int)row.size()){
+	    __error = "norm-int values aren't sized for the amps";
+	    return false;
+	  }
+	  const complex<double> &val = set(ind[a1],ind[a2]);
+	  row[a2] = complex<float>(val.real(),val.imag());
+	}
+      }
+    }
+  }
+  return true;
+}
+//_____________________________________________________________________________
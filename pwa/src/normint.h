@@ -0,0 +1,88 @@
+// -*- C++ -*-
+// Author: Mike Williams
+//_____________________________________________________________________________
+#ifndef _normint_H
+#define _normint_H
+
+#include "pwa-core.h"
+#include <string>
+
+using namespace std;
+/*
+ * Reading + writing normalization integral files. The norm-int XML (see
+ * GenerateNormInt.rb) is scanned natively in a single pass. Next to it,
+ * GenerateNormInt.rb also writes a compact binary sidecar (same name w/ .bin
+ * instead of .xml) holding each Hermitian matrix (upper triangle, full
+ * precision) + its wave name table:
+ *
+ *   char[8]  "PWANORM1"
+ *   int32    0x01020304 (byte order check, the file is native endian)
+ *   int64    size + mtime of the XML file it was written w/
+ *   int32    number of wavesets, then for each:
+ *     string   coherence (int32 length + chars)
+ *     int32    n waves, then n strings (amps file names)
+ *     double   re,im of the n(n+1)/2 elements (i <= j), row by row
+ *
+ * The sidecar is only used if the XML is unchanged since (or gone), so
+ * rescaling/editing the XML (see RescaleNormInt.rb) can't leave it stale.
+ * GenerateNormInt.rb writes the XML elements w/ %.17g (not %g), so they 
+ * parse to exactly the doubles in the sidecar and a fit gives the same 
+ * -log(L) whichever one is read.
+ */
+//_____________________________________________________________________________
+/// 1 incoherent waveset of a norm-int file.
+struct NormIntSet {
+  string coherence;
+  vector<string> files;          // wave (amps file) names
+  vector<complex<double> > vals; // n x n, row major
+
+  int num_waves() const {return (int)files.size();}
+  const complex<double>& operator()(int __i,int __j) const {
+    return vals[__i*files.size() + __j];
+  }
+};
+//_____________________________________________________________________________
+/// Hashed name -> index lookup (open addressing, FNV-1a).
+class NameIndex {
+private:
+  vector<string> _names;
+  vector<int> _slots; // index into _names (-1 if empty), size is 2^n
+
+public:
+  NameIndex(){}
+  explicit NameIndex(const vector<string> &__names){this->build(__names);}
+
+  /// Indexes @a names (if a name is repeated, the 1st one is found)
+  void build(const vector<string> &__names);
+  /// Returns the index of @a name (-1 if it's not there)
+  int find(const string &__name) const;
+};
+//_____________________________________________________________________________
+/// Reads norm-int XML @a file into @a sets. Returns false (and sets @a error)
+/// if it can't.
+bool read_norm_int_xml(const char *__file,vector<NormIntSet> &__sets,
+		       string &__error);
+/// Reads binary norm-int @a file into @a sets. If @a xml_file is given, it
+/// must be the one the sidecar was written w/ (else false is returned).
+bool read_norm_int_bin(const char *__file,vector<NormIntSet> &__sets,
+		       string &__error,const char *__xml_file = 0);
+/// Writes @a sets to binary norm-int @a file, stamped w/ @a xml_file (if
+/// given). Returns false if it can't.
+bool write_norm_int_bin(const char *__file,const vector<NormIntSet> &__sets,
+			const char *__xml_file = 0);
+/// Returns the name of the binary sidecar for norm-int XML file @a xml_file
+string norm_int_bin_name(const string &__xml_file);
+/// Reads norm-int @a xml_file, from its sidecar if that's valid. Sets
+/// @a from_bin to whether it was.
+bool read_norm_int(const char *__xml_file,vector<NormIntSet> &__sets,
+		   string &__error,bool &__from_bin);
+/// Sets norm_vals[ic][a1][a2] for each pair of amps (files @a amp_files[ic])
+/// found in @a sets (a later waveset overwrites an earlier one). Amps which
+/// aren't in a waveset are skipped, but if a1 is, a2 must be too (else false
+/// is returned + @a error names it).
+bool fill_norm_vals(const vector<NormIntSet> &__sets,
+		    const vector<vector<string> > &__amp_files,
+		    VectorFlt3D &__norm_vals,string &__error);
+//_____________________________________________________________________________
+
+#endif /* _normint_H */
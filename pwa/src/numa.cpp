@@ -0,0 +1,194 @@
+// Author: Mike Williams
+//_____________________________________________________________________________
+#include "numa.h"
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <fstream>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <unistd.h>
+
+/// The topology in use (see numa_topology)
+static NumaTopology *topology = 0;
+//_____________________________________________________________________________
+int NumaTopology::num_cpus() const {
+  int num = 0;
+  for(int n = 0; n < num_nodes(); n++) num += (int)node_cpus[n].size();
+  return num;
+}
+//_____________________________________________________________________________
+vector<int> NumaTopology::split(int __num,int __align) const {
+  int num_nodes = this->num_nodes(),num_cpus = this->num_cpus();
+  vector<int> first(num_nodes + 1,__num);
+  first[0] = 0;
+  int cpus = 0;
+  for(int n = 1; n < num_nodes; n++){
+    cpus += (int)node_cpus[n - 1].size();
+    double num_blocks = (__num/(double)__align)*cpus/num_cpus;
+    int start = (int)(num_blocks + 0.5)*__align;
+    first[n] = max(first[n - 1],min(start,__num));
+  }
+  return first;
+}
+//_____________________________________________________________________________
+bool parse_cpu_list(const string &__list,vector<int> &__cpus){
+  __cpus.clear();
+  size_t pos = 0;
+  while(pos < __list.size()){
+    size_t end = __list.find(',',pos);
+    if(end == string::npos) end = __list.size();
+    string range = __list.substr(pos,end - pos);
+    pos = end + 1;
+    if(range.find_first_not_of(" \t\n") == string::npos) continue;
+    if(range.find_first_not_of("0123456789- \t\n") != string::npos)
+      return false;
+    int first,last;
+    char extra;
+    int num = sscanf(range.c_str(),"%d-%d %c",&first,&last,&extra);
+    if(num == 1 && range.find('-') == string::npos) last = first;
+    else if(num != 2) return false;
+    if(first < 0 || last < first) return false;
+    for(int cpu = first; cpu <= last; cpu++) __cpus.push_back(cpu);
+  }
+  return !__cpus.empty();
+}
+//_____________________________________________________________________________
+/// Reads the 1st line of @a file into @a line
+static bool read_line(const string &__file,string &__line){
+  ifstream in_file(__file.c_str());
+  return getline(in_file,__line) ? true : false;
+}
+//_____________________________________________________________________________
+NumaTopology read_numa_topology(const char *__sysfs_dir){
+  NumaTopology topo;
+  string dir = __sysfs_dir,line;
+  vector<int> nodes,cpus;
+  if(read_line(dir + "/online",line) && parse_cpu_list(line,nodes)){
+    for(int n = 0; n < (int)nodes.size(); n++){
+      char file[64];
+      sprintf(file,"/node%d/cpulist",nodes[n]);
+      if(read_line(dir + file,line) && parse_cpu_list(line,cpus))
+	topo.node_cpus.push_back(cpus);
+    }
+  }
+  if(!topo.node_cpus.empty()) topo.source = "sysfs";
+  else{
+    int num_cpus = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    topo.node_cpus.resize(1);
+    for(int cpu = 0; cpu < max(num_cpus,1); cpu++)
+      topo.node_cpus[0].push_back(cpu);
+    topo.source = "default";
+  }
+  return topo;
+}
+//_____________________________________________________________________________
+bool parse_numa_nodes(const string &__spec,NumaTopology &__topo){
+  NumaTopology topo;
+  bool count = __spec.find_first_not_of("0123456789") == string::npos;
+  if(!__spec.empty() && count){
+    int num_nodes = atoi(__spec.c_str());
+    if(num_nodes < 1) return false;
+    NumaTopology sys_topo = read_numa_topology();
+    vector<int> cpus;
+    for(int n = 0; n < sys_topo.num_nodes(); n++)
+      cpus.insert(cpus.end(),sys_topo.node_cpus[n].begin(),
+		  sys_topo.node_cpus[n].end());
+    int num_cpus = (int)cpus.size();
+    int per_node = max(num_cpus/num_nodes,1);
+    topo.node_cpus.resize(num_nodes);
+    for(int n = 0; n < num_nodes; n++){
+      int last = (n == num_nodes - 1) ? max(num_cpus,(n + 1)*per_node)
+	: (n + 1)*per_node;
+      for(int c = n*per_node; c < last; c++)
+	topo.node_cpus[n].push_back(cpus[c % num_cpus]);
+    }
+  }
+  else{
+    size_t pos = 0;
+    while(pos <= __spec.size()){
+      size_t end = __spec.find(':',pos);
+      if(end == string::npos) end = __spec.size();
+      vector<int> cpus;
+      if(!parse_cpu_list(__spec.substr(pos,end - pos),cpus)) return false;
+      topo.node_cpus.push_back(cpus);
+      pos = end + 1;
+    }
+  }
+  topo.source = "PWA_NUMA_NODES";
+  __topo = topo;
+  return true;
+}
+//_____________________________________________________________________________
+const NumaTopology& numa_topology(){
+  if(topology == 0){
+    topology = new NumaTopology();
+    const char *spec = getenv("PWA_NUMA_NODES");
+    if(spec != 0 && !parse_numa_nodes(spec,*topology)){
+      fprintf(stderr,"Warning! Ignoring invalid PWA_NUMA_NODES (%s)\n",spec);
+      spec = 0;
+    }
+    if(spec == 0) *topology = read_numa_topology();
+  }
+  return *topology;
+}
+//_____________________________________________________________________________
+void set_numa_topology(const NumaTopology &__topo){
+  if(topology == 0) topology = new NumaTopology();
+  *topology = __topo;
+}
+//_____________________________________________________________________________
+bool pin_thread(const vector<int> &__cpus){
+#ifdef __linux__
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  for(int c = 0; c < (int)__cpus.size(); c++){
+    if(__cpus[c] < CPU_SETSIZE) CPU_SET(__cpus[c],&cpu_set);
+  }
+  return pthread_setaffinity_np(pthread_self(),sizeof(cpu_set),&cpu_set) == 0;
+#else
+  return false;
+#endif
+}
+//_____________________________________________________________________________
+/// Passed to each thread running numa_node_thread
+struct NumaNodeCall {
+  void (*fcn)(int,void*);
+  void *arg;
+  int node;
+};
+/// Pins itself to its node, then makes the call
+static void* numa_node_thread(void *__ptr){
+  NumaNodeCall *call = (NumaNodeCall*)__ptr;
+  pin_thread(numa_topology().node_cpus[call->node]);
+  call->fcn(call->node,call->arg);
+  return 0;
+}
+//_____________________________________________________________________________
+void numa_for_each_node(void (*__fcn)(int,void*),void *__arg){
+  int num_nodes = numa_topology().num_nodes();
+  if(num_nodes == 1){
+    __fcn(0,__arg);
+    return;
+  }
+  vector<NumaNodeCall> calls(num_nodes);
+  vector<pthread_t> threads(num_nodes);
+  vector<bool> started(num_nodes,false);
+  sigset_t all_sigs,old_sigs;
+  sigfillset(&all_sigs);
+  pthread_sigmask(SIG_SETMASK,&all_sigs,&old_sigs);
+  for(int n = 0; n < num_nodes; n++){
+    calls[n].fcn = __fcn;
+    calls[n].arg = __arg;
+    calls[n].node = n;
+    started[n] = (pthread_create(&threads[n],0,numa_node_thread,&calls[n])
+		  == 0);
+  }
+  pthread_sigmask(SIG_SETMASK,&old_sigs,0);
+  for(int n = 0; n < num_nodes; n++){
+    if(started[n]) pthread_join(threads[n],0);
+    else __fcn(n,__arg); // no thread, do it here (unpinned)
+  }
+}
+//_____________________________________________________________________________
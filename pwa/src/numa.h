@@ -0,0 +1,57 @@
+// -*- C++ -*-
+// Author: Mike Williams
+//_____________________________________________________________________________
+#ifndef _numa_H
+#define _numa_H
+
+#include <string>
+#include <vector>
+
+using namespace std;
+/*
+ * NUMA topology + thread placement. Amps are spread over the nodes by first
+ * touch when they're allocated (see AmpStore::resize) and the FcnSum workers
+ * are pinned to the node whose events they sweep, so (w/ 2 sockets) the
+ * kernels don't pull half their bandwidth across the interconnect. Like the
+ * rest of the core, nothing in here knows about Ruby.
+ */
+//_____________________________________________________________________________
+/// The NUMA nodes work is spread over + the CPUs on each.
+struct NumaTopology {
+  vector<vector<int> > node_cpus; // [node] -> CPU ids
+  string source; // where it came from ("sysfs", "PWA_NUMA_NODES", ...)
+
+  int num_nodes() const {return (int)node_cpus.size();}
+  int num_cpus() const;
+  /// Splits @a num events into a contiguous range for each node, in
+  /// proportion to its number of CPUs, w/ boundaries at multiples of
+  /// @a align. Node n gets [first[n],first[n+1]).
+  vector<int> split(int __num,int __align) const;
+};
+/// Parses a Linux cpulist (eg "0-3,8-11") into @a cpus. Returns false if
+/// it's not valid.
+bool parse_cpu_list(const string &__list,vector<int> &__cpus);
+/// Reads the topology from @a sysfs_dir (nodes w/o CPUs are skipped). If
+/// that's not there (eg OS X), returns 1 node w/ all online CPUs.
+NumaTopology read_numa_topology(const char *__sysfs_dir
+				= "/sys/devices/system/node");
+/// Parses a topology override: either a number of nodes (the CPUs are
+/// divided up between them, reusing CPUs if there are too few) or cpulists
+/// separated by ':' (eg "0-3:4-7"). Returns false if @a spec isn't valid.
+bool parse_numa_nodes(const string &__spec,NumaTopology &__topo);
+/// Returns the topology the amp stores + FcnSum workers use. It's read from
+/// sysfs the 1st time this is called, unless PWA_NUMA_NODES is set (see
+/// parse_numa_nodes), which is useful to test w/ fake nodes.
+const NumaTopology& numa_topology();
+/// Use @a topo from now on (only affects amps allocated after this)
+void set_numa_topology(const NumaTopology &__topo);
+/// Pins the calling thread to @a cpus. Returns false if it couldn't be (or
+/// pinning isn't supported on this OS).
+bool pin_thread(const vector<int> &__cpus);
+/// Calls fcn(node,arg) for each node of numa_topology(), each on a thread
+/// pinned to that node (all signals blocked), and waits for them to finish.
+/// If there's only 1 node, it's called on the calling thread.
+void numa_for_each_node(void (*__fcn)(int,void*),void *__arg);
+//_____________________________________________________________________________
+
+#endif /* _numa_H */
@@ -0,0 +1,757 @@
+// Author: Mike Williams
+//_____________________________________________________________________________
+#include "pwa-core.h"
+#include "numa.h"
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <algorithm>
+#include <map>
+#include <new>
+#include <pthread.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/// Events are handled in blocks of this many, so the amp totals for a block
+/// stay in cache while the amp columns stream through.
+static const int EVT_BLOCK = 256;
+/// Number of events read from amps files at a time
+static const int READ_BLOCK = 4096;
+//_____________________________________________________________________________
+/// The column cache: buffers read from amps files, by AmpStore::read_column
+/// key (only used while reading in amps, so there's no locking). It holds a
+/// reference to each, so AmpColumn::clear never needs to touch it (each Ruby
+/// extension links its own copy of the core, so there'd be 1 per extension).
+static map<string,AmpBuffer*> amp_cache;
+/// Number of times a column was shared (instead of read) since the start
+static int amp_cache_hits = 0;
+//_____________________________________________________________________________
+void AmpColumn::allocate(int __num){
+  this->clear();
+  if(__num <= 0) return;
+  size_t size = __num*sizeof(complex<float>);
+  void *ptr = mmap(0,size,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANON,-1,0);
+  if(ptr == MAP_FAILED) throw bad_alloc();
+  buf = new AmpBuffer();
+  buf->data = (complex<float>*)ptr;
+  buf->num = __num;
+  buf->refs = 1;
+  data = buf->data;
+  num = __num;
+}
+//_____________________________________________________________________________
+void AmpColumn::share(const AmpColumn &__col){
+  if(__col.buf == buf) return;
+  this->clear();
+  buf = __col.buf;
+  data = __col.data;
+  num = __col.num;
+  if(buf != 0) buf->refs++;
+}
+//_____________________________________________________________________________
+void AmpColumn::unshare(){
+  if(!this->shared()) return;
+  AmpColumn col;
+  col.allocate(num);
+  copy(data,data + num,col.data);
+  this->share(col);
+}
+//_____________________________________________________________________________
+void AmpColumn::clear(){
+  if(buf != 0 && --(buf->refs) == 0){
+    munmap(buf->data,buf->num*sizeof(complex<float>));
+    delete buf;
+  }
+  buf = 0;
+  data = 0;
+  num = 0;
+}
+//_____________________________________________________________________________
+void AmpStore::resize(int __num_events,const vector<int> &__num_amps){
+  int num_ic = (int)__num_amps.size();
+  num_events = __num_events;
+  cols.resize(num_ic);
+  for(int ic = 0; ic < num_ic; ic++){
+    cols[ic].resize(__num_amps[ic]);
+    for(int a = 0; a < __num_amps[ic]; a++) cols[ic][a].allocate(num_events);
+  }
+  // page boundaries (columns are page aligned) are the finest split possible
+  int page_events = (int)(sysconf(_SC_PAGESIZE)/sizeof(complex<float>));
+  node_first = numa_topology().split(num_events,page_events);
+}
+//_____________________________________________________________________________
+/// What first_touch_column needs
+struct FirstTouchArgs {
+  const AmpStore *amps;
+  AmpColumn *col;
+};
+/// Writes to each page of node's share of a column's events (see read_column)
+static void first_touch_column(int __node,void *__ptr){
+  FirstTouchArgs *args = (FirstTouchArgs*)__ptr;
+  int first = args->amps->node_first[__node];
+  int last = args->amps->node_first[__node + 1];
+  int page_events = (int)(sysconf(_SC_PAGESIZE)/sizeof(complex<float>));
+  for(int ev = first; ev < last; ev += page_events)
+    (*args->col)[ev] = complex<float>(0.f,0.f);
+}
+//_____________________________________________________________________________
+/// Returns the column cache key for amps @a file w/ @a cuts, skipping the
+/// 1st @a first events which pass and keeping @a num (empty if @a file
+/// can't be stat'd). Files are identified by device + inode (so different
+/// paths to the same file match) + size + modification time, the cuts by
+/// which events pass them.
+static string amp_cache_key(const char *__file,const vector<double> *__cuts,
+			    int __first,int __num){
+  struct stat st;
+  if(stat(__file,&st) != 0) return "";
+  char id[200];
+  int num_cuts = (__cuts == 0) ? -1 : (int)__cuts->size();
+  sprintf(id,"%lu:%lu:%ld:%ld:%d:%d:%d:",(unsigned long)st.st_dev,
+	  (unsigned long)st.st_ino,(long)st.st_size,(long)st.st_mtime,__first,
+	  __num,num_cuts);
+  string key = id;
+  if(__cuts != 0){ // 1 bit per event
+    key.reserve(key.size() + num_cuts/8 + 1);
+    for(int ev = 0; ev < num_cuts; ev += 8){
+      unsigned char bits = 0;
+      for(int b = 0; b < 8 && ev + b < num_cuts; b++)
+	if((*__cuts)[ev + b] > 0) bits |= (1 << b);
+      key += (char)bits;
+    }
+  }
+  return key;
+}
+//_____________________________________________________________________________
+int AmpStore::read_column(int __ic,int __a,const char *__file,
+			  const vector<double> *__cuts,int __first){
+  AmpColumn &col = cols[__ic][__a];
+  amp_cache_purge();
+  string key = amp_cache_key(__file,__cuts,__first,num_events);
+  if(!key.empty()){
+    map<string,AmpBuffer*>::iterator cached = amp_cache.find(key);
+    if(cached != amp_cache.end()){
+      if(col.buf != cached->second){
+	col.clear();
+	col.buf = cached->second;
+	col.data = col.buf->data;
+	col.num = col.buf->num;
+	col.buf->refs++;
+      }
+      amp_cache_hits++;
+      return num_events;
+    }
+  }
+  col.allocate(num_events); // (fresh memory, none of it touched yet)
+  FirstTouchArgs args = {this,&col};
+  numa_for_each_node(first_touch_column,&args);
+  int num_read = read_amps_file(__file,__cuts,__first,col);
+  if(!key.empty() && num_read == num_events && col.buf != 0){
+    col.buf->key = key;
+    col.buf->refs++;
+    amp_cache[key] = col.buf;
+  }
+  return num_read;
+}
+//_____________________________________________________________________________
+void amp_cache_purge(){
+  map<string,AmpBuffer*>::iterator iter = amp_cache.begin();
+  while(iter != amp_cache.end()){
+    AmpBuffer *buf = iter->second;
+    if(buf->refs > 1) iter++;
+    else{ // nobody else uses it
+      amp_cache.erase(iter++);
+      munmap(buf->data,buf->num*sizeof(complex<float>));
+      delete buf;
+    }
+  }
+}
+//_____________________________________________________________________________
+AmpCacheStats amp_cache_stats(){
+  amp_cache_purge();
+  AmpCacheStats stats;
+  stats.columns = (int)amp_cache.size();
+  stats.hits = amp_cache_hits;
+  stats.bytes = stats.bytes_saved = 0;
+  map<string,AmpBuffer*>::const_iterator iter = amp_cache.begin();
+  for(; iter != amp_cache.end(); iter++){
+    size_t bytes = iter->second->num*sizeof(complex<float>);
+    stats.bytes += bytes;
+    stats.bytes_saved += (iter->second->refs - 2)*bytes; // (- the cache)
+  }
+  return stats;
+}
+//_____________________________________________________________________________
+void AmpStore::clear(){
+  vector<vector<AmpColumn> >().swap(cols);
+  node_first.assign(1,0);
+  num_events = 0;
+}
+//_____________________________________________________________________________
+size_t AmpStore::bytes() const {
+  size_t num_amps = 0;
+  for(int ic = 0; ic < num_ic(); ic++) num_amps += cols[ic].size();
+  return num_amps*num_events*sizeof(complex<float>);
+}
+//_____________________________________________________________________________
+/// Sets tot[i] = sum over a of pars[a]*cols[a][i], for i < num
+static void amp_totals(int __num_amps,const complex<float> *const *__cols,
+		       const complex<double> *__pars,int __num,
+		       complex<double> *__tot){
+  for(int i = 0; i < __num; i++) __tot[i] = 0.;
+  for(int a = 0; a < __num_amps; a++){
+    const complex<float> *col = __cols[a];
+    double pr = __pars[a].real(),pi = __pars[a].imag();
+    for(int i = 0; i < __num; i++){
+      double cr = col[i].real(),ci = col[i].imag();
+      __tot[i] += complex<double>(pr*cr - pi*ci,pr*ci + pi*cr);
+    }
+  }
+}
+//_____________________________________________________________________________
+/// Adds the sum over i < num of cols[a][i]*factor[i] to sums[a]
+static void amp_sums(int __num_amps,const complex<float> *const *__cols,
+		     const complex<double> *__factor,int __num,
+		     complex<double> *__sums){
+  for(int a = 0; a < __num_amps; a++){
+    const complex<float> *col = __cols[a];
+    double sr = 0.,si = 0.;
+    for(int i = 0; i < __num; i++){
+      double cr = col[i].real(),ci = col[i].imag();
+      double fr = __factor[i].real(),fi = __factor[i].imag();
+      sr += cr*fr - ci*fi;
+      si += cr*fi + ci*fr;
+    }
+    __sums[a] += complex<double>(sr,si);
+  }
+}
+//_____________________________________________________________________________
+/// Returns the sum over a1,a2 of pars[a1]*conj(pars[a2])*norm[a1][a2],
+/// sets dsums[a1] to the sum over a2 of conj(pars[a2])*norm[a1][a2].
+static complex<double> norm_sums(int __num_amps,const VectorFlt2D &__norm_vals,
+				 const complex<double> *__pars,
+				 complex<double> *__dsums){
+  complex<double> norm = 0.;
+  for(int a1 = 0; a1 < __num_amps; a1++){
+    const complex<float> *row = &__norm_vals[a1][0];
+    complex<double> sum = 0.;
+    for(int a2 = 0; a2 < __num_amps; a2++) sum += conj(__pars[a2])*row[a2];
+    __dsums[a1] = sum;
+    norm += __pars[a1]*sum;
+  }
+  return norm;
+}
+//_____________________________________________________________________________
+/*
+ * PREC_MIXED kernels. Amps are handled as interleaved (real,imag) floats so
+ * the compiler can vectorize across events. Sums over events are kept in
+ * FLT_LANES independent partial sums (which also vectorize) for each block
+ * of events, then added to the double totals.
+ */
+static const int FLT_LANES = 4;
+
+/// Sets tot[i] = sum over a of pars[a]*cols[a][i] for i < num, in float
+static void amp_totals_flt(int __num_amps,const complex<float> *const *__cols,
+			   const complex<float> *__pars,int __num,
+			   complex<float> *__tot){
+  float *tot = (float*)__tot;
+  for(int j = 0; j < 2*__num; j++) tot[j] = 0.f;
+  for(int a = 0; a < __num_amps; a++){
+    const float *col = (const float*)__cols[a];
+    float pr = __pars[a].real(),pi = __pars[a].imag();
+    for(int j = 0; j < 2*__num; j += 2){
+      tot[j] += pr*col[j] - pi*col[j+1];
+      tot[j+1] += pr*col[j+1] + pi*col[j];
+    }
+  }
+}
+/// Adds the sum over i < num of cols[a][i]*factor[i] to sums[a] (products
+/// in float, the sum for each lane is taken over num/FLT_LANES events)
+static void amp_sums_flt(int __num_amps,const complex<float> *const *__cols,
+			 const complex<float> *__factor,int __num,
+			 complex<double> *__sums){
+  const float *factor = (const float*)__factor;
+  for(int a = 0; a < __num_amps; a++){
+    const float *col = (const float*)__cols[a];
+    float lanes[2*FLT_LANES];
+    for(int l = 0; l < 2*FLT_LANES; l++) lanes[l] = 0.f;
+    int i = 0;
+    for(; i + FLT_LANES <= __num; i += FLT_LANES){
+      for(int l = 0; l < FLT_LANES; l++){
+	int j = 2*(i + l);
+	lanes[2*l] += col[j]*factor[j] - col[j+1]*factor[j+1];
+	lanes[2*l+1] += col[j]*factor[j+1] + col[j+1]*factor[j];
+      }
+    }
+    double sr = 0.,si = 0.;
+    for(; i < __num; i++){
+      int j = 2*i;
+      sr += col[j]*factor[j] - col[j+1]*factor[j+1];
+      si += col[j]*factor[j+1] + col[j+1]*factor[j];
+    }
+    for(int l = 0; l < FLT_LANES; l++){
+      sr += lanes[2*l];
+      si += lanes[2*l+1];
+    }
+    __sums[a] += complex<double>(sr,si);
+  }
+}
+//_____________________________________________________________________________
+int read_amps_file(const char *__file,const vector<double> *__cuts,
+		   int __first,AmpColumn &__col){
+  ifstream in_file(__file,ios::in|ios::binary);
+  int num = (int)__col.size(),num_cuts = 0;
+  if(__cuts != 0) num_cuts = (int)__cuts->size();
+  int event = 0,pass_index = 0,stored = 0;
+  vector<complex<float> > buf(READ_BLOCK);
+  while(stored < num){
+    in_file.read((char*)&buf[0],READ_BLOCK*sizeof(complex<float>));
+    int num_read = (int)(in_file.gcount()/sizeof(complex<float>));
+    if(num_read == 0) break;
+    for(int i = 0; i < num_read && stored < num; i++,event++){
+      if(__cuts != 0 && (event >= num_cuts || (*__cuts)[event] <= 0))
+	continue;
+      if(pass_index >= __first) __col[stored++] = buf[i];
+      pass_index++;
+    }
+  }
+  return stored;
+}
+//_____________________________________________________________________________
+/// Adds d(-log(L))/dpar, from the sums of d(-log(L))/d(param) @a dl_dpar,
+/// to @a grad for each of the @a free MINUIT parameters
+static void add_log_l_derivs(const VectorDbl3D &__dparams,
+			     const vector<vector<complex<double> > > &__dl_dpar,
+			     const vector<int> &__free,double *__grad){
+  int num_free = (int)__free.size();
+  int num_ic = (int)__dl_dpar.size();
+  for(int k = 0; k < num_free; k++){
+    int p = __free[k];
+    complex<double> dl_dp = 0.;
+    for(int ic = 0; ic < num_ic; ic++){
+      int num_amps = (int)__dl_dpar[ic].size();
+      for(int a = 0; a < num_amps; a++)
+	dl_dp += __dparams[ic][a][p]*__dl_dpar[ic][a];
+    }
+    __grad[k] += 2*dl_dp.real();
+  }
+}
+/// Sets @a free to every MINUIT parameter (0,...,num_pars-1) and zeros 
+/// @a derivs if @a do_derivs (else clears @a free)
+static void all_pars(bool __do_derivs,vector<double> &__derivs,
+		     vector<int> &__free){
+  __free.clear();
+  if(!__do_derivs) return;
+  for(int p = 0; p < (int)__derivs.size(); p++) __free.push_back(p);
+  __derivs.assign(__derivs.size(),0.);
+}
+//_____________________________________________________________________________
+/// evt_log_liklihood w/ PREC_MIXED
+static double evt_log_liklihood_mixed(const AmpStore &__amps,
+				      const VectorDbl2D &__params,
+				      const VectorDbl3D &__dparams,
+				      const vector<double> &__wts,
+				      const vector<int> &__free,
+				      double *__grad,int __first,int __last){
+  bool do_derivs = !__free.empty();
+  int last = __last < 0 ? __amps.num_events : __last;
+  int num_ic = __amps.num_ic();
+  KahanSum log_l;
+  int max_amps = 1;
+  vector<vector<complex<double> > > dl_dpar(num_ic);
+  vector<vector<complex<float> > > amp_tot(num_ic),pars(num_ic);
+  for(int ic = 0; ic < num_ic; ic++){
+    int num_amps = __amps.num_amps(ic);
+    dl_dpar[ic].assign(num_amps,0.);
+    amp_tot[ic].resize(EVT_BLOCK);
+    pars[ic].resize(num_amps);
+    for(int a = 0; a < num_amps; a++) 
+      pars[ic][a] = complex<float>(__params[ic][a]);
+    max_amps = max(max_amps,num_amps);
+  }
+  vector<float> intensity(EVT_BLOCK);
+  vector<complex<float> > factor(EVT_BLOCK);
+  vector<const complex<float>*> cols(max_amps);
+  for(int start = __first; start < last; start += EVT_BLOCK){
+    int num = min(EVT_BLOCK,last - start);
+    const double *wts = &__wts[start];
+    for(int i = 0; i < num; i++) intensity[i] = 0.f;
+    for(int ic = 0; ic < num_ic; ic++){
+      int num_amps = __amps.num_amps(ic);
+      if(num_amps == 0) continue;
+      for(int a = 0; a < num_amps; a++) cols[a] = &__amps.cols[ic][a][start];
+      amp_totals_flt(num_amps,&cols[0],&pars[ic][0],num,&amp_tot[ic][0]);
+      const float *tot = (const float*)&amp_tot[ic][0];
+      for(int i = 0; i < num; i++) 
+	intensity[i] += tot[2*i]*tot[2*i] + tot[2*i+1]*tot[2*i+1];
+    }
+    double block_log_l = 0.;
+    for(int i = 0; i < num; i++) block_log_l -= wts[i]*log(intensity[i]);
+    log_l.add(block_log_l);
+    if(!do_derivs) continue;
+    for(int ic = 0; ic < num_ic; ic++){
+      int num_amps = __amps.num_amps(ic);
+      if(num_amps == 0) continue;
+      for(int a = 0; a < num_amps; a++) cols[a] = &__amps.cols[ic][a][start];
+      const float *tot = (const float*)&amp_tot[ic][0];
+      float *f = (float*)&factor[0];
+      for(int i = 0; i < num; i++){ // -wt*conj(amp_tot)/intensity
+	float scale = (float)wts[i]/intensity[i];
+	f[2*i] = -tot[2*i]*scale;
+	f[2*i+1] = tot[2*i+1]*scale;
+      }
+      amp_sums_flt(num_amps,&cols[0],&factor[0],num,&dl_dpar[ic][0]);
+    }
+  }
+  if(do_derivs) add_log_l_derivs(__dparams,dl_dpar,__free,__grad);
+  return log_l.sum;
+}
+//_____________________________________________________________________________
+double evt_log_liklihood(const AmpStore &__amps,const VectorDbl2D &__params,
+			 const VectorDbl3D &__dparams,
+			 const vector<double> &__wts,const vector<int> &__free,
+			 double *__grad,int __first,int __last){
+  if(__amps.precision == PREC_MIXED)
+    return evt_log_liklihood_mixed(__amps,__params,__dparams,__wts,__free,
+				   __grad,__first,__last);
+  bool do_derivs = !__free.empty();
+  int last = __last < 0 ? __amps.num_events : __last;
+  int num_ic = __amps.num_ic();
+  KahanSum log_l;
+  int max_amps = 1;
+  vector<vector<complex<double> > > dl_dpar(num_ic),amp_tot(num_ic);
+  for(int ic = 0; ic < num_ic; ic++){
+    dl_dpar[ic].assign(__amps.num_amps(ic),0.);
+    amp_tot[ic].resize(EVT_BLOCK);
+    max_amps = max(max_amps,__amps.num_amps(ic));
+  }
+  vector<double> intensity(EVT_BLOCK);
+  vector<complex<double> > factor(EVT_BLOCK);
+  vector<const complex<float>*> cols(max_amps);
+  for(int start = __first; start < last; start += EVT_BLOCK){
+    int num = min(EVT_BLOCK,last - start);
+    const double *wts = &__wts[start];
+    for(int i = 0; i < num; i++) intensity[i] = 0.;
+    for(int ic = 0; ic < num_ic; ic++){
+      int num_amps = __amps.num_amps(ic);
+      if(num_amps == 0) continue;
+      for(int a = 0; a < num_amps; a++) cols[a] = &__amps.cols[ic][a][start];
+      const complex<double> *tot = &amp_tot[ic][0];
+      amp_totals(num_amps,&cols[0],&__params[ic][0],num,&amp_tot[ic][0]);
+      for(int i = 0; i < num; i++) 
+	intensity[i] += tot[i].real()*tot[i].real() + tot[i].imag()*tot[i].imag();
+    }
+    double block_log_l = 0.;
+    for(int i = 0; i < num; i++) block_log_l -= wts[i]*log(intensity[i]);
+    log_l.add(block_log_l);
+    if(!do_derivs) continue;
+    for(int ic = 0; ic < num_ic; ic++){
+      int num_amps = __amps.num_amps(ic);
+      if(num_amps == 0) continue;
+      for(int a = 0; a < num_amps; a++) cols[a] = &__amps.cols[ic][a][start];
+      const complex<double> *tot = &amp_tot[ic][0];
+      for(int i = 0; i < num; i++) 
+	factor[i] = -wts[i]*conj(tot[i])/intensity[i];
+      amp_sums(num_amps,&cols[0],&factor[0],num,&dl_dpar[ic][0]);
+    }
+  }
+  if(do_derivs) add_log_l_derivs(__dparams,dl_dpar,__free,__grad);
+  return log_l.sum;
+}
+//_____________________________________________________________________________
+double evt_log_liklihood(const AmpStore &__amps,const VectorDbl2D &__params,
+			 const VectorDbl3D &__dparams,
+			 const vector<double> &__wts,bool __do_derivs,
+			 vector<double> &__derivs,int __first,int __last){
+  vector<int> free;
+  all_pars(__do_derivs,__derivs,free);
+  return evt_log_liklihood(__amps,__params,__dparams,__wts,free,
+			   free.empty() ? 0 : &__derivs[0],__first,__last);
+}
+//_____________________________________________________________________________
+double evt_norm(const VectorFlt3D &__norm_vals,const VectorDbl2D &__params,
+		const VectorDbl3D &__dparams,const vector<int> &__free,
+		double *__grad){
+  int num_ic = (int)__params.size();
+  int num_free = (int)__free.size();
+  complex<double> norm = 0.0;
+  vector<complex<double> > dnorm_dpar(num_free,0.),dsums;
+
+  for(int ic = 0; ic < num_ic; ic++){
+    int num_amps = (int)__norm_vals[ic].size();
+    if(num_amps == 0) continue;
+    dsums.resize(num_amps);
+    norm += norm_sums(num_amps,__norm_vals[ic],&__params[ic][0],&dsums[0]);
+    for(int a1 = 0; a1 < num_amps && num_free > 0; a1++){
+      const complex<double> *dparams = &__dparams[ic][a1][0];
+      for(int k = 0; k < num_free; k++)
+	dnorm_dpar[k] += dparams[__free[k]]*dsums[a1];
+    }
+  }
+  for(int k = 0; k < num_free; k++) __grad[k] += 2*dnorm_dpar[k].real();
+  return norm.real();
+}
+//_____________________________________________________________________________
+double evt_norm(const VectorFlt3D &__norm_vals,const VectorDbl2D &__params,
+		const VectorDbl3D &__dparams,bool __do_derivs,
+		vector<double> &__derivs){
+  vector<int> free;
+  all_pars(__do_derivs,__derivs,free);
+  return evt_norm(__norm_vals,__params,__dparams,free,
+		  free.empty() ? 0 : &__derivs[0]);
+}
+//_____________________________________________________________________________
+/// Shared by the evt_hessian threads, each sums the event terms for its 
+/// range of events into its own (lower triangle of) hess
+struct HessianTask {
+  const AmpStore *amps;
+  const VectorDbl2D *params;
+  const VectorDbl3D *dparams;
+  const vector<double> *wts;
+  const vector<int> *act_pars;
+  const vector<vector<vector<int> > > *dep_amps; // [ic][act par][k]
+  const vector<pair<int,int> > *d2_amps; // (ic,a) w/ 2nd derivatives
+  bool fisher;
+  int first,last;
+  vector<double> hess;
+  vector<complex<double> > dlog; // [k] d(-log(L))/d(params of d2_amps[k])
+};
+/// Sums the event terms of the Hessian (see evt_hessian) for @a task
+static void hessian_events(HessianTask &__task){
+  const AmpStore &amps = *__task.amps;
+  const VectorDbl2D &params = *__task.params;
+  const VectorDbl3D &dparams = *__task.dparams;
+  const vector<int> &act_pars = *__task.act_pars;
+  int num_ic = (int)params.size();
+  const vector<pair<int,int> > &d2_amps = *__task.d2_amps;
+  int num_act = (int)act_pars.size();
+  int num_d2 = __task.fisher ? 0 : (int)d2_amps.size();
+  vector<double> dI(num_act);
+  vector<complex<double> > amp_tots(num_ic);
+  vector<vector<complex<double> > > damp(num_ic);
+  for(int ic = 0; ic < num_ic; ic++) damp[ic].resize(num_act);
+  vector<double> &hess = __task.hess;
+  hess.assign(num_act*num_act,0.);
+  __task.dlog.assign(num_d2,0.);
+
+  for(int ev = __task.first; ev < __task.last; ev++){ // loop over events
+    double intensity = 0.;
+    double wt = (*__task.wts)[ev];
+    for(int i = 0; i < num_act; i++) dI[i] = 0.;
+    for(int ic = 0; ic < num_ic; ic++){
+      complex<double> amp_tot = amps.amp_total(ev,ic,params[ic]);
+      amp_tots[ic] = amp_tot;
+      intensity += (amp_tot*conj(amp_tot)).real();
+      for(int i = 0; i < num_act; i++){ // d(amp_tot)/dpar
+	const vector<int> &dep = (*__task.dep_amps)[ic][i];
+	complex<double> d = 0.;
+	for(int k = 0; k < (int)dep.size(); k++){
+	  int a = dep[k];
+	  d += dparams[ic][a][act_pars[i]]*amps(ev,ic,a);
+	}
+	damp[ic][i] = d;
+	dI[i] += 2*(d*conj(amp_tot)).real();
+      }
+    }
+    for(int k = 0; k < num_d2; k++){ // d(-log(I))/d(params[ic][a])
+      int ic = d2_amps[k].first,a = d2_amps[k].second;
+      __task.dlog[k] -= wt*(conj(amp_tots[ic])*amps(ev,ic,a))/intensity;
+    }
+    double i2 = intensity*intensity;
+    for(int i = 0; i < num_act; i++){
+      for(int j = 0; j <= i; j++){
+	double h = dI[i]*dI[j]/i2;
+	if(!__task.fisher){
+	  double d2I = 0.;
+	  for(int ic = 0; ic < num_ic; ic++)
+	    d2I += 2*(damp[ic][i]*conj(damp[ic][j])).real();
+	  h -= d2I/intensity;
+	}
+	hess[i*num_act + j] += wt*h;
+      }
+    }
+  }
+}
+static void* hessian_thread(void *__ptr){
+  hessian_events(*(HessianTask*)__ptr);
+  return 0;
+}
+//_____________________________________________________________________________
+vector<int> evt_hessian(const AmpStore &__amps,const VectorDbl2D &__params,
+			const VectorDbl3D &__dparams,
+			const vector<ParamD2> &__d2params,
+			const VectorFlt3D *__norm_vals,
+			const vector<double> &__wts,const vector<bool> &__free,
+			bool __fisher,vector<double> &__hess,int __num_threads){
+  int num_events = __amps.num_events;
+  int num_ic = (int)__params.size();
+  int num_pars = (int)__free.size();
+  // the amps w/ 2nd derivatives, d2_index[d] is d2params[d]'s amp in them
+  vector<pair<int,int> > d2_amps;
+  vector<int> d2_index;
+  vector<bool> has_d2(num_pars,false);
+  if(!__fisher){
+    for(int d = 0; d < (int)__d2params.size(); d++){
+      const ParamD2 &d2 = __d2params[d];
+      pair<int,int> amp(d2.ic,d2.a);
+      int k = (int)(find(d2_amps.begin(),d2_amps.end(),amp) - d2_amps.begin());
+      if(k == (int)d2_amps.size()) d2_amps.push_back(amp);
+      d2_index.push_back(k);
+      has_d2[d2.p] = has_d2[d2.q] = true;
+    }
+  }
+  // only parameters some amp depends on can contribute, keep (sparse) lists
+  // of the amps which depend on each of them (0 isn't a MINUIT parameter id)
+  vector<int> act_pars;
+  vector<int> act_index(num_pars,-1); // MINUIT id -> index in act_pars
+  vector<vector<vector<int> > > dep_amps(num_ic);
+  for(int p = 1; p < num_pars; p++){
+    if(!__free[p]) continue;
+    bool active = has_d2[p];
+    for(int ic = 0; ic < num_ic; ic++){
+      int num_amps = (int)__params[ic].size();
+      for(int a = 0; a < num_amps; a++){
+	if(__dparams[ic][a][p] != 0.) { active = true; break; }
+      }
+    }
+    if(!active) continue;
+    act_index[p] = (int)act_pars.size();
+    act_pars.push_back(p);
+    for(int ic = 0; ic < num_ic; ic++){
+      int num_amps = (int)__params[ic].size();
+      dep_amps[ic].push_back(vector<int>());
+      for(int a = 0; a < num_amps; a++){
+	if(__dparams[ic][a][p] != 0.) dep_amps[ic].back().push_back(a);
+      }
+    }
+  }
+  int num_act = (int)act_pars.size();
+  // the event terms, split into ranges of events over the threads
+  int num_threads = max(1,min(__num_threads,num_events/EVT_BLOCK));
+  vector<HessianTask> tasks(num_threads);
+  for(int t = 0; t < num_threads; t++){
+    HessianTask &task = tasks[t];
+    task.amps = &__amps;
+    task.params = &__params;
+    task.dparams = &__dparams;
+    task.wts = &__wts;
+    task.act_pars = &act_pars;
+    task.dep_amps = &dep_amps;
+    task.d2_amps = &d2_amps;
+    task.fisher = __fisher;
+    task.first = (int)(((long long)num_events*t)/num_threads);
+    task.last = (int)(((long long)num_events*(t + 1))/num_threads);
+  }
+  vector<pthread_t> threads(num_threads);
+  vector<bool> started(num_threads,false);
+  for(int t = 1; t < num_threads; t++)
+    started[t] = (pthread_create(&threads[t],0,hessian_thread,&tasks[t]) == 0);
+  for(int t = 0; t < num_threads; t++){ // this thread does the rest
+    if(!started[t]) hessian_events(tasks[t]);
+  }
+  __hess.assign(num_act*num_act,0.);
+  vector<complex<double> > dlog(d2_amps.size(),0.);
+  for(int t = 0; t < num_threads; t++){
+    if(started[t]) pthread_join(threads[t],0);
+    for(int k = 0; k < num_act*num_act; k++) __hess[k] += tasks[t].hess[k];
+    for(int k = 0; k < (int)dlog.size(); k++) dlog[k] += tasks[t].dlog[k];
+  }
+  // the terms w/ 2nd derivatives of the amp parameters, each is 2 Re of
+  // d2params*d(-log(L) + norm-int)/d(params)
+  if(__norm_vals != 0){
+    const VectorFlt3D &norm_vals = *__norm_vals;
+    for(int k = 0; k < (int)d2_amps.size(); k++){
+      int ic = d2_amps[k].first,a1 = d2_amps[k].second;
+      int num_amps = (int)min(norm_vals[ic].size(),__params[ic].size());
+      if(a1 >= num_amps) continue;
+      for(int a2 = 0; a2 < num_amps; a2++)
+	dlog[k] += norm_vals[ic][a1][a2]*conj(__params[ic][a2]);
+    }
+  }
+  for(int d = 0; d < (int)d2_index.size(); d++){
+    const ParamD2 &d2 = __d2params[d];
+    int i = act_index[d2.p],j = act_index[d2.q];
+    if(i < 0 || j < 0) continue;
+    __hess[i*num_act + j] += 2*(d2.val*dlog[d2_index[d]]).real();
+  }
+  // the norm-int contribution (its expectation cancels the d2I terms above,
+  // so it's not part of the Fisher information)
+  if(!__fisher && __norm_vals != 0){
+    const VectorFlt3D &norm_vals = *__norm_vals;
+    for(int ic = 0; ic < num_ic; ic++){
+      int num_amps = (int)norm_vals[ic].size();
+      for(int i = 0; i < num_act; i++){
+	const vector<int> &amps_i = dep_amps[ic][i];
+	for(int j = 0; j <= i; j++){
+	  const vector<int> &amps_j = dep_amps[ic][j];
+	  complex<double> d2norm = 0.;
+	  for(int k1 = 0; k1 < (int)amps_i.size(); k1++){
+	    int a1 = amps_i[k1];
+	    if(a1 >= num_amps) continue;
+	    for(int k2 = 0; k2 < (int)amps_j.size(); k2++){
+	      int a2 = amps_j[k2];
+	      if(a2 >= num_amps) continue;
+	      d2norm += __dparams[ic][a1][act_pars[i]]
+		*(norm_vals[ic][a1][a2]*conj(__dparams[ic][a2][act_pars[j]]));
+	    }
+	  }
+	  __hess[i*num_act + j] += 2*d2norm.real();
+	}
+      }
+    }
+  }
+  // fill in the upper triangle
+  for(int i = 0; i < num_act; i++){
+    for(int j = 0; j < i; j++) __hess[j*num_act + i] = __hess[i*num_act + j];
+  }
+  return act_pars;
+}
+//_____________________________________________________________________________
+int amps_file_events(const char *__file){
+  ifstream in_file(__file,ios::in|ios::binary|ios::ate);
+  if(!in_file) return 0;
+  return (int)(in_file.tellg()/(streamoff)sizeof(complex<float>));
+}
+//_____________________________________________________________________________
+int norm_int_sums(const vector<const char*> &__files,
+		  const vector<double> *__cuts,int __max_events,
+		  VectorFlt2D &__sums,int &__num_used){
+  int num_amps = (int)__files.size(),num_cuts = 0;
+  if(__cuts != 0) num_cuts = (int)__cuts->size();
+  ifstream *in_files = new ifstream[num_amps];
+  for(int f = 0; f < num_amps; f++)
+    in_files[f].open(__files[f],ios::in|ios::binary);
+  VectorFlt2D buf(num_amps,vector<complex<float> >(READ_BLOCK));
+  __sums.assign(num_amps,vector<complex<float> >(num_amps,0.));
+  __num_used = 0;
+  int event = 0;
+  while(event < __max_events){
+    int num = min(READ_BLOCK,__max_events - event),num_read = num;
+    for(int f = 0; f < num_amps; f++){
+      in_files[f].read((char*)&buf[f][0],num*sizeof(complex<float>));
+      num_read = min(num_read,
+		     (int)(in_files[f].gcount()/sizeof(complex<float>)));
+    }
+    for(int i = 0; i < num_read; i++){
+      if(__cuts != 0 && (event + i >= num_cuts || (*__cuts)[event + i] < 0))
+	continue;
+      __num_used++;
+      for(int row = 0; row < num_amps; row++){
+	complex<float> amp = buf[row][i];
+	for(int col = row; col < num_amps; col++)
+	  __sums[row][col] += amp*conj(buf[col][i]);
+      }
+    }
+    event += num_read;
+    if(num_read < num) break; // ran out of events
+  }
+  delete [] in_files;
+  // impose symmetry
+  for(int row = 0; row < num_amps; row++){
+    for(int col = 0; col < row; col++) 
+      __sums[row][col] = conj(__sums[col][row]);
+  }
+  return event;
+}
+//_____________________________________________________________________________
@@ -0,0 +1,217 @@
+// -*- C++ -*-
+// Author: Mike Williams
+//_____________________________________________________________________________
+#ifndef _pwa_core_H
+#define _pwa_core_H
+
+#include <vector>
+#include <complex>
+#include <string>
+#include <cstddef>
+
+using namespace std;
+/*
+ * The PWA core: amplitude storage + the numeric kernels used during fits.
+ * Nothing in here knows about Ruby, so it can be linked into the Ruby
+ * extensions (which are thin wrappers around it), run from worker threads or
+ * benchmarked on its own (see bench.cpp).
+ */
+//_____________________________________________________________________________
+typedef vector<vector<complex<double> > > VectorDbl2D;
+typedef vector<vector<complex<float> > >  VectorFlt2D;
+typedef vector<vector<vector<complex<double> > > > VectorDbl3D;
+typedef vector<vector<vector<complex<float> > > > VectorFlt3D;
+//_____________________________________________________________________________
+/// Provide multiplication b/t complex<float> and complex<double>.
+template <typename __U,typename __V>
+complex<double> operator*(const complex<__U> &__c1,const complex<__V> &__c2){
+  double x1 = __c1.real(),x2 = __c2.real(),y1 = __c1.imag(),y2 = __c2.imag();
+  return complex<double>(x1*x2-y1*y2,x1*y2+y1*x2);
+}
+//_____________________________________________________________________________
+/// Compensated (Kahan) sum, for adding up many terms in double.
+struct KahanSum {
+  double sum,c; // running sum + (minus) the low order bits lost from it
+
+  KahanSum() : sum(0.),c(0.) {}
+
+  void add(double __x){
+    double y = __x - c;
+    double t = sum + y;
+    c = (t - sum) - y;
+    sum = t;
+  }
+};
+/// Arithmetic used by the -log(L) kernels. PREC_MIXED does the per event
+/// work (amp totals, intensities, gradient terms) in float, at twice the SIMD
+/// width, and only the sums over events in double.
+enum Precision { PREC_DOUBLE, PREC_MIXED };
+//_____________________________________________________________________________
+/// Memory holding amps, shared (reference counted) by the AmpColumns using it.
+struct AmpBuffer {
+  complex<float> *data;
+  int num;
+  int refs;   // number of AmpColumns (+ the column cache) using it
+  string key; // in the column cache under this (if not empty)
+};
+/// One amplitude for every event (the contents of 1 amps file after cuts).
+/// Columns are handles to AmpBuffers, so copies share the same amps (use
+/// unshare before writing to one that may be shared). The memory is mmapped,
+/// so it starts out zeroed and each page ends up on the NUMA node of the
+/// thread that first writes it (see AmpStore::read_column).
+struct AmpColumn {
+  complex<float> *data;
+  int num;
+  AmpBuffer *buf;
+
+  AmpColumn() : data(0),num(0),buf(0) {}
+  AmpColumn(const AmpColumn &__col) : data(0),num(0),buf(0) {
+    this->share(__col);
+  }
+  ~AmpColumn(){this->clear();}
+  AmpColumn& operator=(const AmpColumn &__col){
+    this->share(__col);
+    return *this;
+  }
+  /// Gives this column its own (zeroed) memory for @a num amps
+  void allocate(int __num);
+  /// Use the same amps as @a col
+  void share(const AmpColumn &__col);
+  /// Gives this column its own copy of its amps (if they're shared)
+  void unshare();
+  bool shared() const {return buf != 0 && buf->refs > 1;}
+  void clear();
+  int size() const {return num;}
+  complex<float>& operator[](int __i){return data[__i];}
+  const complex<float>& operator[](int __i) const {return data[__i];}
+};
+/// Amplitudes for all events in a Dataset. They're stored by column
+/// (<tt>cols[ic][a][event]</tt>), so each amps file is read into, and the
+/// kernels stream through, contiguous blocks of memory. Events
+/// [node_first[n],node_first[n+1]) of every column read in are on NUMA node
+/// n (the same file may be shared by several columns, see read_column).
+struct AmpStore {
+  int num_events;
+  vector<vector<AmpColumn> > cols; // [ic][a]
+  Precision precision;
+  vector<int> node_first; // [node] 1st event on each NUMA node (+ num_events)
+
+  AmpStore() : num_events(0),precision(PREC_DOUBLE),node_first(1,0) {}
+
+  /// Resize for @a num_events events w/ @a num_amps[ic] amps for each ic
+  /// (all zero) and split the events up between the NUMA nodes (see
+  /// numa_topology).
+  void resize(int __num_events,const vector<int> &__num_amps);
+  /// Reads amps @a file into column @a a of @a ic (see read_amps_file for
+  /// @a cuts and @a first). If a column w/ the same file, cuts and events
+  /// is already in memory (in any AmpStore), it's shared instead. Otherwise
+  /// the column's pages are spread over the NUMA nodes by first touch before
+  /// it's read. Returns the number of amps stored.
+  int read_column(int __ic,int __a,const char *__file,
+		  const vector<double> *__cuts,int __first);
+  /// Free all memory
+  void clear();
+  int num_ic() const {return (int)cols.size();}
+  int num_nodes() const {return (int)node_first.size() - 1;}
+  int num_amps(int __ic) const {return (int)cols[__ic].size();}
+  /// Number of bytes of amplitudes held (including shared ones)
+  size_t bytes() const;
+  complex<float>& operator()(int __ev,int __ic,int __a){
+    return cols[__ic][__a][__ev];
+  }
+  const complex<float>& operator()(int __ev,int __ic,int __a) const {
+    return cols[__ic][__a][__ev];
+  }
+  /// Returns the total amplitude of @a ev for incoherent term @a ic
+  complex<double> amp_total(int __ev,int __ic,
+			    const vector<complex<double> > &__params) const {
+    complex<double> amp_tot(0,0);
+    const vector<AmpColumn> &ic_cols = cols[__ic];
+    int num_amps = (int)ic_cols.size();
+    for(int a = 0; a < num_amps; a++) 
+      amp_tot += __params[a]*ic_cols[a][__ev];
+    return amp_tot;
+  }
+};
+/// What's in the column cache (see AmpStore::read_column)
+struct AmpCacheStats {
+  int columns;        // number of columns in it
+  int hits;           // number of times a column was shared instead of read
+  size_t bytes;       // memory they use
+  size_t bytes_saved; // memory it'd take to have a copy for each user
+};
+/// Returns what's in the column cache (that of the calling Ruby extension),
+/// after freeing the columns no longer used (see amp_cache_purge).
+AmpCacheStats amp_cache_stats();
+/// Frees the columns in the cache which no AmpColumn uses anymore
+void amp_cache_purge();
+//_____________________________________________________________________________
+/// Reads amps @a file into @a col, skipping events w/ @a cuts <= 0 (if
+/// @a cuts isn't 0) and the 1st @a first events which pass them, until
+/// @a col is full. Returns the number of amps stored.
+int read_amps_file(const char *__file,const vector<double> *__cuts,
+		   int __first,AmpColumn &__col);
+/// Returns -log(L) for events @a amps w/ weights @a wts. If @a do_derivs,
+/// d(-log(L))/dpar is set in @a derivs (which must have an entry for each
+/// MINUIT parameter). Uses @a amps.precision arithmetic. Only events
+/// [first,last) are included (all of them if @a last < 0), so the events can
+/// be split up between threads.
+double evt_log_liklihood(const AmpStore &__amps,const VectorDbl2D &__params,
+			 const VectorDbl3D &__dparams,
+			 const vector<double> &__wts,bool __do_derivs,
+			 vector<double> &__derivs,int __first = 0,
+			 int __last = -1);
+/// Same as above, but only d(-log(L))/dpar w/r to the @a free MINUIT 
+/// parameters is calculated (none if it's empty), and it's added to @a grad
+/// (packed, grad[k] is w/r to parameter free[k]). So the cost of the
+/// derivatives goes w/ the number of free parameters, and several terms can
+/// be accumulated into 1 buffer.
+double evt_log_liklihood(const AmpStore &__amps,const VectorDbl2D &__params,
+			 const VectorDbl3D &__dparams,
+			 const vector<double> &__wts,const vector<int> &__free,
+			 double *__grad,int __first = 0,int __last = -1);
+/// A nonzero 2nd derivative of amp parameter params[ic][a] w/r to MINUIT
+/// parameters p >= q (see Dataset#_param_d2s).
+struct ParamD2 {
+  int ic,a,p,q;
+  complex<double> val;
+};
+/// Sets @a hess to the 2nd derivative matrix of -log(L) + norm-int (or the
+/// Fisher information if @a fisher, see Evt#calc_hessian) w/r to the MINUIT
+/// parameters which are @a free and which some amp depends on. Returns the
+/// ids of those parameters (@a hess is n x n, indexed in the same order).
+/// @a d2params are the 2nd derivatives of the amp parameters (none if they're
+/// linear in the MINUIT parameters, not used for the Fisher information).
+/// @a norm_vals may be 0 (no norm-int term). The events are split over up to
+/// @a num_threads threads.
+vector<int> evt_hessian(const AmpStore &__amps,const VectorDbl2D &__params,
+			const VectorDbl3D &__dparams,
+			const vector<ParamD2> &__d2params,
+			const VectorFlt3D *__norm_vals,
+			const vector<double> &__wts,const vector<bool> &__free,
+			bool __fisher,vector<double> &__hess,
+			int __num_threads = 1);
+/// Returns the normalization integral value using @a params. If @a do_derivs,
+/// dnorm/dpar is set in @a derivs (which must have an entry for each MINUIT
+/// parameter).
+double evt_norm(const VectorFlt3D &__norm_vals,const VectorDbl2D &__params,
+		const VectorDbl3D &__dparams,bool __do_derivs,
+		vector<double> &__derivs);
+/// Same as above, but dnorm/dpar is only calculated w/r to the @a free
+/// MINUIT parameters and added to (packed) @a grad (see evt_log_liklihood).
+double evt_norm(const VectorFlt3D &__norm_vals,const VectorDbl2D &__params,
+		const VectorDbl3D &__dparams,const vector<int> &__free,
+		double *__grad);
+/// Returns the number of events in amps @a file
+int amps_file_events(const char *__file);
+/// Sets @a sums (a1 x a2) to amp(a1)*conj(amp(a2)) summed over the events in
+/// amps @a files (up to @a max_events of them) w/ @a cuts >= 0 (all of them
+/// if @a cuts is 0). Files are read in blocks of events, so they needn't fit
+/// in memory. Returns the number of events read, @a num_used is set to the
+/// number which passed the cuts.
+int norm_int_sums(const vector<const char*> &__files,
+		  const vector<double> *__cuts,int __max_events,
+		  VectorFlt2D &__sums,int &__num_used);
+//_____________________________________________________________________________
+
+#endif /* _pwa_core_H */
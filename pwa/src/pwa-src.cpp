@@ -0,0 +1,21 @@
+// Author: Mike Williams
+//_____________________________________________________________________________
+/*
+ * Ruby glue shared by every extension (see pwa-src.h). It's compiled once 
+ * and linked into each of them, rather than #include'd.
+ */
+#include "ruby-complex.h"
+#include "pwa-src.h"
+// globals:
+VALUE rb_cPWA;
+VALUE rb_cCppVectorDbl2D;
+VALUE rb_cCppVectorFlt2D;
+VALUE rb_cCppVectorDbl3D;
+VALUE rb_cCppVectorFlt3D;
+VALUE rb_cAmpStore;
+VectorDbl2D __VectorDbl2D__;
+VectorFlt2D __VectorFlt2D__;
+VectorDbl3D __VectorDbl3D__;
+VectorFlt3D __VectorFlt3D__;
+AmpStore __AmpStore__;
+//_____________________________________________________________________________
@@ -6,34 +6,39 @@
 
 #include <vector>
 #include <complex>
+#include "pwa-core.h"
 #include "ruby-complex.h"
 
 using namespace std;
 
 //_____________________________________________________________________________
-typedef vector<vector<complex<double> > > VectorDbl2D;
-typedef vector<vector<complex<float> > >  VectorFlt2D;
-typedef vector<vector<vector<complex<double> > > > VectorDbl3D;
-typedef vector<vector<vector<complex<float> > > > VectorFlt3D;
-/* defined in cppvector.cpp */
+/* defined in pwa-src.cpp (linked into every extension) */
 extern VALUE rb_cPWA;
 extern VALUE rb_cCppVectorDbl2D;
 extern VALUE rb_cCppVectorFlt2D;
 extern VALUE rb_cCppVectorDbl3D;
 extern VALUE rb_cCppVectorFlt3D;
+extern VALUE rb_cAmpStore;
 extern VectorDbl2D __VectorDbl2D__;
 extern VectorFlt2D __VectorFlt2D__;
 extern VectorDbl3D __VectorDbl3D__;
 extern VectorFlt3D __VectorFlt3D__;
+extern AmpStore __AmpStore__;
 //_____________________________________________________________________________
 
-template <typename _Tp> _Tp* get_cpp_ptr(VALUE __ruby_obj,const _Tp &__dummy);
-
-complex<double> get_amp_total(const vector<complex<float> > &__amps,
-			      const vector<complex<double> > &__params);
-
+/// Obtains the C++ pointer from the Ruby object
+template <typename _Tp> _Tp* get_cpp_ptr(VALUE __ruby_obj,const _Tp &__dummy){
+  _Tp *ptr;
+  Data_Get_Struct(__ruby_obj,_Tp,ptr);
+  return ptr;
+}
+/* defined in set_params.cpp */
 VALUE rb_dataset_set_params(VALUE __self,VALUE __pars,VALUE __vars,
 			    VALUE __set_derivs);
+/// Sets @a d2params to the 2nd derivatives of the amp parameters of Dataset
+/// @a self (see Dataset#_param_d2s).
+void dataset_param_d2s(VALUE __self,VALUE __pars,VALUE __vars,
+		       vector<ParamD2> &__d2params);
 //_____________________________________________________________________________
 
 #endif /* _pwa_src_H */
@@ -7,18 +7,12 @@
 #include <iostream>
 #include <complex>
 #include "ruby.h"
+#include "pwa-core.h"
 
 #define RUBY_FUNC(f) ((VALUE (*)(...)) f)
 
 using namespace std;
 //_____________________________________________________________________________
-/// Provide multiplication b/t complex<float> and complex<double>.
-template <typename __U,typename __V> 
-complex<double> operator*(const complex<__U> &__c1,const complex<__V> &__c2){
-  double x1 = __c1.real(),x2 = __c2.real(),y1 = __c1.imag(),y2 = __c2.imag();
-  return complex<double>(x1*x2-y1*y2,x1*y2+y1*x2);
-}
-//_____________________________________________________________________________
 /// Create a Ruby Complex object from a C++ complex object.
 template<typename __Tp>
 VALUE rb_complex_new(const complex<__Tp> &__c){
@@ -29,13 +23,13 @@ VALUE rb_complex_new(const complex<__Tp> &__c){
 }
 //_____________________________________________________________________________
 /// Returns the real part of @a c
-VALUE rb_complex_real(VALUE __c){
+inline VALUE rb_complex_real(VALUE __c){
   static ID rb_id_real = rb_intern("real");  
   return rb_funcall(__c,rb_id_real,0);
 }
 //_____________________________________________________________________________
 /// Returns the imaginary part of @a c
-VALUE rb_complex_imag(VALUE __c){
+inline VALUE rb_complex_imag(VALUE __c){
   static ID rb_id_imag = rb_intern("imag");
   return rb_funcall(__c,rb_id_imag,0);
 }  
@@ -0,0 +1,321 @@
+// Author: Mike Williams
+//_____________________________________________________________________________
+#include "select.h"
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/// Events are selected in blocks of this many (each op is a loop over them)
+static const int SELECT_BLOCK = 512;
+/// Selection::Op codes
+enum {
+  PUSH_CONST,PUSH_VAR,NEG,NOT,ABS,SQRT,ADD,SUB,MUL,DIV,LT,LE,GT,GE,EQ,NE,AND,
+  OR
+};
+//_____________________________________________________________________________
+/// Parses a selection into a tree (recursive descent), see select.h.
+struct SelectParser {
+  /// A node of the tree (a is the 1st operand, b the 2nd)
+  struct Node {
+    int code;
+    double val;
+    int var;
+    int a,b;
+  };
+  const string &expr;
+  const vector<string> &kinvars;
+  size_t pos;       // of the next token
+  vector<Node> nodes;
+  string error;
+
+  SelectParser(const string &__expr,const vector<string> &__kinvars)
+    : expr(__expr),kinvars(__kinvars),pos(0) {}
+
+  /// Adds a node, returns its index
+  int node(int __code,int __a = -1,int __b = -1,double __val = 0.,
+	   int __var = -1){
+    Node n = {__code,__val,__var,__a,__b};
+    nodes.push_back(n);
+    return (int)nodes.size() - 1;
+  }
+  void skip_space(){
+    while(pos < expr.size() && isspace(expr[pos])) pos++;
+  }
+  /// If the next token is @a tok, skips it + returns true
+  bool accept(const char *__tok){
+    skip_space();
+    size_t len = string(__tok).size();
+    if(expr.compare(pos,len,__tok) != 0) return false;
+    // a word must not just be the start of a longer one
+    if(isalpha(__tok[0]) && pos + len < expr.size()
+       && (isalnum(expr[pos + len]) || expr[pos + len] == '_')) return false;
+    pos += len;
+    return true;
+  }
+  void fail(const string &__msg){
+    char where[64];
+    sprintf(where," (at position %d)",(int)pos);
+    if(error.empty()) error = __msg + where;
+    throw error;
+  }
+  /// Returns the index of kinvar @a name
+  int kinvar(const string &__name){
+    for(int kv = 0; kv < (int)kinvars.size(); kv++)
+      if(kinvars[kv] == __name) return kv;
+    fail("unknown kinvar '" + __name + "'");
+    return -1;
+  }
+  // expr := and ('||' and)*
+  int parse_or(){
+    int n = parse_and();
+    while(accept("||") || accept("or")) n = node(OR,n,parse_and());
+    return n;
+  }
+  // and := not ('&&' not)*
+  int parse_and(){
+    int n = parse_not();
+    while(accept("&&") || accept("and")) n = node(AND,n,parse_not());
+    return n;
+  }
+  // not := ('!' | 'not') not | cmp
+  int parse_not(){
+    if(accept("!") || accept("not")) return node(NOT,parse_not());
+    return parse_cmp();
+  }
+  /// Returns the comparison op next (or -1 if there isn't one)
+  int accept_cmp(){
+    if(accept("<=")) return LE;
+    if(accept(">=")) return GE;
+    if(accept("==")) return EQ;
+    if(accept("!=")) return NE;
+    if(accept("<")) return LT;
+    if(accept(">")) return GT;
+    return -1;
+  }
+  // cmp := sum (op sum)* (a chain is and-ed, a < b < c is a < b && b < c)
+  int parse_cmp(){
+    int n = parse_sum(),code,result = -1;
+    while((code = accept_cmp()) >= 0){
+      int rhs = parse_sum();
+      int cmp = node(code,n,rhs);
+      result = (result < 0) ? cmp : node(AND,result,cmp);
+      n = rhs;
+    }
+    return (result < 0) ? n : result;
+  }
+  // sum := prod (('+' | '-') prod)*
+  int parse_sum(){
+    int n = parse_prod();
+    while(true){
+      if(accept("+")) n = node(ADD,n,parse_prod());
+      else if(accept("-")) n = node(SUB,n,parse_prod());
+      else return n;
+    }
+  }
+  // prod := unary (('*' | '/') unary)*
+  int parse_prod(){
+    int n = parse_unary();
+    while(true){
+      if(accept("*")) n = node(MUL,n,parse_unary());
+      else if(accept("/")) n = node(DIV,n,parse_unary());
+      else return n;
+    }
+  }
+  // unary := '-' unary | '+' unary | primary
+  int parse_unary(){
+    if(accept("-")) return node(NEG,parse_unary());
+    if(accept("+")) return parse_unary();
+    return parse_primary();
+  }
+  // primary := number | kinvar | '[' name ']' | fcn '(' expr ')'
+  //          | '(' expr ')'
+  int parse_primary(){
+    skip_space();
+    if(pos >= expr.size()) fail("unexpected end");
+    char c = expr[pos];
+    if(isdigit(c) || (c == '.' && pos + 1 < expr.size()
+		      && isdigit(expr[pos + 1]))){
+      const char *start = expr.c_str() + pos;
+      char *end;
+      double val = strtod(start,&end);
+      pos += end - start;
+      return node(PUSH_CONST,-1,-1,val);
+    }
+    if(accept("(")){
+      int n = parse_or();
+      if(!accept(")")) fail("expected ')'");
+      return n;
+    }
+    if(c == '['){
+      size_t end = expr.find(']',pos);
+      if(end == string::npos) fail("expected ']'");
+      string name = expr.substr(pos + 1,end - pos - 1);
+      int var = kinvar(name);
+      pos = end + 1;
+      return node(PUSH_VAR,-1,-1,0.,var);
+    }
+    if(isalpha(c) || c == '_'){
+      size_t end = pos;
+      while(end < expr.size() && (isalnum(expr[end]) || expr[end] == '_'))
+	end++;
+      string name = expr.substr(pos,end - pos);
+      int fcn = -1;
+      if(name == "abs") fcn = ABS;
+      else if(name == "sqrt") fcn = SQRT;
+      if(fcn >= 0){
+	pos = end;
+	if(!accept("(")) fail("expected '(' after " + name);
+	int n = node(fcn,parse_or());
+	if(!accept(")")) fail("expected ')'");
+	return n;
+      }
+      int var = kinvar(name);
+      pos = end;
+      return node(PUSH_VAR,-1,-1,0.,var);
+    }
+    fail(string("syntax error at '") + c + "'");
+    return -1;
+  }
+  /// Appends the program for node @a n to @a sel, returns the stack depth
+  /// it needs
+  int emit(int __n,Selection &__sel) const {
+    const Node &n = nodes[__n];
+    int depth = 1;
+    if(n.a >= 0) depth = emit(n.a,__sel);
+    if(n.b >= 0) depth = max(depth,emit(n.b,__sel) + 1);
+    Selection::Op op = {n.code,n.val,n.var};
+    __sel.prog.push_back(op);
+    if(n.code == PUSH_VAR
+       && find(__sel.vars.begin(),__sel.vars.end(),n.var) == __sel.vars.end())
+      __sel.vars.push_back(n.var);
+    return depth;
+  }
+};
+//_____________________________________________________________________________
+bool Selection::compile(const string &__expr,const vector<string> &__kinvars,
+			string &__error){
+  SelectParser parser(__expr,__kinvars);
+  prog.clear();
+  vars.clear();
+  num_kv = (int)__kinvars.size();
+  try {
+    int root = parser.parse_or();
+    parser.skip_space();
+    if(parser.pos != __expr.size()) parser.fail("syntax error");
+    max_depth = parser.emit(root,*this);
+  }
+  catch(const string &__msg){
+    __error = __msg;
+    prog.clear();
+    return false;
+  }
+  return true;
+}
+//_____________________________________________________________________________
+void Selection::eval(const double *__kv,int __num,char *__pass) const {
+  vector<double> stack(max(max_depth,1)*SELECT_BLOCK);
+  double *base = &stack[0];
+  int num_ops = (int)prog.size();
+  for(int start = 0; start < __num; start += SELECT_BLOCK){
+    int num = min(SELECT_BLOCK,__num - start);
+    int sp = 0; // number of entries on the stack
+    for(int o = 0; o < num_ops; o++){
+      const Op &op = prog[o];
+      if(op.code == PUSH_CONST || op.code == PUSH_VAR) sp++;
+      else if(op.code >= ADD) sp--; // (2 operands, the result replaces x)
+      double *x = base + (sp - 1)*SELECT_BLOCK; // top of the stack
+      double *y = x + SELECT_BLOCK;             // 2nd operand (if any)
+      switch(op.code){
+      case PUSH_CONST:
+	for(int i = 0; i < num; i++) x[i] = op.val;
+	break;
+      case PUSH_VAR:{
+	const double *kv = __kv + (size_t)start*num_kv + op.var;
+	for(int i = 0; i < num; i++) x[i] = kv[(size_t)i*num_kv];
+	break;
+      }
+      case NEG: for(int i = 0; i < num; i++) x[i] = -x[i]; break;
+      case NOT: for(int i = 0; i < num; i++) x[i] = (x[i] == 0.); break;
+      case ABS: for(int i = 0; i < num; i++) x[i] = fabs(x[i]); break;
+      case SQRT: for(int i = 0; i < num; i++) x[i] = sqrt(x[i]); break;
+      case ADD: for(int i = 0; i < num; i++) x[i] += y[i]; break;
+      case SUB: for(int i = 0; i < num; i++) x[i] -= y[i]; break;
+      case MUL: for(int i = 0; i < num; i++) x[i] *= y[i]; break;
+      case DIV: for(int i = 0; i < num; i++) x[i] /= y[i]; break;
+      case LT: for(int i = 0; i < num; i++) x[i] = (x[i] < y[i]); break;
+      case LE: for(int i = 0; i < num; i++) x[i] = (x[i] <= y[i]); break;
+      case GT: for(int i = 0; i < num; i++) x[i] = (x[i] > y[i]); break;
+      case GE: for(int i = 0; i < num; i++) x[i] = (x[i] >= y[i]); break;
+      case EQ: for(int i = 0; i < num; i++) x[i] = (x[i] == y[i]); break;
+      case NE: for(int i = 0; i < num; i++) x[i] = (x[i] != y[i]); break;
+      case AND:
+	for(int i = 0; i < num; i++) x[i] = (x[i] != 0. && y[i] != 0.);
+	break;
+      case OR:
+	for(int i = 0; i < num; i++) x[i] = (x[i] != 0. || y[i] != 0.);
+	break;
+      }
+    }
+    const double *result = &stack[0];
+    for(int i = 0; i < num; i++) __pass[start + i] = (result[i] != 0.);
+  }
+}
+//_____________________________________________________________________________
+bool KinvarData::open(const char *__file,int __num_kv){
+  this->close();
+  int fd = ::open(__file,O_RDONLY);
+  if(fd < 0 || __num_kv <= 0){
+    if(fd >= 0) ::close(fd);
+    return false;
+  }
+  struct stat st;
+  if(fstat(fd,&st) != 0){
+    ::close(fd);
+    return false;
+  }
+  num_kv = __num_kv;
+  num_events = (int)(st.st_size/(num_kv*sizeof(double)));
+  if(st.st_size > 0){
+    void *ptr = mmap(0,st.st_size,PROT_READ,MAP_SHARED,fd,0);
+    if(ptr == MAP_FAILED){
+      ::close(fd);
+      num_kv = num_events = 0;
+      return false;
+    }
+    madvise(ptr,st.st_size,MADV_SEQUENTIAL);
+    vals = (const double*)ptr;
+    size = st.st_size;
+  }
+  ::close(fd); // (the mapping stays)
+  return true;
+}
+//_____________________________________________________________________________
+void KinvarData::close(){
+  if(vals != 0) munmap((void*)vals,size);
+  vals = 0;
+  num_kv = num_events = 0;
+  size = 0;
+}
+//_____________________________________________________________________________
+int select_events(const Selection &__sel,const KinvarData &__kv,
+		  const vector<double> *__cuts,vector<double> &__cuts_out){
+  int num_events = __kv.num_events,num_cuts = 0,num_pass = 0;
+  if(__cuts != 0) num_cuts = (int)__cuts->size();
+  vector<char> pass(num_events);
+  if(num_events > 0) __sel.eval(__kv.vals,num_events,&pass[0]);
+  __cuts_out.resize(num_events);
+  for(int ev = 0; ev < num_events; ev++){
+    double cut = 1.;
+    if(__cuts != 0) cut = (ev < num_cuts) ? (*__cuts)[ev] : -1.;
+    __cuts_out[ev] = pass[ev] ? cut : -1.;
+    if(__cuts_out[ev] > 0) num_pass++;
+  }
+  return num_pass;
+}
+//_____________________________________________________________________________
@@ -0,0 +1,73 @@
+// -*- C++ -*-
+// Author: Mike Williams
+//_____________________________________________________________________________
+#ifndef _select_H
+#define _select_H
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+using namespace std;
+/*
+ * Event selection expressions over kinematic variables, compiled + run over
+ * the (mmapped) binary kinvar file in blocks of events. The language:
+ *
+ *   kinvars:     mass, [mass], [any name] (the brackets allow any chars)
+ *   numbers:     1, -2.5, 1e-3
+ *   arithmetic:  + - * / (and unary -), abs(x), sqrt(x)
+ *   comparisons: < <= > >= == != (chained ones are ranges, ie
+ *                0.5 < [mass] <= 1.2 is 0.5 < [mass] && [mass] <= 1.2)
+ *   boolean:     && || ! (or and, or, not), true is non-zero
+ *
+ * The result selects events (the same conditions Evt#histo_bins used to
+ * eval in Ruby for every event).
+ */
+//_____________________________________________________________________________
+/// A compiled selection expression.
+struct Selection {
+  /// 1 instruction of the (stack based) program
+  struct Op {
+    int code;
+    double val; // constant (PUSH_CONST)
+    int var;    // kinvar index (PUSH_VAR)
+  };
+  vector<Op> prog;
+  vector<int> vars;   // kinvar indicies used
+  int max_depth;      // stack size needed
+  int num_kv;         // number of kinvars per event
+
+  Selection() : max_depth(0),num_kv(0) {}
+
+  /// Compiles @a expr w/ kinvars named @a kinvars (in file order). Returns
+  /// false (and sets @a error) if it's not valid.
+  bool compile(const string &__expr,const vector<string> &__kinvars,
+	       string &__error);
+  /// Sets pass[i] to 1 if event i (of @a num) passes (else 0). @a kv holds
+  /// num_kv values for each event.
+  void eval(const double *__kv,int __num,char *__pass) const;
+};
+//_____________________________________________________________________________
+/// A binary kinvar file (doubles, num_kv per event), mmapped.
+struct KinvarData {
+  const double *vals;
+  int num_kv;
+  int num_events;
+  size_t size; // of the mapping
+
+  KinvarData() : vals(0),num_kv(0),num_events(0),size(0) {}
+  ~KinvarData(){this->close();}
+  /// Maps @a file w/ @a num_kv kinvars per event. Returns false if it can't.
+  bool open(const char *__file,int __num_kv);
+  void close();
+};
+//_____________________________________________________________________________
+/// Sets @a cuts_out[ev] for each event in @a kv to @a cuts[ev] (1 if @a cuts
+/// is 0) if it passes @a sel, else to -1 (which both read_amps_file and
+/// norm_int_sums reject). Events w/o a cut value are rejected. Returns the
+/// number which pass.
+int select_events(const Selection &__sel,const KinvarData &__kv,
+		  const vector<double> *__cuts,vector<double> &__cuts_out);
+//_____________________________________________________________________________
+
+#endif /* _select_H */
@@ -0,0 +1,89 @@
+// Author: Mike Williams
+//_____________________________________________________________________________
+#include "ruby-complex.h"
+#include "pwa-src.h"
+#include "select.h"
+#include <cstdio>
+
+VALUE rb_cSelection;
+//_____________________________________________________________________________
+/// Tell Ruby to use this function when garbage collecting Selection
+void selection_free(void *__ptr){
+  delete (Selection*)__ptr;
+}
+//_____________________________________________________________________________
+/* call-seq: new(expr,kinvars) -> Selection
+ *
+ * Compiles selection expression _expr_ (see select.h for the language) over
+ * the kinematic variables named in Array _kinvars_ (in the order they're
+ * stored in the binary kinvar file). Raises ArgumentError if _expr_ isn't
+ * valid.
+ */
+VALUE rb_selection_new(VALUE __class,VALUE __expr,VALUE __kinvars){
+  Selection *sel = new Selection();
+  char error[256] = "";
+  { // (rb_raise doesn't run destructors, so these must be gone 1st)
+    int num_kv = RARRAY(__kinvars)->len;
+    vector<string> kinvars(num_kv);
+    for(int kv = 0; kv < num_kv; kv++)
+      kinvars[kv] = STR2CSTR(rb_ary_entry(__kinvars,kv));
+    string msg;
+    if(!sel->compile(STR2CSTR(__expr),kinvars,msg))
+      snprintf(error,sizeof(error),"%s",msg.c_str());
+  }
+  if(error[0] != 0){
+    delete sel;
+    rb_raise(rb_eArgError,"bad selection '%s': %s",STR2CSTR(__expr),error);
+  }
+  return Data_Wrap_Struct(__class,0,selection_free,sel);
+}
+//_____________________________________________________________________________
+/* call-seq: apply(data_file,cuts) -> Array
+ *
+ * Runs over binary kinvar file _data_file_ and returns a cuts Array w/ an
+ * entry for each event in it: its entry in _cuts_ (1 if _cuts_ is
+ * <tt>nil</tt>) if it passes, else -1 (rejected by both amps reading and
+ * norm-int generation).
+ */
+VALUE rb_selection_apply(VALUE __self,VALUE __data_file,VALUE __cuts){
+  Selection *sel;
+  Data_Get_Struct(__self,Selection,sel);
+  KinvarData kv;
+  if(!kv.open(STR2CSTR(__data_file),sel->num_kv))
+    rb_raise(rb_eIOError,"can't read kinvar file %s",STR2CSTR(__data_file));
+  vector<double> cuts,cuts_out;
+  if(__cuts != Qnil){
+    int num_cuts = RARRAY(__cuts)->len;
+    cuts.resize(num_cuts);
+    for(int ev = 0; ev < num_cuts; ev++)
+      cuts[ev] = NUM2DBL(rb_ary_entry(__cuts,ev));
+  }
+  select_events(*sel,kv,__cuts == Qnil ? 0 : &cuts,cuts_out);
+  int num_events = (int)cuts_out.size();
+  VALUE ary = rb_ary_new2(num_events);
+  for(int ev = 0; ev < num_events; ev++)
+    rb_ary_store(ary,ev,rb_float_new(cuts_out[ev]));
+  return ary;
+}
+//_____________________________________________________________________________
+/* call-seq: num_ops -> Fixnum
+ *
+ * Number of instructions the expression compiled to.
+ */
+VALUE rb_selection_num_ops(VALUE __self){
+  Selection *sel;
+  Data_Get_Struct(__self,Selection,sel);
+  return INT2NUM((int)sel->prog.size());
+}
+//_____________________________________________________________________________
+
+extern "C" void Init_selection(){
+  //-+-RDOC-+-
+  rb_cPWA = rb_define_module("PWA");
+  rb_cSelection = rb_define_class_under(rb_cPWA,"Selection",rb_cObject);
+  rb_define_singleton_method(rb_cSelection,"new",RUBY_FUNC(rb_selection_new),
+			     2);
+  rb_define_method(rb_cSelection,"apply",RUBY_FUNC(rb_selection_apply),2);
+  rb_define_method(rb_cSelection,"num_ops",RUBY_FUNC(rb_selection_num_ops),0);
+}
+//_____________________________________________________________________________
@@ -0,0 +1,74 @@
+// Author: Mike Williams
+//_____________________________________________________________________________
+/*
+ * Dataset#_set_params (+ the 2nd derivatives the Hessians use), split out
+ * of dataset.cpp (compiled on its own, see the Makefile). The Dcs kernels
+ * fill their own per-vars table instead (see dcs.cpp).
+ */
+#include "ruby-complex.h"
+#include "pwa-src.h"
+//_____________________________________________________________________________
+/* call-seq: _set_params(pars,vars,set_derivs)
+ *
+ * Sets <tt>@params</tt> using MINUIT parameters _pars_ and kinematic
+ * variables _vars_ (if <tt>:dcs</tt>). If _set_derivs_ is <tt>true</tt>, then
+ * <tt>@dparams</tt> is set also. _set_derivs_ can also be MINUIT's derivs 
+ * Array, then only the derivatives w/r to parameters w/ non-<tt>nil</tt> 
+ * entries in it are calculated (the rest are set to 0).
+ */
+VALUE rb_dataset_set_params(VALUE __self,VALUE __pars,VALUE __vars,
+			    VALUE __set_derivs){
+  static ID set_pars_id = rb_intern("set_pars");
+  static ID value_id = rb_intern("value");
+  static ID deriv_id = rb_intern("deriv");
+  VALUE amps = rb_iv_get(__self,"@amps"); 
+  VectorDbl2D *params 
+    = get_cpp_ptr(rb_iv_get(__self,"@params"),__VectorDbl2D__);
+  VectorDbl3D *dparams 
+    = get_cpp_ptr(rb_iv_get(__self,"@dparams"),__VectorDbl3D__);
+  int num_ic = RARRAY(amps)->len,num_pars = RARRAY(__pars)->len;
+  VALUE wanted = (TYPE(__set_derivs) == T_ARRAY) ? __set_derivs : Qnil;
+  for(int ic = 0; ic < num_ic; ic++){ // loop over incoherent wavesets
+    VALUE ic_amps = rb_ary_entry(amps,ic);
+    int num_amps = RARRAY(ic_amps)->len;
+    for(int a = 0; a < num_amps; a++){ // loop over amps in this waveset
+      VALUE amp = rb_ary_entry(ic_amps,a); // current amp
+      if(rb_iv_get(amp,"@use") == Qfalse){
+	(*params)[ic][a] = 0.0;
+	for(int par = 0; par < num_pars; par++) (*dparams)[ic][a][par] = 0.;
+	continue;
+      }
+      rb_funcall(amp,set_pars_id,1,__pars); // call Amp#set_pars on it
+      (*params)[ic][a] = CPP_COMPLEX(float,rb_funcall(amp,value_id,1,__vars));
+      if(__set_derivs == Qfalse) continue;
+      for(int par = 0; par < num_pars; par++){ // loop over parameters
+	if(rb_ary_entry(__pars,par) == Qnil) continue; // amp doesn't use par
+	if(wanted != Qnil && rb_ary_entry(wanted,par) == Qnil){ // fixed
+	  (*dparams)[ic][a][par] = 0.;
+	  continue;
+	}
+	(*dparams)[ic][a][par] 
+	  = CPP_COMPLEX(double,rb_funcall(amp,deriv_id,2,INT2NUM(par),__vars));
+      }
+    }
+  }
+  return __self;
+}
+//_____________________________________________________________________________
+void dataset_param_d2s(VALUE __self,VALUE __pars,VALUE __vars,
+		       vector<ParamD2> &__d2params){
+  static ID param_d2s_id = rb_intern("_param_d2s");
+  VALUE d2s = rb_funcall(__self,param_d2s_id,2,__pars,__vars);
+  int num_d2s = RARRAY(d2s)->len;
+  __d2params.resize(num_d2s);
+  for(int d = 0; d < num_d2s; d++){ // [ic,a,p,q,d2]
+    VALUE d2 = rb_ary_entry(d2s,d);
+    ParamD2 &param_d2 = __d2params[d];
+    param_d2.ic = NUM2INT(rb_ary_entry(d2,0));
+    param_d2.a = NUM2INT(rb_ary_entry(d2,1));
+    param_d2.p = NUM2INT(rb_ary_entry(d2,2));
+    param_d2.q = NUM2INT(rb_ary_entry(d2,3));
+    param_d2.val = CPP_COMPLEX(double,rb_ary_entry(d2,4));
+  }
+}
+//_____________________________________________________________________________
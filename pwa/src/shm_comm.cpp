@@ -0,0 +1,480 @@
+// Author: Mike Williams
+//_____________________________________________________________________________
+#include "ruby-complex.h"
+#include "pwa-src.h"
+#include "timers.h"
+#include <cerrno>
+#include <poll.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+VALUE rb_cShmComm;
+//_____________________________________________________________________________
+/// Used to wake up a waiting process (an eventfd on Linux, else a pipe).
+struct ShmSignal {
+  int rfd,wfd;
+};
+/// Opens @a sig, returns false on failure
+bool shm_signal_open(ShmSignal &__sig){
+#ifdef __linux__
+  __sig.rfd = __sig.wfd = eventfd(0,0);
+  return (__sig.rfd >= 0);
+#else
+  int fds[2];
+  if(pipe(fds) != 0) return false;
+  __sig.rfd = fds[0];
+  __sig.wfd = fds[1];
+  return true;
+#endif
+}
+/// Closes @a sig
+void shm_signal_close(ShmSignal &__sig){
+  close(__sig.rfd);
+  if(__sig.wfd != __sig.rfd) close(__sig.wfd);
+}
+/// Posts to @a sig (wakes up whoever is waiting on it)
+void shm_signal_post(ShmSignal &__sig){
+#ifdef __linux__
+  uint64_t one = 1;
+  while(write(__sig.wfd,&one,sizeof(one)) < 0 && errno == EINTR);
+#else
+  char one = 1;
+  while(write(__sig.wfd,&one,sizeof(one)) < 0 && errno == EINTR);
+#endif
+}
+/// Waits at most @a timeout ms (-1 for ever) on @a sig. Returns the number of
+/// posts consumed (0 if timed out).
+int shm_signal_wait(ShmSignal &__sig,int __timeout){
+  struct pollfd pfd;
+  pfd.fd = __sig.rfd;
+  pfd.events = POLLIN;
+  if(poll(&pfd,1,__timeout) <= 0) return 0;
+#ifdef __linux__
+  uint64_t count = 0;
+  if(read(__sig.rfd,&count,sizeof(count)) != sizeof(count)) return 0;
+  return (int)count;
+#else
+  char buf[64];
+  ssize_t num_read = read(__sig.rfd,buf,sizeof(buf));
+  return num_read > 0 ? (int)num_read : 0;
+#endif
+}
+//_____________________________________________________________________________
+/// What the workers are told to do
+enum ShmCommand {SHM_FCN,SHM_REBALANCE,SHM_EXIT};
+/// Header at the start of the shared memory segment.
+struct ShmHeader {
+  int flag;       // MINUIT flag for the current call
+  int command;    // ShmCommand
+  int num_pars;   // length of the MINUIT parameter array
+  int num_scales; // length of the rebalance scales array
+};
+/// Shared memory segment + signals used by the master and forked workers. 
+/// The segment holds the header, the MINUIT parameters (+ which of them and 
+/// of the derivatives MINUIT wants are nil), the rebalance scales and 1 slot
+/// per worker w/ its fcn value, the time it spent on the call and its 
+/// derivatives, then 1 max_pars x max_pars Hessian slot per worker (only 
+/// touched, so only given pages, if Fcn#hessian is used). Each piece starts
+/// on its own cache line. Every command the 
+/// master posts is answered (on done) before it posts the next one, so the 
+/// workers never see 2 at once.
+struct ShmComm {
+  int num_workers;
+  int max_pars;
+  int max_scales;
+  char *mem;
+  size_t mem_size;
+  size_t pars_offset,nil_offset,dnil_offset,scales_offset,slots_offset;
+  size_t slot_size,hess_offset,hess_size;
+  ShmSignal done;        // posted by workers when they finish a command
+  vector<ShmSignal> go;  // posted by the master to start a worker
+  vector<pid_t> pids;    // worker process ids (master only)
+  pid_t master_pid;      // process id of the master
+  double call_start;     // when this worker got the current call
+
+  ShmHeader* header() {return (ShmHeader*)mem;}
+  double* pars() {return (double*)(mem + pars_offset);}
+  char* pars_nil() {return mem + nil_offset;}
+  char* derivs_nil() {return mem + dnil_offset;}
+  double* scales() {return (double*)(mem + scales_offset);}
+  double* slot(int __rank) {
+    return (double*)(mem + slots_offset + (__rank - 1)*slot_size);
+  }
+  double* hess(int __rank) {
+    return (double*)(mem + hess_offset + (__rank - 1)*hess_size);
+  }
+};
+/// Rounds @a size up to a whole number of cache lines
+size_t shm_align(size_t __size){return ((__size + 63)/64)*64;}
+//_____________________________________________________________________________
+/// Tell Ruby to use this function when garbage collecting ShmComm
+void shmcomm_free(void *__ptr){
+  ShmComm *comm = (ShmComm*)__ptr;
+  if(comm->mem != 0) munmap(comm->mem,comm->mem_size);
+  shm_signal_close(comm->done);
+  for(int w = 0; w < comm->num_workers; w++) shm_signal_close(comm->go[w]);
+  delete comm;
+}
+//_____________________________________________________________________________
+/* call-seq: new(num_workers,max_pars,max_scales) -> ShmComm
+ *
+ * Creates the shared memory segment and signals for _num_workers_ workers,
+ * MINUIT parameter Arrays of length up to _max_pars_ and rebalance scale 
+ * Arrays of length up to _max_scales_. Must be called before forking the 
+ * workers.
+ */
+VALUE rb_shmcomm_new(VALUE __class,VALUE __num_workers,VALUE __max_pars,
+		     VALUE __max_scales){
+  ShmComm *comm = new ShmComm();
+  comm->num_workers = NUM2INT(__num_workers);
+  comm->max_pars = NUM2INT(__max_pars);
+  comm->max_scales = NUM2INT(__max_scales);
+  comm->master_pid = getpid();
+  comm->call_start = 0.;
+  comm->pars_offset = shm_align(sizeof(ShmHeader));
+  comm->nil_offset 
+    = comm->pars_offset + shm_align(comm->max_pars*sizeof(double));
+  comm->dnil_offset = comm->nil_offset + shm_align(comm->max_pars);
+  comm->scales_offset = comm->dnil_offset + shm_align(comm->max_pars);
+  comm->slots_offset 
+    = comm->scales_offset + shm_align(comm->max_scales*sizeof(double));
+  comm->slot_size = shm_align((comm->max_pars + 2)*sizeof(double));
+  comm->hess_offset = comm->slots_offset + comm->num_workers*comm->slot_size;
+  comm->hess_size 
+    = shm_align((size_t)comm->max_pars*comm->max_pars*sizeof(double));
+  comm->mem_size = comm->hess_offset + comm->num_workers*comm->hess_size;
+  void *mem = mmap(0,comm->mem_size,PROT_READ|PROT_WRITE,
+		   MAP_SHARED|MAP_ANON,-1,0);
+  if(mem == MAP_FAILED){
+    delete comm;
+    rb_sys_fail("mmap");
+  }
+  comm->mem = (char*)mem;
+  memset(comm->mem,0,comm->hess_offset); // (MAP_ANON is 0 anyways)
+  comm->go.resize(comm->num_workers);
+  int num_open = -1; // signals opened (done, then go[0...num_open - 1])
+  if(shm_signal_open(comm->done)){
+    for(num_open = 0; num_open < comm->num_workers; num_open++)
+      if(!shm_signal_open(comm->go[num_open])) break;
+  }
+  if(num_open < comm->num_workers){ // (rb_sys_fail doesn't return)
+    int err = errno;
+    if(num_open >= 0) shm_signal_close(comm->done);
+    for(int w = 0; w < num_open; w++) shm_signal_close(comm->go[w]);
+    munmap(comm->mem,comm->mem_size);
+    delete comm;
+    errno = err;
+    rb_sys_fail("eventfd");
+  }
+  return Data_Wrap_Struct(__class,0,shmcomm_free,comm);
+}
+//_____________________________________________________________________________
+/* call-seq: watch(pids) -> self
+ *
+ * Sets the process ids of the workers (ordered by rank). If one of them dies,
+ * _gather_ raises instead of waiting for ever.
+ */
+VALUE rb_shmcomm_watch(VALUE __self,VALUE __pids){
+  ShmComm *comm;
+  Data_Get_Struct(__self,ShmComm,comm);
+  comm->pids.resize(RARRAY(__pids)->len);
+  for(int w = 0; w < (int)comm->pids.size(); w++) 
+    comm->pids[w] = (pid_t)NUM2INT(rb_ary_entry(__pids,w));
+  return __self;
+}
+//_____________________________________________________________________________
+/* call-seq: broadcast(flag,pars,derivs) -> self
+ *
+ * Copies MINUIT _flag_ and parameters _pars_ (+ which _derivs_ are nil, ie.
+ * not wanted) into shared memory and wakes up all workers.
+ */
+VALUE rb_shmcomm_broadcast(VALUE __self,VALUE __flag,VALUE __pars,
+			   VALUE __derivs){
+  ShmComm *comm;
+  Data_Get_Struct(__self,ShmComm,comm);
+  int num_pars = RARRAY(__pars)->len; // length of MINUIT parameter array
+  if(num_pars > comm->max_pars) 
+    rb_raise(rb_eArgError,"too many parameters (%d > %d)",num_pars,
+	     comm->max_pars);
+  double *pars = comm->pars();
+  char *pars_nil = comm->pars_nil();
+  char *derivs_nil = comm->derivs_nil();
+  for(int p = 0; p < num_pars; p++){
+    VALUE par = rb_ary_entry(__pars,p);
+    pars_nil[p] = (par == Qnil) ? 1 : 0;
+    pars[p] = (par == Qnil) ? 0. : NUM2DBL(par);
+    derivs_nil[p] = (rb_ary_entry(__derivs,p) == Qnil) ? 1 : 0;
+  }
+  comm->header()->flag = NUM2INT(__flag);
+  comm->header()->command = SHM_FCN;
+  comm->header()->num_pars = num_pars;
+  for(int w = 0; w < comm->num_workers; w++) shm_signal_post(comm->go[w]);
+  return __self;
+}
+//_____________________________________________________________________________
+/// Waits for every worker to post done (raises if one of them dies)
+void shmcomm_wait_done(ShmComm *__comm){
+  int num_done = 0;
+  while(num_done < __comm->num_workers){
+    int num = shm_signal_wait(__comm->done,1000);
+    num_done += num;
+    if(num > 0) continue;
+    for(int w = 0; w < (int)__comm->pids.size(); w++){ // make sure all alive
+      int status;
+      if(waitpid(__comm->pids[w],&status,WNOHANG) == __comm->pids[w])
+	rb_raise(rb_eRuntimeError,"worker %d (pid %d) died",w + 1,
+		 (int)__comm->pids[w]);
+    }
+  }
+}
+//_____________________________________________________________________________
+/* call-seq: gather(derivs) -> fcn_val
+ *
+ * Waits for all workers to finish the current call. Returns the sum of their
+ * fcn values, if the call's flag is 2 their derivatives are also added to 
+ * (non-<tt>nil</tt> entries of) _derivs_.
+ */
+VALUE rb_shmcomm_gather(VALUE __self,VALUE __derivs){
+  ShmComm *comm;
+  Data_Get_Struct(__self,ShmComm,comm);
+  shmcomm_wait_done(comm);
+  int num_pars = comm->header()->num_pars;
+  double fcn_val = 0.;
+  vector<double> derivs(num_pars,0.);
+  for(int rank = 1; rank <= comm->num_workers; rank++){
+    double *slot = comm->slot(rank);
+    fcn_val += slot[0];
+    for(int p = 0; p < num_pars; p++) derivs[p] += slot[p + 2];
+  }
+  if(comm->header()->flag == 2){
+    for(int p = 0; p < num_pars; p++){
+      VALUE deriv = rb_ary_entry(__derivs,p);
+      if(deriv == Qnil) continue;
+      rb_ary_store(__derivs,p,rb_float_new(NUM2DBL(deriv) + derivs[p]));
+    }
+  }
+  return rb_float_new(fcn_val);
+}
+//_____________________________________________________________________________
+/* call-seq: gather_hessian(hess) -> hess
+ *
+ * Waits for the workers to finish a Hessian call (see Fcn#hessian) and adds 
+ * theirs to _hess_ (an Array of Arrays, num_pars x num_pars).
+ */
+VALUE rb_shmcomm_gather_hessian(VALUE __self,VALUE __hess){
+  ShmComm *comm;
+  Data_Get_Struct(__self,ShmComm,comm);
+  shmcomm_wait_done(comm);
+  int num_pars = comm->header()->num_pars;
+  vector<double> hess(num_pars*num_pars,0.);
+  for(int rank = 1; rank <= comm->num_workers; rank++){
+    const double *worker_hess = comm->hess(rank);
+    for(int k = 0; k < num_pars*num_pars; k++) hess[k] += worker_hess[k];
+  }
+  for(int p = 0; p < num_pars; p++){
+    VALUE row = rb_ary_entry(__hess,p);
+    for(int q = 0; q < num_pars; q++){
+      double h = NUM2DBL(rb_ary_entry(row,q)) + hess[p*num_pars + q];
+      rb_ary_store(row,q,rb_float_new(h));
+    }
+  }
+  return __hess;
+}
+//_____________________________________________________________________________
+/* call-seq: terminate -> self
+ *
+ * Tells all workers to exit.
+ */
+VALUE rb_shmcomm_terminate(VALUE __self){
+  ShmComm *comm;
+  Data_Get_Struct(__self,ShmComm,comm);
+  comm->header()->command = SHM_EXIT;
+  for(int w = 0; w < comm->num_workers; w++) shm_signal_post(comm->go[w]);
+  return __self;
+}
+//_____________________________________________________________________________
+/* call-seq: node_times -> Array
+ *
+ * Returns the time (in seconds) each worker spent on the last call, from 
+ * getting it to replying (call after _gather_).
+ */
+VALUE rb_shmcomm_node_times(VALUE __self){
+  ShmComm *comm;
+  Data_Get_Struct(__self,ShmComm,comm);
+  VALUE times = rb_ary_new2(comm->num_workers);
+  for(int rank = 1; rank <= comm->num_workers; rank++)
+    rb_ary_store(times,rank - 1,rb_float_new(comm->slot(rank)[1]));
+  return times;
+}
+//_____________________________________________________________________________
+/* call-seq: rebalance(scales) -> self
+ *
+ * Tells all workers to divide up the Datasets again using the per-Dataset 
+ * cost _scales_ (see PWA::Parallel.divide_datasets). The scales have their
+ * own region of shared memory. _wait_rebalanced_ must be called before the 
+ * next broadcast.
+ */
+VALUE rb_shmcomm_rebalance(VALUE __self,VALUE __scales){
+  ShmComm *comm;
+  Data_Get_Struct(__self,ShmComm,comm);
+  int num_scales = RARRAY(__scales)->len;
+  if(num_scales > comm->max_scales) 
+    rb_raise(rb_eArgError,"too many scales (%d > %d)",num_scales,
+	     comm->max_scales);
+  double *scales = comm->scales();
+  for(int d = 0; d < num_scales; d++)
+    scales[d] = NUM2DBL(rb_ary_entry(__scales,d));
+  comm->header()->command = SHM_REBALANCE;
+  comm->header()->num_scales = num_scales;
+  for(int w = 0; w < comm->num_workers; w++) shm_signal_post(comm->go[w]);
+  return __self;
+}
+/* call-seq: wait_rebalanced -> self
+ *
+ * Waits for all workers to finish dividing up the Datasets again (see 
+ * _rebalance_, raises if one of them died).
+ */
+VALUE rb_shmcomm_wait_rebalanced(VALUE __self){
+  ShmComm *comm;
+  Data_Get_Struct(__self,ShmComm,comm);
+  shmcomm_wait_done(comm);
+  return __self;
+}
+/* call-seq: rebalanced(rank) -> self
+ *
+ * Called by worker _rank_ once it has divided up the Datasets again.
+ */
+VALUE rb_shmcomm_rebalanced(VALUE __self,VALUE __rank){
+  ShmComm *comm;
+  Data_Get_Struct(__self,ShmComm,comm);
+  int rank = NUM2INT(__rank);
+  if(rank < 1 || rank > comm->num_workers) 
+    rb_raise(rb_eArgError,"invalid worker rank %d",rank);
+  shm_signal_post(comm->done);
+  return __self;
+}
+//_____________________________________________________________________________
+/* call-seq: wait_for_call(rank) -> [flag,pars,derivs]
+ *
+ * Called by worker _rank_ (1,2,...) to wait for the next broadcast. Returns 
+ * the MINUIT flag, parameters and derivatives (0 where the master's are
+ * non-nil, <tt>nil</tt> elsewhere), <tt>[:rebalance,scales]</tt> if the 
+ * Datasets are to be divided up again (see _rebalance_, reply w/ 
+ * _rebalanced_) or <tt>nil</tt> if it should exit (which is also the case if
+ * the master has gone away).
+ */
+VALUE rb_shmcomm_wait_for_call(VALUE __self,VALUE __rank){
+  ShmComm *comm;
+  Data_Get_Struct(__self,ShmComm,comm);
+  int rank = NUM2INT(__rank);
+  if(rank < 1 || rank > comm->num_workers) 
+    rb_raise(rb_eArgError,"invalid worker rank %d",rank);
+  while(shm_signal_wait(comm->go[rank - 1],1000) == 0){
+    if(getppid() != comm->master_pid) return Qnil;
+  }
+  if(comm->header()->command == SHM_EXIT) return Qnil;
+  VALUE call = rb_ary_new2(3);
+  if(comm->header()->command == SHM_REBALANCE){
+    int num_scales = comm->header()->num_scales;
+    VALUE rb_scales = rb_ary_new2(num_scales);
+    for(int d = 0; d < num_scales; d++)
+      rb_ary_store(rb_scales,d,rb_float_new(comm->scales()[d]));
+    rb_ary_store(call,0,ID2SYM(rb_intern("rebalance")));
+    rb_ary_store(call,1,rb_scales);
+    return call;
+  }
+  comm->call_start = wall_time();
+  int num_pars = comm->header()->num_pars;
+  double *pars = comm->pars();
+  char *pars_nil = comm->pars_nil();
+  char *derivs_nil = comm->derivs_nil();
+  VALUE rb_pars = rb_ary_new2(num_pars);
+  VALUE rb_derivs = rb_ary_new2(num_pars);
+  for(int p = 0; p < num_pars; p++){
+    if(pars_nil[p]) rb_ary_store(rb_pars,p,Qnil);
+    else rb_ary_store(rb_pars,p,rb_float_new(pars[p]));
+    rb_ary_store(rb_derivs,p,derivs_nil[p] ? Qnil : INT2FIX(0));
+  }
+  rb_ary_store(call,0,INT2NUM(comm->header()->flag));
+  rb_ary_store(call,1,rb_pars);
+  rb_ary_store(call,2,rb_derivs);
+  return call;
+}
+//_____________________________________________________________________________
+/* call-seq: reply(rank,fcn_val,derivs) -> self
+ *
+ * Called by worker _rank_ to send back its _fcn_val_ and _derivs_ 
+ * (<tt>nil</tt> entries are sent as 0).
+ */
+VALUE rb_shmcomm_reply(VALUE __self,VALUE __rank,VALUE __fcn_val,
+		       VALUE __derivs){
+  ShmComm *comm;
+  Data_Get_Struct(__self,ShmComm,comm);
+  int rank = NUM2INT(__rank);
+  if(rank < 1 || rank > comm->num_workers) 
+    rb_raise(rb_eArgError,"invalid worker rank %d",rank);
+  int num_pars = comm->header()->num_pars;
+  double *slot = comm->slot(rank);
+  slot[0] = NUM2DBL(__fcn_val);
+  slot[1] = wall_time() - comm->call_start;
+  for(int p = 0; p < num_pars; p++){
+    VALUE deriv = rb_ary_entry(__derivs,p);
+    slot[p + 2] = (deriv == Qnil) ? 0. : NUM2DBL(deriv);
+  }
+  shm_signal_post(comm->done);
+  return __self;
+}
+/* call-seq: reply_hessian(rank,hess) -> self
+ *
+ * Called by worker _rank_ to send back its Hessian _hess_ (Array of Arrays,
+ * num_pars x num_pars).
+ */
+VALUE rb_shmcomm_reply_hessian(VALUE __self,VALUE __rank,VALUE __hess){
+  ShmComm *comm;
+  Data_Get_Struct(__self,ShmComm,comm);
+  int rank = NUM2INT(__rank);
+  if(rank < 1 || rank > comm->num_workers) 
+    rb_raise(rb_eArgError,"invalid worker rank %d",rank);
+  int num_pars = comm->header()->num_pars;
+  double *hess = comm->hess(rank);
+  for(int p = 0; p < num_pars; p++){
+    VALUE row = rb_ary_entry(__hess,p);
+    for(int q = 0; q < num_pars; q++)
+      hess[p*num_pars + q] = NUM2DBL(rb_ary_entry(row,q));
+  }
+  shm_signal_post(comm->done);
+  return __self;
+}
+//_____________________________________________________________________________
+
+extern "C" void Init_shm_comm(){
+  //-+-RDOC-+- 
+  rb_cPWA = rb_define_module("PWA");
+  rb_cShmComm = rb_define_class_under(rb_cPWA,"ShmComm",rb_cObject);
+  rb_define_singleton_method(rb_cShmComm,"new",RUBY_FUNC(rb_shmcomm_new),3);
+  rb_define_method(rb_cShmComm,"watch",RUBY_FUNC(rb_shmcomm_watch),1);
+  rb_define_method(rb_cShmComm,"broadcast",RUBY_FUNC(rb_shmcomm_broadcast),3);
+  rb_define_method(rb_cShmComm,"gather",RUBY_FUNC(rb_shmcomm_gather),1);
+  rb_define_method(rb_cShmComm,"terminate",RUBY_FUNC(rb_shmcomm_terminate),0);
+  rb_define_method(rb_cShmComm,"node_times",RUBY_FUNC(rb_shmcomm_node_times),
+		   0);
+  rb_define_method(rb_cShmComm,"rebalance",RUBY_FUNC(rb_shmcomm_rebalance),1);
+  rb_define_method(rb_cShmComm,"wait_rebalanced",
+		   RUBY_FUNC(rb_shmcomm_wait_rebalanced),0);
+  rb_define_method(rb_cShmComm,"rebalanced",RUBY_FUNC(rb_shmcomm_rebalanced),
+		   1);
+  rb_define_method(rb_cShmComm,"wait_for_call",
+		   RUBY_FUNC(rb_shmcomm_wait_for_call),1);
+  rb_define_method(rb_cShmComm,"reply",RUBY_FUNC(rb_shmcomm_reply),3);
+  rb_define_method(rb_cShmComm,"gather_hessian",
+		   RUBY_FUNC(rb_shmcomm_gather_hessian),1);
+  rb_define_method(rb_cShmComm,"reply_hessian",
+		   RUBY_FUNC(rb_shmcomm_reply_hessian),2);
+}
+//_____________________________________________________________________________
@@ -0,0 +1,79 @@
+// -*- C++ -*-
+// Author: Mike Williams
+//_____________________________________________________________________________
+#ifndef _timers_H
+#define _timers_H
+
+#include <ctime>
+#include <string>
+#include <vector>
+#include <sys/time.h>
+
+using namespace std;
+/*
+ * Low overhead timers used to see where the time goes during a fit. These
+ * don't call into Ruby, so they may be used from worker threads (as long as
+ * each thread has its own).
+ */
+//_____________________________________________________________________________
+/// Returns the wall clock time in seconds
+inline double wall_time(){
+  struct timeval tv;
+  gettimeofday(&tv,0);
+  return tv.tv_sec + 1e-6*tv.tv_usec;
+}
+/// Returns the CPU time (in seconds) used by the calling thread (or the whole
+/// process if per-thread CPU clocks aren't available).
+inline double cpu_time(){
+#ifdef CLOCK_THREAD_CPUTIME_ID
+  struct timespec ts;
+  if(clock_gettime(CLOCK_THREAD_CPUTIME_ID,&ts) == 0)
+    return ts.tv_sec + 1e-9*ts.tv_nsec;
+#endif
+  return clock()/(double)CLOCKS_PER_SEC;
+}
+//_____________________________________________________________________________
+/// Number of calls + wall and CPU time accumulated for 1 phase of a call.
+struct PhaseTimer {
+  int calls;
+  double wall,cpu;             // totals (seconds)
+  double wall_start,cpu_start; // when start was last called
+
+  PhaseTimer() : calls(0),wall(0.),cpu(0.),wall_start(0.),cpu_start(0.) {}
+
+  void start(){
+    wall_start = wall_time();
+    cpu_start = cpu_time();
+  }
+  /// Adds the time since start, returns the wall time taken
+  double stop(){
+    double dwall = wall_time() - wall_start;
+    calls++;
+    wall += dwall;
+    cpu += cpu_time() - cpu_start;
+    return dwall;
+  }
+  void add(const PhaseTimer &__timer){
+    calls += __timer.calls;
+    wall += __timer.wall;
+    cpu += __timer.cpu;
+  }
+  void clear(){
+    calls = 0;
+    wall = cpu = 0.;
+  }
+};
+//_____________________________________________________________________________
+/// A complete event ("ph":"X") in a Chrome trace.
+struct TraceEvent {
+  string name;
+  int tid;     // thread (0 is the one that called fcn)
+  double ts;   // start (seconds since the epoch)
+  double dur;  // duration (seconds)
+
+  TraceEvent(const string &__name,int __tid,double __ts,double __dur)
+    : name(__name),tid(__tid),ts(__ts),dur(__dur) {}
+};
+//_____________________________________________________________________________
+
+#endif /* _timers_H */